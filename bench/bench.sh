@@ -0,0 +1,159 @@
+#!/bin/sh
+#
+# Benchmark of aioblkcopy, run by "make bench" in the build directory.
+# Usage: bench.sh AIOBLKCOPY WORKDIR
+#
+# Copies a file with every built engine and a file through the delay engine, which simulates a device
+# with high latency, and reads block devices given in BENCH_DEVICES (null_blk, device-mapper delay targets)
+# to /dev/null. Every case is run over all block sizes and queue depths, the best rate of BENCH_RUNS runs
+# is printed. Results are kept in WORKDIR/results, the previous ones are moved to WORKDIR/results.prev.
+# With BENCH_BASELINE set to results of an earlier build rates are compared and the script fails
+# if any case got slower by more than BENCH_TOLERANCE percent.
+#
+# Environment:
+#   BENCH_SIZE       megabytes copied in file cases (256)
+#   BENCH_DELAYSIZE  megabytes copied through the delay engine (32)
+#   BENCH_BLKSIZES   block sizes ("64k 256k 1m 4m")
+#   BENCH_DEPTHS     queue depths ("1 4 16 32")
+#   BENCH_ENGINES    engines of file and device cases (all built except delay)
+#   BENCH_DELAY      latency and jitter of the delay engine in microseconds ("1000:200")
+#   BENCH_DEVICES    block devices to read, they are never written
+#   BENCH_RUNS       runs of every case (1)
+#   BENCH_BASELINE   results file to compare with
+#   BENCH_TOLERANCE  allowed slowdown in percent (10)
+#
+
+BIN=$1
+WORK=$2
+
+if [ -z "$BIN" ] || [ -z "$WORK" ]; then
+
+	echo "Usage: $0 AIOBLKCOPY WORKDIR" >&2
+	exit 1
+
+fi
+
+SIZE=${BENCH_SIZE:-256}
+DELAYSIZE=${BENCH_DELAYSIZE:-32}
+BLKSIZES=${BENCH_BLKSIZES:-"64k 256k 1m 4m"}
+DEPTHS=${BENCH_DEPTHS:-"1 4 16 32"}
+DELAY=${BENCH_DELAY:-"1000:200"}
+RUNS=${BENCH_RUNS:-1}
+TOLERANCE=${BENCH_TOLERANCE:-10}
+
+if [ -z "$BENCH_ENGINES" ]; then
+
+	BENCH_ENGINES=$("$BIN" --help 2>&1 | sed -n 's/^ENGINE can be one of: \(.*\)\.$/\1/p' | tr '|' '\n' | grep -v '^delay$' | tr '\n' ' ')
+
+fi
+
+mkdir -p "$WORK" || exit 1
+
+RESULTS=$WORK/results
+
+if [ -f "$RESULTS" ]; then
+
+	mv "$RESULTS" "$RESULTS.prev" || exit 1
+
+fi
+
+: > "$RESULTS"
+
+dd if=/dev/urandom of="$WORK/input" bs=1048576 count="$SIZE" 2>/dev/null || exit 1
+dd if="$WORK/input" of="$WORK/delayinput" bs=1048576 count="$DELAYSIZE" 2>/dev/null || exit 1
+
+# Prints the best rate in MB/s of the copy with given arguments or "failed".
+
+run() {
+
+	best=failed
+	i=0
+
+	while [ "$i" -lt "$RUNS" ]; do
+
+		rm -f "$WORK/output"
+
+		rate=$("$BIN" "$@" 2>&1 | sed -n 's/^[0-9]* bytes copied, .* s, \(.*\) MB\/s$/\1/p')
+
+		if [ -n "$rate" ] && { [ "$best" = failed ] || [ "$(echo "$rate $best" | awk '{ print ($1 > $2) }')" = 1 ]; }; then
+
+			best=$rate
+
+		fi
+
+		i=$((i + 1))
+
+	done
+
+	rm -f "$WORK/output"
+
+	echo "$best"
+
+}
+
+# Runs one case over all block sizes and depths: target name, engine, copy arguments.
+
+sweep() {
+
+	target=$1
+	engine=$2
+	shift 2
+
+	for bs in $BLKSIZES; do
+
+		for q in $DEPTHS; do
+
+			rate=$(run --engine="$engine" --without-zerocopy -b "$bs" -q "$q" "$@")
+
+			printf "%-16s %-16s %8s %6s %10s\n" "$target" "$engine" "$bs" "$q" "$rate"
+
+			echo "$target $engine $bs $q $rate" >> "$RESULTS"
+
+		done
+
+	done
+
+}
+
+printf "%-16s %-16s %8s %6s %10s\n" TARGET ENGINE BLKSIZE DEPTH "MB/s"
+
+for engine in $BENCH_ENGINES; do
+
+	sweep file "$engine" -i "$WORK/input" -o "$WORK/output"
+
+done
+
+sweep delay "delay:$DELAY" -i "$WORK/delayinput" -o "$WORK/output"
+
+for dev in $BENCH_DEVICES; do
+
+	for engine in $BENCH_ENGINES; do
+
+		sweep "$(basename "$dev")" "$engine" -i "$dev" -o /dev/null --count="${SIZE}M"
+
+	done
+
+done
+
+rm -f "$WORK/input" "$WORK/delayinput"
+
+if [ -z "$BENCH_BASELINE" ]; then
+
+	exit 0
+
+fi
+
+echo
+echo "Compared with $BENCH_BASELINE, tolerance $TOLERANCE%:"
+
+awk -v tol="$TOLERANCE" '
+	NR == FNR { base[$1 " " $2 " " $3 " " $4] = $5; next }
+	{
+		key = $1 " " $2 " " $3 " " $4
+		if (!(key in base) || (base[key] == "failed")) next
+		if ($5 == "failed") { printf "%-43s failed, was %s\n", key, base[key]; bad = 1; next }
+		change = ($5 - base[key]) * 100 / base[key]
+		if (change < -tol) { printf "%-43s %10s, was %s (%.1f%%)\n", key, $5, base[key], change; bad = 1 }
+	}
+	END { if (bad) exit 1; print "no regressions" }
+' "$BENCH_BASELINE" "$RESULTS"
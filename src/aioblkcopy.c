@@ -26,40 +26,81 @@ along with this program; if not, write to the Free Software
 Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 */
 
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <errno.h>
 #include <string.h>
-#include <sys/param.h>
-#include <sys/types.h>
-#include <sys/stat.h>
-#include <sys/time.h>
 #include <signal.h>
 #include <unistd.h>
-#include <fcntl.h>
-#include <aio.h>
 #include <getopt.h>
+#include <pthread.h>
 
 #include "aioblkcopy.h"
+#include "copyjob.h"
+#include "batch.h"
+#include "ioengine.h"
+#include "autotune.h"
+#include "sparse.h"
+#include "journal.h"
+#include "compress.h"
+#include "verify.h"
+#include "workers.h"
+#include "stats.h"
+#include "topology.h"
+#include "rescue.h"
+#include "pagecache.h"
+#include "numa.h"
 
 /*
- * The program configuration parameters.
+ * The program configuration parameters, the copy itself is done by copyjob.c.
  */
 
-struct globalparams {
-    int blksize;       /* working block size -b and --blocksize*/
-    int maxqsize;    /* maximum queue size -q and --maxqsize*/
-    char *inputfile;   /* input file -i */
-    char *outputfile;  /* output file -o */
+struct copyparams globalparams;
 
-    #ifdef _GNU_SOURCE
+/*
+ * Batch mode takes inputs and outputs from jobs file instead of -i and -o.
+ */
 
-    int wo_di_inp;     /* disable O_DIRECT on input --without-directio-input*/
-    int wo_di_out;     /* disable O_DIRECT on output --without-directio-output*/
+static char *jobsfile = NULL;
 
-    #endif
+static int jobsparallel = BATCH_DEFAULT_PARALLEL;
 
-} globalparams;
+static int jobsinflight = 0;
+
+/*
+ * Codes of options which have no short form.
+ */
+
+#define OPT_ENGINE 256
+#define OPT_READDEPTH 257
+#define OPT_WRITEDEPTH 258
+#define OPT_STAGING 259
+#define OPT_SPARSE 260
+#define OPT_JOURNAL 261
+#define OPT_STREAMS 262
+#define OPT_LISTEN 263
+#define OPT_CONNECT 264
+#define OPT_COMPRESS 265
+#define OPT_WORKTHREADS 266
+#define OPT_VERIFY 267
+#define OPT_PROGRESS 268
+#define OPT_STATSJSON 269
+#define OPT_STATSPROM 270
+#define OPT_MAXRATE 271
+#define OPT_MAXIOPS 272
+#define OPT_THROTTLEFILE 273
+#define OPT_SKIP 274
+#define OPT_SEEK 275
+#define OPT_COUNT 276
+#define OPT_ONERROR 277
+#define OPT_ERRORMAP 278
+#define OPT_SYNC 279
+#define OPT_JOBS 280
+#define OPT_PARALLEL 281
+#define OPT_INFLIGHT 282
+#define OPT_NUMA 283
+#define OPT_SQPOLL 284
 
 static const char *optstr = "i:o:b:q:h";
 
@@ -68,11 +109,47 @@ static const struct option optarray[] = {
     { "output-file", required_argument, NULL, 'o' },
     { "blksize", required_argument, NULL, 'b' },
     { "maxqsize", required_argument, NULL, 'q' },
+    { "read-depth", required_argument, NULL, OPT_READDEPTH },
+    { "write-depth", required_argument, NULL, OPT_WRITEDEPTH },
+    { "staging", required_argument, NULL, OPT_STAGING },
+    { "engine", required_argument, NULL, OPT_ENGINE },
+    { "hugepages", no_argument, &globalparams.hugepages, 1 },
+    { "mlock", no_argument, &globalparams.mlock, 1 },
+    { "auto", no_argument, &globalparams.autotune, 1 },
+    { "sparse", optional_argument, NULL, OPT_SPARSE },
+    { "delta", no_argument, &globalparams.delta, 1 },
+    { "journal", required_argument, NULL, OPT_JOURNAL },
+    { "resume", no_argument, &globalparams.resume, 1 },
+    { "streams", required_argument, NULL, OPT_STREAMS },
+    { "without-zerocopy", no_argument, &globalparams.wo_zerocopy, 1 },
+    { "listen", required_argument, NULL, OPT_LISTEN },
+    { "connect", required_argument, NULL, OPT_CONNECT },
+    { "compress", required_argument, NULL, OPT_COMPRESS },
+    { "work-threads", required_argument, NULL, OPT_WORKTHREADS },
+    { "verify", optional_argument, NULL, OPT_VERIFY },
+    { "progress", optional_argument, NULL, OPT_PROGRESS },
+    { "stats-json", required_argument, NULL, OPT_STATSJSON },
+    { "stats-prom", required_argument, NULL, OPT_STATSPROM },
+    { "max-rate", required_argument, NULL, OPT_MAXRATE },
+    { "max-iops", required_argument, NULL, OPT_MAXIOPS },
+    { "throttle-file", required_argument, NULL, OPT_THROTTLEFILE },
+    { "skip", required_argument, NULL, OPT_SKIP },
+    { "seek", required_argument, NULL, OPT_SEEK },
+    { "count", required_argument, NULL, OPT_COUNT },
+    { "on-error", required_argument, NULL, OPT_ONERROR },
+    { "error-map", required_argument, NULL, OPT_ERRORMAP },
+    { "sync", required_argument, NULL, OPT_SYNC },
+    { "drop-cache", no_argument, &globalparams.dropcache, 1 },
+    { "jobs", required_argument, NULL, OPT_JOBS },
+    { "parallel", required_argument, NULL, OPT_PARALLEL },
+    { "inflight", required_argument, NULL, OPT_INFLIGHT },
+    { "numa", optional_argument, NULL, OPT_NUMA },
+    { "sqpoll", optional_argument, NULL, OPT_SQPOLL },
 
     #ifdef _GNU_SOURCE
 
-    { "without-directio-input", required_argument, &globalparams.wo_di_inp, 1 },
-    { "without-directio-output", required_argument, &globalparams.wo_di_out, 1 },
+    { "without-directio-input", no_argument, &globalparams.wo_di_inp, 1 },
+    { "without-directio-output", no_argument, &globalparams.wo_di_out, 1 },
 
     #endif
 
@@ -81,14 +158,25 @@ static const struct option optarray[] = {
 };
 
 /*
- * The AIO signal handler.
+ * Parses queue size given to -q, --read-depth or --write-depth.
  */
 
-static void aiosighandler( int sig, siginfo_t *si, void *ucontext ) {
+static int parseqsize( const char *str ) {
 
-	#ifdef AIOBLKCOPY_DEBUG
-	write(STDERR_FILENO, "IO_SIGNAL received\n", 20);
-	#endif
+	long long tint;
+	char *bsuffix;
+
+	tint = strtoul(str, &bsuffix, 10);
+
+	if (( tint < 1 ) || ( tint > MAX_QUEUESIZE ) || (bsuffix[0] != '\0' ) ) {
+
+		fprintf(stderr, "Wrong maximum queue size, must be positive decimal between 1 and %i!\n", MAX_QUEUESIZE);
+
+		exit(EXIT_USAGE);
+
+	}
+
+	return tint;
 
 }
 
@@ -103,9 +191,45 @@ Asynchronous block copying tool.\n\n\
 Mandatory arguments to long options are mandatory for short options too.\n\
     -h, --help                    display this help and exit\n\
     -i, --input-file=FILENAME     source file\n\
-    -o, --output-file=FILENAME    destination file\n\
+    -o, --output-file=FILENAME    destination file, can be given up to %i times\n\
     -q, --maxqsize=QUEUESIZE      maximum size of working queue\n\
-    -b, --blocksize=BLOCKSIZE     size of working data block\n");
+    -b, --blocksize=BLOCKSIZE     size of working data block\n\
+    --read-depth=QUEUESIZE        maximum number of simultaneous read requests\n\
+    --write-depth=QUEUESIZE       maximum number of simultaneous write requests\n\
+    --staging=SIZE                memory for blocks already read but not written yet\n\
+    --engine=ENGINE               I/O engine to use\n\
+    --hugepages                   use huge pages for data buffers\n\
+    --mlock                       lock data buffers in memory\n\
+    --auto                        tune queue depths and block size while copying\n\
+    --sparse[=METHOD]             do not copy holes and zero blocks\n\
+    --delta                       read output and write only changed blocks\n\
+    --journal=FILE                record copy progress in FILE\n\
+    --resume                      continue interrupted copy recorded in journal\n\
+    --streams=N                   copy N ranges of input in parallel threads\n\
+    --without-zerocopy            do not copy inside the kernel with splice or copy_file_range\n\
+    --listen=[HOST:]PORT          receive blocks from aioblkcopy --connect instead of input file\n\
+    --connect=HOST:PORT           send blocks to aioblkcopy --listen instead of output file\n\
+    --compress=METHOD             compress blocks sent with --connect\n\
+    --work-threads=N              hashing and compression threads of every stream\n\
+    --verify[=readback]           hash blocks and print digest of the copy, read written blocks back\n\
+    --progress[=SECONDS]          print progress every SECONDS\n\
+    --stats-json=FILE             keep statistics in FILE in JSON\n\
+    --stats-prom=FILE             keep statistics in FILE in Prometheus text format\n\
+    --max-rate=SIZE               limit reads and writes to SIZE bytes per second each\n\
+    --max-iops=N                  limit reads and writes to N requests per second each\n\
+    --throttle-file=FILE          read new limits from FILE on SIGHUP\n\
+    --skip=SIZE                   start reading input at offset SIZE\n\
+    --seek=SIZE                   start writing output at offset SIZE\n\
+    --count=SIZE                  copy only SIZE bytes\n\
+    --on-error=METHOD             what to do when input can't be read\n\
+    --error-map=FILE              record unreadable ranges of input in FILE\n\
+    --sync=POLICY                 make written data durable: none (default), end or every=SIZE\n\
+    --drop-cache                  keep data of files without direct io out of page cache\n\
+    --jobs=FILE                   copy every input listed in FILE to its outputs\n\
+    --parallel=N                  number of --jobs copying at the same time\n\
+    --inflight=N                  data blocks in flight over all --jobs\n\
+    --numa[=NODE]                 place buffers and copy threads on NUMA node of the devices\n\
+    --sqpoll[=CPU]                submit uring requests by kernel thread on its own CPU\n", MAX_OUTPUTS);
 
 	#ifdef _GNU_SOURCE
 
@@ -117,209 +241,282 @@ Mandatory arguments to long options are mandatory for short options too.\n\
 	fprintf(stderr, "\n\
 FILENAME can be any file. Output file created if not existed and truncated if existed without prompt.\n\
 If no filenames given standard input and output used instead.\n\
-QUEUESIZE must be positive decimal between 1 and 32 and determines maximum number of input and output simultaneous requests.\n\
-BLOCKSIZE can be given in bytes, kilobytes(suffixes k or K needed) or megabytes(suffixes m or M needed).\n\
-QUEUESIZE by default is %i, BLOCKSIZE by default is %i.\n", DEFAULT_MAXQUEUESIZE, DEFAULT_BLKSIZE);
+With several output files blocks are read once and written to all of them, every output has its own write queue,\n\
+so the slowest one sets the pace only when staging memory is used up. Sparse and delta byte counts are sums over outputs.\n\
+QUEUESIZE must be positive decimal between 1 and %i and determines maximum number of input and output simultaneous requests.\n\
+--read-depth and --write-depth override -q for one side.\n\
+BLOCKSIZE and SIZE can be given in bytes, kilobytes(suffixes k or K needed), megabytes(suffixes m or M needed)\n\
+or gigabytes(suffixes g or G needed).\n\
+QUEUESIZE by default is %i, BLOCKSIZE by default is %i rounded up to a multiple of optimal io size of input\n\
+and output devices or, if they don't report it, of their minimal io size and physical block size.\n\
+Over the network the default isn't rounded. With direct io BLOCKSIZE must be a multiple of logical block size.\n\
+By default no staging memory is used, so read requests wait for free input queue items.\n\
+With --auto queue sizes are upper limits (%i if not given) and BLOCKSIZE is the starting block size\n\
+changed between %i and %i bytes while copying.\n\
+With --sparse holes of regular input files aren't read and zero blocks aren't written, METHOD can be:\n\
+skip (nothing is done, default for regular output files), punch (holes are punched in output file),\n\
+zeroout (BLKZEROOUT, default for block devices), discard (BLKDISCARD, only for devices returning zeroes).\n\
+With --delta output isn't truncated, every block is read from output first and written only if it differs,\n\
+regular output file is truncated to input size at the end.\n\
+Journal is updated every %lld seconds after output is synced, --resume skips ranges written according to it\n\
+without truncating output. Both journal and resume need seekable input and output and only one output file.\n\
+With --streams input is split into N ranges (1 to %i), every range is copied by its own thread with its own queues,\n\
+I/O engine and buffers, so queue sizes, staging memory and autotuning are per stream.\n\
+If data isn't looked at (no --sparse, --delta, --journal, --streams or --auto) it's copied inside the kernel:\n\
+with copy_file_range between regular files, with splice if one side is a pipe and the other doesn't use direct io.\n\
+Sender uses one TCP connection per stream, every block carries its offset, so receiver writes blocks as they come.\n\
+Receiver takes the number of connections from the sender, several connections need seekable output.\n\
+With --compress blocks are packed by worker threads after they are read and sent as is if that doesn't make them smaller,\n\
+receiver unpacks them with the method the sender announces. By default streams share all CPUs for compression\n\
+and hashing.\n\
+With --verify blocks are hashed with XXH3 after they are read, the digest is the sum of hashes of all nonzero\n\
+%i byte sectors seeded with their offsets from --skip, so it doesn't depend on block size. Ranges skipped by --resume aren't hashed.\n\
+With --verify=readback every written block is read back and mismatching offsets are reported, without direct io\n\
+blocks are read back from page cache. Receiver hashes blocks if the sender does and compares them with hashes sent along.\n\
+With --progress bytes copied, current rate, time left, queue occupancy and read and write latency percentiles\n\
+of the last interval are printed every %i seconds if SECONDS aren't given. They are printed on SIGUSR2 at any time.\n\
+Statistics files are replaced on the same interval and at the end: bytes and requests of both sides, short transfer\n\
+retries, cancellations, writes beyond the end of output, queue depths and latency histograms.\n\
+Limits are shared by all streams, requests over them aren't submitted until tokens are refilled, so fewer requests\n\
+are in flight. Throttle file has lines max-rate=SIZE and max-iops=N, a missing line means no limit.\n\
+Input which isn't seekable is read and thrown away up to --skip. Output isn't truncated with --seek and --on-error=skip.\n\
+Requests with offset, length or memory not aligned to logical block size of the sides using direct io (block size\n\
+of the file system or the alignment statx reports for files) don't use direct io, so only the head and the tail\n\
+of an unaligned range go through page cache. The rest is direct if --skip and --seek differ by a multiple of it.\n\
+METHOD of --on-error is abort (default), retry, skip or zero. Failed read is repeated %i times, the first time after\n\
+%lld ms and every next time twice later, then retry stops the copy. Skip and zero bisect the failing block down\n\
+to sectors of input (pages without direct io) while the other blocks are copied as usual. Unreadable sectors\n\
+are written as zeroes by zero and left in output as they are by skip. Error map has lines range START END.\n\
+With --sync=end regular and block device outputs are synced after the copy, with --sync=every=SIZE also in the background\n\
+every SIZE bytes written to an output, writes go on meanwhile. The time of the last sync is included in the copy rate.\n\
+With --drop-cache input without direct io is read ahead %i MB or two blocks from the read requests and its pages\n\
+are dropped as soon as they are read, writeback of output pages is started when they are written and they are dropped\n\
+once that much newer data is written. Pages cached before the copy are dropped too.\n\
+Jobs file has lines INPUT OUTPUT [OUTPUT]..., names are separated by spaces, lines starting with # are skipped.\n\
+Jobs run with the other options, the biggest inputs first, %i at a time by default. Blocks read but not written yet\n\
+take buffers of one pool shared by all jobs, --inflight buffers (--parallel times --streams times QUEUESIZE by default)\n\
+are divided equally between streams copying, so the jobs left at the end get the whole pool. SIGUSR2 prints\n\
+progress of running jobs. All jobs use the same block size, %i KiB unless -b is given, it isn't rounded\n\
+to device topology. --journal, --resume, --error-map, statistics files, --progress, --throttle-file and network\n\
+can't be used with --jobs.\n\
+With --numa data buffers are allocated on NODE or, if it isn't given, on the node of the PCI device behind input\n\
+(output if input has none) found in sysfs, device-mapper and md devices take the node of their first slave.\n\
+Copy threads, their workers and AIO threads run on CPUs of the node. With --jobs the shared buffers are placed\n\
+on the node of the first job. --sqpoll uses uring engine with a kernel thread taking requests from the ring,\n\
+on the last CPU of the --numa node (the copy threads don't run there) or on CPU if it's given.\n", \
+			MAX_QUEUESIZE, DEFAULT_MAXQUEUESIZE, DEFAULT_BLKSIZE, MAX_QUEUESIZE, AUTOTUNE_MINBLKSIZE, AUTOTUNE_MAXBLKSIZE, \
+			JOURNAL_INTERVAL_NS / 1000000000, MAX_STREAMS, VERIFY_SECTOR, STATS_INTERVAL, RESCUE_RETRIES, RESCUE_BACKOFF_NS / 1000000, \
+			PAGECACHE_WINDOW / 1024 / 1024, BATCH_DEFAULT_PARALLEL, DEFAULT_BLKSIZE / 1024);
+
+	fprintf(stderr, "ENGINE can be one of: ");
+
+	ioengine_list(stderr);
+
+	fprintf(stderr, ".\n\
+By default the first engine which works on this system is used, libaio only if direct io is used for both files.\n");
+
+	#ifdef HAVE_DELAY_ENGINE
+
+	fprintf(stderr, "Engine delay[:LATENCY[:JITTER]] is never used by default, it does requests with pread and pwrite\n\
+and completes them LATENCY microseconds (1000 if not given) after they are queued, give or take random JITTER.\n");
+
+	#endif
+
+	fprintf(stderr, "METHOD can be one of: ");
+
+	compress_list(stderr);
+
+	fprintf(stderr, ".\n");
 
 }
 
-int main( int argc, char *argv[] ) {
 
-	/*
-	 * Temporary file descriptors.
-	 */
-	int ifd = -1;
-	int ofd = -1;
+/*
+ * Reads limits from throttle file, they are kept if the file can't be read or is wrong.
+ */
 
-	/*
-	 * Requests numbering needed for write ordering.
-	 */
-	long long irqnum = 0;
-	long long orqnum = 0;
+static void loadthrottle( struct copyjob *job, const char *path ) {
 
-	size_t ioff = 0;
-	size_t ooff = 0;
+	char line[256];
+	long long rate = 0;
+	long long iops = 0;
+	long long *val;
+	char *arg;
+	FILE *f;
 
-	/*
-	 * Current queue size. Mostly needed for debugging.
-	 */
+	f = fopen(path, "r");
 
-	int iqsize = 0;
-	int oqsize = 0;
+	if (f == NULL) {
 
-	/*
-	 * Maximum queues size.
-	 */
-	int imaxqsize;
-	int omaxqsize;
+		perror(path);
 
-	/*
-	 * pipes, fifos, character devices can't do lseek(), so queueing on them is useless.
-	 */
-	int iseekable;
-	int oseekable;
+		return;
 
-	/*
-	 * Used for end of data detection.
-	 */
-	int eof = 0;
+	}
 
-	/*
-	 * Working queues.
-	 */
-	struct blkqueitem *ique;
-	struct blkqueitem *oque;
+	while(fgets(line, sizeof(line), f) != NULL) {
 
-	struct sigaction sa;
-	struct timeval to;
+		line[strcspn(line, "\r\n")] = '\0';
 
-	int i;
-	int j;
+		if ((line[0] == '\0') || (line[0] == '#')) continue;
 
-	/*
-	 * Only needed on initialization.
-	 */
-	struct stat statdata;
-	int fflags;
+		arg = strchr(line, '=');
 
-	/*
-	 * Variables for statistics.
-	 */
-	struct timeval starttime;
-	struct timeval endtime;
-	double	workingtime;
+		if (arg != NULL) *arg++ = '\0';
 
-	/*
-	 * Variables for command line parsing.
-	 */
-	int opt;
-	int paramsindex;
-	long long tint;
-	char *bsuffix;
+		if (strcmp(line, "max-rate") == 0) val = &rate;
+		else if (strcmp(line, "max-iops") == 0) val = &iops;
+		else val = NULL;
 
+		if ((val == NULL) || (arg == NULL) || ((*val = copy_parsesize(arg)) == -1)) {
 
-	/*
-	 * Initialize default global parameters.
-	 */
+			fprintf(stderr, "Wrong line in throttle file %s: %s\n", path, line);
 
-	globalparams.blksize = DEFAULT_BLKSIZE;
-	globalparams.maxqsize = DEFAULT_MAXQUEUESIZE;
-	globalparams.inputfile = NULL;
-	globalparams.outputfile = NULL;
+			fclose(f);
 
-	#ifdef _GNU_SOURCE
+			return;
 
-	globalparams.wo_di_inp = 0;
-	globalparams.wo_di_out = 0;
+		}
 
-    #endif
+	}
+
+	fclose(f);
+
+	if (copy_job_throttle(job, rate, iops) == -1) return;
+
+	fprintf(stderr, "Throttle: %lld bytes/s, %lld requests/s\n", rate, iops);
+
+}
+
+/*
+ * Progress is printed by the monitor of the job every --progress seconds and by status thread on status signals.
+ */
+
+struct progress {
+
+	pthread_t thread;
+
+	sigset_t sigset;
+
+	int stop;
+
+	struct copyjob *job;
 
 	/*
-	 * Parse command line.
+	 * Jobs file run, status signals print progress of its running jobs.
 	 */
+	struct copybatch *batch;
 
-	for(;;) {
+	pthread_mutex_t lock;
 
-		opt = getopt_long(argc, argv, optstr, optarray, &paramsindex);
+	struct statsnap snap;
 
-		if (opt == -1) break;
+	/*
+	 * State of the previous report, rate and latencies are of the interval since it.
+	 */
+	long long last;
 
-		switch(opt) {
+	size_t lastdone;
 
-		case 'i':
+	struct lathist prevrd;
 
-			globalparams.inputfile = optarg;
-			break;
+	struct lathist prevwr;
 
-		case 'o':
+	struct lathist intrd;
 
-			globalparams.outputfile = optarg;
-			break;
+	struct lathist intwr;
 
-		case 'q':
+} progress;
 
-			tint = strtoul(optarg, &bsuffix, 10);
+static void printprogress(struct progress *pg, const struct statsnap *snap) {
 
-			if (( tint < 1 ) || ( tint > 32 ) || (bsuffix[0] != '\0' ) ) {
+	double elapsed = (double)snap->elapsed / 1000000000;
+	double interval = (double)(snap->elapsed - pg->last) / 1000000000;
+	long long eta;
 
-				fprintf(stderr, "Wrong maximum queue size, must be positive decimal between 1 and 32!\n");
+	lathist_diff(&pg->intrd, &snap->rd, &pg->prevrd);
+	lathist_diff(&pg->intwr, &snap->wr, &pg->prevwr);
 
-				exit(EXIT_USAGE);
+	flockfile(stderr);
 
-			}
+	fprintf(stderr, "%lld bytes copied, %.1f s, %.2f MB/s", (long long)snap->done, elapsed, \
+			(interval > 0) ? (snap->done - pg->lastdone) / interval / 1024 / 1024 : 0);
 
-			globalparams.maxqsize = tint;
+	if ((snap->total > 0) && (snap->done > 0) && ((off_t)snap->done <= snap->total)) {
 
-			break;
+		eta = (snap->total - snap->done) * elapsed / snap->done;
 
-		case 'b':
+		fprintf(stderr, ", %.1f%%, ETA %lld:%02lld:%02lld", 100.0 * snap->done / snap->total, eta / 3600, eta / 60 % 60, eta % 60);
 
-			errno = 0;
+	}
 
-			tint = strtoul(optarg, &bsuffix, 10);
+	fprintf(stderr, "\n");
 
-			if (errno != 0) CUSTOMERROR("strtoul()");
+	/*
+	 * Copy inside the kernel has no queues.
+	 */
 
-			if (bsuffix[0] != '\0') {
+	if (snap->ilimit + snap->olimit != 0) {
 
-				if (bsuffix[1] == '\0') {
+		fprintf(stderr, "read queue %i/%i, write queue %i/%i, ", snap->iqsize, snap->ilimit, snap->oqsize, snap->olimit);
 
-					switch(bsuffix[0]) {
+		stats_printlat(stderr, "read", &pg->intrd);
 
-					case 'K':
-					case 'k':
+		fprintf(stderr, ", ");
 
-						tint = tint * 1024;
+		stats_printlat(stderr, "write", &pg->intwr);
 
-						break;
+		fprintf(stderr, "\n");
 
-					case 'M':
-					case 'm':
+	}
 
-						tint = tint * 1024 * 1024;
+	funlockfile(stderr);
 
-						break;
+	pg->prevrd = snap->rd;
+	pg->prevwr = snap->wr;
+	pg->last = snap->elapsed;
+	pg->lastdone = snap->done;
 
-					default:
+}
 
-						fprintf(stderr, "Block size suffix must be K for kilobytes or M for megabytes!\n");
-						exit(EXIT_USAGE);
-						break;
+/*
+ * One line for every running job of the batch.
+ */
 
-					}
+static void printbatch(struct progress *pg) {
 
-				}
-				else {
+	struct copyjob *job;
+	int done = 0;
+	int i;
 
-					fprintf(stderr, "Block size suffix must be K for kilobytes or M for megabytes!\n");
-					exit(EXIT_USAGE);
+	flockfile(stderr);
 
-				}
+	for(i = 0; i < copy_batch_count(pg->batch); i++) {
 
-			}
+		job = copy_batch_job(pg->batch, i);
 
-			if ((tint % 512) != 0) {
+		switch(copy_job_poll(job, &pg->snap)) {
 
-				fprintf(stderr, "Block size must be multiple of 512!\n");
-				exit(EXIT_USAGE);
+		case COPYJOB_RUNNING:
 
-			}
+			fprintf(stderr, "%s: %lld bytes copied, %.1f s", copy_batch_input(pg->batch, i), \
+					(long long)pg->snap.done, (double)pg->snap.elapsed / 1000000000);
 
-			if (tint > 1024*1024*16) {
+			if ((pg->snap.total > 0) && ((off_t)pg->snap.done <= pg->snap.total)) {
 
-				fprintf(stderr, "Block size too big! Must be less then 16 megabytes.\n");
-				exit(EXIT_USAGE);
+				fprintf(stderr, ", %.1f%%", 100.0 * pg->snap.done / pg->snap.total);
 
 			}
 
-			globalparams.blksize = tint;
+			fprintf(stderr, "\n");
 
 			break;
 
-		case 'h':
+		case COPYJOB_DONE:
+		case COPYJOB_FAILED:
+
+			done++ ;
 
-			usage();
-			exit(EXIT_USAGE);
 			break;
 
 		default:
@@ -328,629 +525,847 @@ int main( int argc, char *argv[] ) {
 
 		}
 
-
 	}
 
-	imaxqsize = globalparams.maxqsize;
-	omaxqsize = globalparams.maxqsize;
+	fprintf(stderr, "%i of %i jobs done\n", done, copy_batch_count(pg->batch));
 
-	/*
-	 * Check if the input file is regular file or block device.
-	 * I suppose that only on regular files and block devices are possible to do lseek() and
-	 * submit simultaneous read/write requests.
-	 * Also for these descriptors there is no point to do many requests simultaneously.
- 	 */
+	funlockfile(stderr);
 
-	if (globalparams.inputfile != NULL) {
+}
 
-		if (stat(globalparams.inputfile, &statdata) == -1) CUSTOMERROR("stat()");
+/*
+ * Progress callback of the job.
+ */
 
-		if ( !( S_ISREG(statdata.st_mode) || S_ISBLK(statdata.st_mode) ) ) {
+static void progressreport(struct copyjob *job, const struct statsnap *snap, void *arg) {
 
-			iseekable = 0;
+	struct progress *pg = arg;
 
-			imaxqsize = 1;
+	pthread_mutex_lock(&pg->lock);
 
-		}
-		else {
+	printprogress(pg, snap);
 
-			iseekable = 1;
+	pthread_mutex_unlock(&pg->lock);
 
-		}
+}
 
-	}
-	else {
+/*
+ * Verification callback of the job, arg is the name printed before the message or NULL.
+ */
 
-		iseekable = 0;
+static void verifyreport(struct copyjob *job, long long off, size_t len, void *arg) {
 
-		imaxqsize = 1;
+	fprintf(stderr, "%s%sVerification failed at offset %lld, %zu bytes\n", (arg != NULL) ? (const char *)arg : "", \
+			(arg != NULL) ? ": " : "", off, len);
 
-		/*
-		 * if a user doesn't give us a input file name we'll use STDIN.
-		 */
+}
 
-		ifd = STDIN_FILENO;
+/*
+ * Status thread takes the status signals which are blocked in all other threads.
+ */
 
-	}
+static void *statusthread(void *arg) {
 
-	/*
-	 * The same for outputfile.
-	 */
+	struct progress *pg = arg;
+	int sig;
+
+	for(;;) {
 
-	if (globalparams.outputfile != NULL) {
+		sig = sigwaitinfo(&pg->sigset, NULL);
 
-		if (stat(globalparams.outputfile, &statdata) == -1)	if (errno != ENOENT) CUSTOMERROR("stat()");
+		if (STATS_GET(pg->stop) == 1) break;
 
-		if ( !( S_ISREG(statdata.st_mode) || S_ISBLK(statdata.st_mode) ) ) {
+		if (sig == -1) continue;
 
-			oseekable = 0;
+		if (sig == SIGHUP) {
 
-			omaxqsize = 1;
+			loadthrottle(pg->job, globalparams.throttlefile);
+
+			continue;
+
+		}
+
+		pthread_mutex_lock(&pg->lock);
+
+		if (pg->batch != NULL) {
+
+			printbatch(pg);
 
 		}
 		else {
 
-			oseekable = 1;
+			copy_job_poll(pg->job, &pg->snap);
+
+			printprogress(pg, &pg->snap);
 
 		}
 
+		pthread_mutex_unlock(&pg->lock);
+
 	}
-	else {
 
-		oseekable = 0;
+	return NULL;
 
-		omaxqsize = 1;
+}
 
-		/*
-		 * if a user doesn't give us a output file name we'll use STDOUT.
-		*/
+static void printerror(const struct copyerror *err) {
 
-		ofd = STDOUT_FILENO;
+	if (err->message[0] != '\0') fprintf(stderr, "%s\n", err->message);
 
+	if (err->func != NULL) {
+
+		fprintf(stderr, "Error occurred at file %s line(%d):\n", err->file, err->line);
+
+		fprintf(stderr, "%s: %s\n", err->func, strerror(err->code));
 
 	}
 
-	#ifdef AIOBLKCOPY_DEBUG
-	printf("inputfile: %s\noutputfile: %s \niseekable: %i : %i imaxqsize: %i omaxqsize: %i maxqsize: %i blksize: %i\n", \
-			globalparams.inputfile, globalparams.outputfile, iseekable, oseekable, imaxqsize, omaxqsize, globalparams.maxqsize, globalparams.blksize);
-	#endif
+}
 
-	/*
-	 * Initialize input and output queues.
-	 */
+/*
+ * Prints why the job failed and ends the program.
+ */
+
+static void joberror(const struct copyerror *err) {
+
+	printerror(err);
+
+	exit((err->usage == 1) ? EXIT_USAGE : EXIT_FAILURE);
+
+}
 
-	ique = malloc(sizeof(struct blkqueitem) * imaxqsize);
+/*
+ * Completion signals of the copy and status signals are blocked before any thread starts,
+ * so all threads inherit the mask. Status signals are taken only by status thread.
+ */
 
-	if (ique == NULL) CUSTOMERROR("malloc()");
+static void startstatus(struct progress *pg) {
 
-	oque = malloc(sizeof(struct blkqueitem) * omaxqsize);
+	sigset_t ioset;
 
-	if (oque == NULL) CUSTOMERROR("malloc()");
+	copy_job_sigset(&ioset);
 
-	memset(ique, 0, sizeof(struct blkqueitem) * imaxqsize);
-	memset(oque, 0, sizeof(struct blkqueitem) * omaxqsize);
+	if (pthread_sigmask(SIG_BLOCK, &ioset, NULL) != 0) CUSTOMERROR("pthread_sigmask()");
 
-	for(i = 0; i < imaxqsize; i++) {
+	sigemptyset(&pg->sigset);
+	sigaddset(&pg->sigset, SIGUSR2);
 
-		ique[i].aiodata = malloc(sizeof(struct aiocb));
+	#ifdef SIGINFO
+	sigaddset(&pg->sigset, SIGINFO);
+	#endif
 
-		if (ique[i].aiodata == NULL) CUSTOMERROR("malloc");
+	if (globalparams.throttlefile != NULL) sigaddset(&pg->sigset, SIGHUP);
 
-		memset(ique[i].aiodata, 0, sizeof(struct aiocb));
+	if (pthread_sigmask(SIG_BLOCK, &pg->sigset, NULL) != 0) CUSTOMERROR("pthread_sigmask()");
 
-		ique[i].status = QUEITEM_FREE;
+	if (pthread_mutex_init(&pg->lock, NULL) != 0) CUSTOMERROR("pthread_mutex_init()");
 
-		fflags = O_RDONLY;
+	if (pthread_create(&pg->thread, NULL, statusthread, pg) != 0) CUSTOMERROR("pthread_create()");
 
-		#ifdef _GNU_SOURCE
+}
 
-		if ((globalparams.wo_di_inp == 0) && (iseekable == 1)) {
+static void stopstatus(struct progress *pg) {
 
-			fflags = fflags | O_DIRECT;
+	STATS_SET(pg->stop, 1);
 
-		}
+	if (pthread_kill(pg->thread, SIGUSR2) != 0) CUSTOMERROR("pthread_kill()");
 
-		#endif
+	if (pthread_join(pg->thread, NULL) != 0) CUSTOMERROR("pthread_join()");
 
-		if ((iseekable == 0) && (ifd != -1)) {
+}
 
-			ique[i].fd = ifd;
+/*
+ * Reads jobs file into the batch, wrong file ends the program.
+ */
 
-		}
+static void loadjobs(struct copybatch *batch, const char *path) {
 
-		else {
+	char line[4096];
+	char *names[1 + MAX_OUTPUTS];
+	char *tok;
+	int lineno = 0;
+	int n;
+	FILE *f;
 
-			/*
-			 * We can't use fcntl DUP_FD, because we need independent seeking on descriptors.
-			 * If someone knows that it's not true let me know.
-			 */
+	f = fopen(path, "r");
 
-			ique[i].fd = open(globalparams.inputfile, fflags);
+	if (f == NULL) {
 
-			if (ique[i].fd == -1) CUSTOMERROR("open()");
+		perror(path);
 
-		}
+		exit(EXIT_USAGE);
 
 	}
 
-	for(i = 0; i < omaxqsize; i++) {
+	while(fgets(line, sizeof(line), f) != NULL) {
 
-		oque[i].aiodata = malloc(sizeof(struct aiocb));
+		lineno++ ;
 
-		if (oque[i].aiodata == NULL) CUSTOMERROR("malloc");
+		line[strcspn(line, "\r\n")] = '\0';
 
-		memset(oque[i].aiodata, 0, sizeof(struct aiocb));
+		n = 0;
 
-		oque[i].status =  QUEITEM_FREE;
+		for(tok = strtok(line, " \t"); (tok != NULL) && (n <= MAX_OUTPUTS); tok = strtok(NULL, " \t")) names[n++] = tok;
 
-		fflags = O_WRONLY | O_CREAT | O_TRUNC;
+		if ((n == 0) || (names[0][0] == '#')) continue;
 
-		#ifdef _GNU_SOURCE
+		if ((n < 2) || (tok != NULL)) {
 
-		if ((globalparams.wo_di_out == 0) && ( oseekable == 1)) {
+			fprintf(stderr, "Wrong line %i in jobs file %s, it must have input and 1 to %i outputs!\n", lineno, path, MAX_OUTPUTS);
 
-			fflags = fflags | O_DIRECT ;
+			exit(EXIT_USAGE);
 
 		}
 
-		#endif
+		if (copy_batch_add(batch, names[0], names + 1, n - 1) == -1) CUSTOMERROR("copy_batch_add()");
 
-		if (( oseekable == 0) && (ofd != -1)) {
+	}
 
-			oque[i].fd = ofd;
+	fclose(f);
 
-		}
+	if (copy_batch_count(batch) == 0) {
 
-		else {
+		fprintf(stderr, "No jobs in jobs file %s!\n", path);
 
-			oque[i].fd = open(globalparams.outputfile, fflags,  S_IRUSR |  S_IWUSR | S_IRGRP );
+		exit(EXIT_USAGE);
 
-			if (oque[i].fd == -1) CUSTOMERROR("open()");
+	}
 
-		}
+}
+
+/*
+ * Copies all jobs of jobs file and prints their results in the order they ran.
+ */
+
+static int runbatch( void ) {
+
+	struct copybatch *batch;
+	struct copyjob *job;
+	const struct copyresult *res;
+	long long start;
+	double seconds;
+	size_t copied = 0;
+	int failed = 0;
+	int i;
+
+	if ((globalparams.inputfile != NULL) || (globalparams.outputs != 0)) {
+
+		fprintf(stderr, "Input and output files are given in jobs file with --jobs!\n");
+		exit(EXIT_USAGE);
+
+	}
+
+	if ((globalparams.journal != NULL) || (globalparams.resume == 1) || (globalparams.errormap != NULL) || \
+			(globalparams.statsjson != NULL) || (globalparams.statsprom != NULL) || (globalparams.progress != 0) || \
+			(globalparams.throttlefile != NULL) || (globalparams.listen != NULL) || (globalparams.connect != NULL)) {
+
+		fprintf(stderr, "Journal, error map, statistics files, progress, throttle file and network can't be used with --jobs!\n");
+		exit(EXIT_USAGE);
 
 	}
 
 	/*
-	 * Installation of signals handlers;
+	 * Every stream of a running job needs its own completion signal.
 	 */
 
-	if (sigemptyset(&sa.sa_mask) == -1) {
+	if (jobsparallel * globalparams.streams > MAX_STREAMS) {
 
-			fprintf(stderr, "Error occurred at file %s line(%d):\n", __FILE__, __LINE__);
+		fprintf(stderr, "Jobs copying at the same time can't have more than %i streams together!\n", MAX_STREAMS);
+		exit(EXIT_USAGE);
 
-			perror("sigemptyset()");
+	}
 
-			exit(EXIT_FAILURE);
+	if (jobsinflight == 0) jobsinflight = jobsparallel * globalparams.streams * globalparams.maxqsize;
 
-		}
+	batch = copy_batch_create(&globalparams, jobsparallel, jobsinflight);
+
+	if (batch == NULL) CUSTOMERROR("copy_batch_create()");
+
+	loadjobs(batch, jobsfile);
+
+	for(i = 0; i < copy_batch_count(batch); i++) copy_job_setverifyfail(copy_batch_job(batch, i), verifyreport, (void *)copy_batch_input(batch, i));
+
+	progress.batch = batch;
+
+	startstatus(&progress);
+
+	start = nstime();
 
-	sa.sa_flags = SA_RESTART | SA_SIGINFO;
-	sa.sa_sigaction = aiosighandler;
+	copy_batch_run(batch);
+
+	seconds = (double)(nstime() - start) / 1000000000;
+
+	stopstatus(&progress);
+
+	for(i = 0; i < copy_batch_count(batch); i++) {
+
+		job = copy_batch_job(batch, i);
+
+		switch(copy_job_poll(job, NULL)) {
+
+		case COPYJOB_DONE:
+
+			res = copy_job_result(job);
+
+			fprintf(stderr, "%s: %lld bytes copied, %.2f s, %.2f MB/s\n", copy_batch_input(batch, i), \
+					(long long)res->copied, res->seconds, res->copied / res->seconds / 1024 / 1024);
+
+			if (res->badranges != 0) {
+
+				fprintf(stderr, "%s: %lld bytes in %i ranges couldn't be read and were %s\n", copy_batch_input(batch, i), \
+						res->badbytes, res->badranges, (globalparams.onerror == RESCUE_SKIP) ? "skipped" : "written as zeroes");
+
+			}
 
-	if (sigaction(IO_SIGNAL, &sa, NULL) == -1) {
+			if (res->verify != VERIFY_NONE) {
 
-		fprintf(stderr, "Error occurred at file %s line(%d):\n", __FILE__, __LINE__);
+				fprintf(stderr, "%s: XXH3 digest %016llx\n", copy_batch_input(batch, i), (unsigned long long)res->digest);
 
-		perror("sigaction()");
+				if (res->verifyfail != 0) {
 
-		exit(EXIT_FAILURE);
+					fprintf(stderr, "%s: %lld blocks failed verification\n", copy_batch_input(batch, i), res->verifyfail);
+
+					failed++ ;
+
+				}
+
+			}
+
+			copied += res->copied;
+
+			break;
+
+		case COPYJOB_FAILED:
+
+			fprintf(stderr, "%s: failed\n", copy_batch_input(batch, i));
+
+			printerror(copy_job_error(job));
+
+			failed++ ;
+
+			break;
+
+		default:
+
+			fprintf(stderr, "%s: not copied\n", copy_batch_input(batch, i));
+
+			failed++ ;
+
+			break;
+
+		}
 
 	}
 
+	fprintf(stderr, "%i jobs, %i failed, %lld bytes copied, %.2f s, %.2f MB/s\n", copy_batch_count(batch), failed, \
+			(long long)copied, seconds, copied / seconds / 1024 / 1024);
+
+	copy_batch_destroy(batch);
+
+	return (failed != 0) ? EXIT_FAILURE : EXIT_SUCCESS;
+
+}
+
+int main( int argc, char *argv[] ) {
+
+	struct copyjob *job;
+	const struct copyresult *res;
+	int i;
+
 	/*
-	 * Used only for statistics.
+	 * Variables for command line parsing.
 	 */
+	int opt;
+	int paramsindex;
+	long long tint;
+	char *bsuffix;
 
-	if (gettimeofday(&starttime, NULL) == -1) CUSTOMERROR("gettimeofday()");
+	/*
+	 * Initialize default global parameters.
+	 */
+
+	copy_params_init(&globalparams);
 
 	/*
-	 * Main loop.
+	 * Parse command line.
 	 */
 
 	for(;;) {
 
-		/*
-		 * Check all input queue items and send unused items to AIO working queue.
-		 */
+		opt = getopt_long(argc, argv, optstr, optarray, &paramsindex);
+
+		if (opt == -1) break;
+
+		switch(opt) {
+
+		case 'i':
+
+			globalparams.inputfile = optarg;
+			break;
 
-		for(i = 0; i < imaxqsize; i++) {
+		case 'o':
 
-			if (ique[i].status == QUEITEM_READY) continue;
+			if (globalparams.outputs == MAX_OUTPUTS) {
 
-			/*
-			 * Check for input operations in progress.
-			 */
+				fprintf(stderr, "At most %i output files can be given!\n", MAX_OUTPUTS);
+				exit(EXIT_USAGE);
 
-			if (ique[i].status == QUEITEM_INPROGRESS) {
+			}
 
-				ique[i].retcode = aio_error(ique[i].aiodata);
+			globalparams.outputfile[globalparams.outputs++] = optarg;
+			break;
 
-				switch(ique[i].retcode) {
+		case 'q':
 
-				case 0:
+			globalparams.maxqsize = parseqsize(optarg);
 
-					ique[i].retcode = aio_return(ique[i].aiodata);
+			break;
 
-					if (ique[i].retcode == 0) {
+		case OPT_READDEPTH:
 
-						eof = 1;
+			globalparams.rdepth = parseqsize(optarg);
 
-						#ifdef AIOBLKCOPY_DEBUG
-						fprintf(stderr, "READ EOF rqnum: %lld fd: %i offset: %lld bytes: %i iqsize: %i\n", \
-								ique[i].rqnum, ique[i].aiodata->aio_fildes, ique[i].aiodata->aio_offset, \
-								ique[i].retcode, iqsize);
-						#endif
+			break;
 
-						if (ique[i].readyb != 0) {
+		case OPT_WRITEDEPTH:
 
-							ique[i].status = QUEITEM_READY;
-							continue;
+			globalparams.wdepth = parseqsize(optarg);
 
-						}
+			break;
 
-						break;
+		case OPT_STAGING:
 
-					}
+			globalparams.staging = copy_parsesize(optarg);
 
-					ique[i].readyb += ique[i].retcode;
+			if (globalparams.staging == -1) {
 
-					/*
-					 * If we haven't got full block we'll try again and again and again...
-					 */
+				fprintf(stderr, "Wrong staging memory size, suffix must be K, M or G!\n");
+				exit(EXIT_USAGE);
 
-					if (ique[i].readyb != globalparams.blksize) {
+			}
 
-						ique[i].aiodata->aio_fildes = ique[i].fd;
+			break;
 
-						ique[i].aiodata->aio_reqprio = 0;
+		case 'b':
 
-						ique[i].aiodata->aio_buf = ique[i].buffer + ique[i].readyb;
+			tint = copy_parsesize(optarg);
 
-						if (iseekable == 1)	{
+			if (tint <= 0) {
 
-							ique[i].aiodata->aio_offset = ique[i].fdoffset + ique[i].readyb;
+				fprintf(stderr, "Wrong block size, suffix must be K for kilobytes, M for megabytes or G for gigabytes!\n");
+				exit(EXIT_USAGE);
 
-						}
-						else {
+			}
 
-							ique[i].aiodata->aio_offset = 0;
+			if ((tint % TOPOLOGY_SECTOR) != 0) {
 
-						}
+				fprintf(stderr, "Block size must be multiple of %i!\n", TOPOLOGY_SECTOR);
+				exit(EXIT_USAGE);
 
-						ique[i].aiodata->aio_nbytes = globalparams.blksize - ique[i].readyb;
+			}
 
-						ique[i].aiodata->aio_sigevent.sigev_notify = SIGEV_SIGNAL;
-						ique[i].aiodata->aio_sigevent.sigev_signo = IO_SIGNAL;
-						ique[i].aiodata->aio_sigevent.sigev_value.sival_ptr = &ique[i];
+			if (tint > MAX_BLKSIZE) {
 
-						if (aio_read(ique[i].aiodata) == -1) CUSTOMERROR("aio_read()");
+				fprintf(stderr, "Block size too big! Must be less then 16 megabytes.\n");
+				exit(EXIT_USAGE);
 
-						#ifdef AIOBLKCOPY_DEBUG
-						fprintf(stderr, "READ INPROGRESS rqnum: %lld fd: %i offset: %lld bytes: %i iqsize: %i\n", \
-							ique[i].rqnum, ique[i].aiodata->aio_fildes, ique[i].aiodata->aio_offset, \
-							ique[i].aiodata->aio_nbytes, iqsize);
-						#endif
+			}
 
-						continue;
+			globalparams.blksize = tint;
 
-					}
+			break;
 
-					ique[i].status = QUEITEM_READY;
+		case OPT_ENGINE:
 
-					#ifdef AIOBLKCOPY_DEBUG
-					fprintf(stderr, "READ COMPLETED rqnum: %lld fd: %i offset: %lld bytes: %i iqsize: %i\n", \
-							ique[i].rqnum, ique[i].aiodata->aio_fildes, ique[i].aiodata->aio_offset, \
-							ique[i].readyb, iqsize);
-					#endif
+			if (ioengine_exists(optarg) == 0) {
 
-					continue;
+				fprintf(stderr, "Unknown I/O engine %s, must be one of: ", optarg);
 
-				case EINPROGRESS:
+				ioengine_list(stderr);
 
-					continue;
+				fprintf(stderr, "\n");
 
-				case ECANCELED:
+				exit(EXIT_USAGE);
 
-					ique[i].retcode = aio_return(ique[i].aiodata);
+			}
 
-					#ifdef AIOBLKCOPY_DEBUG
-					fprintf(stderr, "READ CANCELED rqnum: %lld fd: %i offset:  %lld bytes: %i iqsize: %i\n", \
-						ique[i].rqnum, ique[i].aiodata->aio_fildes, ique[i].aiodata->aio_offset, \
-						ique[i].retcode, iqsize);
-					#endif
+			globalparams.engine = optarg;
 
-					break;
+			break;
 
-				default:
+		case OPT_SPARSE:
 
-					CUSTOMERROR("aio_error()");
+			if (optarg == NULL) globalparams.sparse = SPARSE_AUTO;
+			else if (strcmp(optarg, "skip") == 0) globalparams.sparse = SPARSE_SKIP;
+			else if (strcmp(optarg, "punch") == 0) globalparams.sparse = SPARSE_PUNCH;
+			else if (strcmp(optarg, "zeroout") == 0) globalparams.sparse = SPARSE_ZEROOUT;
+			else if (strcmp(optarg, "discard") == 0) globalparams.sparse = SPARSE_DISCARD;
+			else {
 
-					break;
+				fprintf(stderr, "Sparse method must be skip, punch, zeroout or discard!\n");
+				exit(EXIT_USAGE);
 
-				}
+			}
 
-				ique[i].status = QUEITEM_FREE;
+			break;
 
-				free((void *)(ique[i].buffer));
+		case OPT_ONERROR:
 
-				ique[i].buffer = NULL;
+			if (strcmp(optarg, "abort") == 0) globalparams.onerror = RESCUE_ABORT;
+			else if (strcmp(optarg, "retry") == 0) globalparams.onerror = RESCUE_RETRY;
+			else if (strcmp(optarg, "skip") == 0) globalparams.onerror = RESCUE_SKIP;
+			else if (strcmp(optarg, "zero") == 0) globalparams.onerror = RESCUE_ZERO;
+			else {
 
-				iqsize-- ;
+				fprintf(stderr, "Error handling must be abort, retry, skip or zero!\n");
+				exit(EXIT_USAGE);
 
 			}
-			/*
-			 * Prepare and send unused queitems to AIO working queue.
-			 */
+
+			break;
+
+		case OPT_ERRORMAP:
+
+			globalparams.errormap = optarg;
+
+			break;
+
+		case OPT_SYNC:
+
+			if (strcmp(optarg, "none") == 0) globalparams.sync = SYNC_NONE;
+			else if (strcmp(optarg, "end") == 0) globalparams.sync = SYNC_END;
+			else if ((strncmp(optarg, "every=", 6) == 0) && ((globalparams.syncevery = copy_parsesize(optarg + 6)) > 0)) globalparams.sync = SYNC_EVERY;
 			else {
 
-				if (eof == 1) continue;
+				fprintf(stderr, "Sync policy must be none, end or every=SIZE!\n");
+				exit(EXIT_USAGE);
+
+			}
 
-				ique[i].retcode = posix_memalign((void **)&(ique[i].buffer), 512, globalparams.blksize);
+			break;
 
-				if (ique[i].retcode != 0) {
+		case OPT_STREAMS:
 
-					fprintf(stderr, "Error occurred at file %s line(%d):\n", __FILE__, __LINE__);
+			tint = atoi(optarg);
 
-					fprintf(stderr, "posix_memalign(): %s", strerror(ique[i].retcode));
+			if ((tint < 1) || (tint > MAX_STREAMS)) {
 
-					exit(EXIT_FAILURE);
+				fprintf(stderr, "Number of streams must be between 1 and %i!\n", MAX_STREAMS);
+				exit(EXIT_USAGE);
 
-				}
+			}
 
-				ique[i].rqnum = ++irqnum;
-				ique[i].status = QUEITEM_INPROGRESS;
-				ique[i].retcode = EINPROGRESS;
-				ique[i].readyb = 0;
+			globalparams.streams = tint;
 
-				if (iseekable == 1) {
+			break;
 
-					ique[i].fdoffset = ioff;
+		case OPT_LISTEN:
 
-				}
-				else {
+			globalparams.listen = optarg;
 
-					ique[i].fdoffset = 0;
+			break;
 
-				}
+		case OPT_CONNECT:
 
-				ique[i].aiodata->aio_fildes = ique[i].fd;
-				ique[i].aiodata->aio_reqprio = 0;
-				ique[i].aiodata->aio_buf = ique[i].buffer;
-				ique[i].aiodata->aio_offset = ique[i].fdoffset;
-				ique[i].aiodata->aio_nbytes = globalparams.blksize;
-				ique[i].aiodata->aio_sigevent.sigev_notify = SIGEV_SIGNAL;
-				ique[i].aiodata->aio_sigevent.sigev_signo = IO_SIGNAL;
-				ique[i].aiodata->aio_sigevent.sigev_value.sival_ptr = &ique[i];
+			globalparams.connect = optarg;
 
-				if (aio_read(ique[i].aiodata) == -1) CUSTOMERROR("aio_read()");
+			break;
 
-				ioff += globalparams.blksize;
+		case OPT_COMPRESS:
 
-				iqsize++ ;
+			globalparams.compress = compress_method(optarg);
 
-				#ifdef AIOBLKCOPY_DEBUG
-				fprintf(stderr, "READ QUEUED rqnum: %lld fd: %i offset: %lld bytes: %i iqsize: %i\n", \
-						ique[i].rqnum, ique[i].aiodata->aio_fildes, ique[i].aiodata->aio_offset, \
-						ique[i].aiodata->aio_nbytes, iqsize);
-				#endif
+			if (globalparams.compress == -1) {
+
+				fprintf(stderr, "Unknown compression method %s, must be one of: ", optarg);
+
+				compress_list(stderr);
+
+				fprintf(stderr, "\n");
+
+				exit(EXIT_USAGE);
 
 			}
 
-		}
+			break;
 
-		/*
-		 * Check all output queue items for write completion.
-		 * Check all input queue items for read completion then put completed to AIO working queue for writing.
-		 */
+		case OPT_WORKTHREADS:
 
-		j = 0;
+			tint = atoi(optarg);
 
-		for(i = 0; i < omaxqsize; i++) {
+			if ((tint < 1) || (tint > WORKERS_MAXTHREADS)) {
 
-			if (oque[i].status == QUEITEM_INPROGRESS) {
+				fprintf(stderr, "Number of work threads must be between 1 and %i!\n", WORKERS_MAXTHREADS);
+				exit(EXIT_USAGE);
+
+			}
 
-				oque[i].retcode = aio_error(oque[i].aiodata);
+			globalparams.workthreads = tint;
 
-				switch(oque[i].retcode) {
+			break;
 
-					case 0:
+		case OPT_VERIFY:
 
-						oque[i].retcode = aio_return(oque[i].aiodata);
+			if (verify_available() == 0) {
 
-						#ifdef AIOBLKCOPY_DEBUG
-						fprintf(stderr, "WRITE COMPLETED orqnum: %lld fd : %i offset: %li bytes: %i oqsize: %i\n", \
-								oque[i].rqnum, oque[i].aiodata->aio_fildes, oque[i].aiodata->aio_offset, \
-								oque[i].retcode, oqsize-1);
-						#endif
+				fprintf(stderr, "Verification needs XXH3 hashing, it isn't built in!\n");
+				exit(EXIT_USAGE);
 
-						if (oque[i].retcode == 0) eof = 1;
+			}
 
-						break;
+			if (optarg == NULL) globalparams.verify = VERIFY_HASH;
+			else if (strcmp(optarg, "readback") == 0) globalparams.verify = VERIFY_READBACK;
+			else {
 
-					case EINPROGRESS:
+				fprintf(stderr, "Verify method can be only readback!\n");
+				exit(EXIT_USAGE);
 
-						continue;
+			}
 
-					case ECANCELED:
+			break;
 
-						#ifdef AIOBLKCOPY_DEBUG
-						fprintf(stderr, "WRITE CANCELED orqnum: %lld fd : %i offset: %li bytes: %i oqsize: %i\n", \
-								oque[i].rqnum, oque[i].aiodata->aio_fildes, oque[i].aiodata->aio_offset, \
-								oque[i].aiodata->aio_nbytes, oqsize-1);
-						#endif
+		case OPT_PROGRESS:
 
-						break;
+			globalparams.progress = STATS_INTERVAL;
 
-					case EFBIG:
+			if (optarg != NULL) {
 
-						/*
-						 * It's possible that output device smaller than input data size.
-						 */
-						eof = 1;
-						#ifdef AIOBLKCOPY_DEBUG
-						fprintf(stderr, "WRITE EOF orqnum: %lld fd : %i offset: %li bytes: %i oqsize: %i\n", \
-							oque[i].rqnum, oque[i].aiodata->aio_fildes, oque[i].aiodata->aio_offset, \
-							oque[i].aiodata->aio_nbytes, oqsize-1);
-						#endif
-						break;
+				globalparams.progress = atoi(optarg);
 
-					default:
+				if (globalparams.progress < 1) {
 
-						CUSTOMERROR("aio_error()");
-						break;
+					fprintf(stderr, "Progress interval must be positive number of seconds!\n");
+					exit(EXIT_USAGE);
 
 				}
 
-				oque[i].status = QUEITEM_FREE;
+			}
 
-				free((void *)(oque[i].buffer));
+			break;
 
-				oque[i].buffer = NULL;
+		case OPT_STATSJSON:
 
-				oqsize-- ;
+			globalparams.statsjson = optarg;
+
+			break;
+
+		case OPT_STATSPROM:
+
+			globalparams.statsprom = optarg;
+
+			break;
 
+		case OPT_MAXRATE:
+
+			globalparams.maxrate = copy_parsesize(optarg);
+
+			if (globalparams.maxrate == -1) {
+
+				fprintf(stderr, "Wrong rate, suffix must be K, M or G!\n");
+				exit(EXIT_USAGE);
 
 			}
 
-			else {
-				/*
-				 * Check input queue for completed data and send it to output.
-				 */
-				while(j < imaxqsize) {
+			break;
 
-					switch(ique[j].status) {
+		case OPT_MAXIOPS:
 
-					case QUEITEM_FREE:
-					case QUEITEM_INPROGRESS:
+			globalparams.maxiops = copy_parsesize(optarg);
 
-						break;
+			if (globalparams.maxiops == -1) {
 
-					case QUEITEM_READY:
+				fprintf(stderr, "Wrong number of requests per second!\n");
+				exit(EXIT_USAGE);
 
-						/*
-						 * If output isn't seekable we must wait for the next completed request one by one.
-						 */
-						if (( oseekable == 0 ) && ( ique[j].rqnum != (orqnum+1) ) ) break;
+			}
 
-						oque[i].status = QUEITEM_INPROGRESS;
+			break;
 
-						oque[i].rqnum = ++orqnum;
+		case OPT_THROTTLEFILE:
 
-						oque[i].buffer = ique[j].buffer;
+			globalparams.throttlefile = optarg;
 
-						if (iseekable == 0) oque[i].fdoffset = ooff;
-						else oque[i].fdoffset = ique[j].fdoffset;
+			break;
 
-						oque[i].aiodata->aio_nbytes = ique[j].readyb;
+		case OPT_SKIP:
+		case OPT_SEEK:
+		case OPT_COUNT:
 
-						oque[i].aiodata->aio_fildes = oque[i].fd;
-						oque[i].aiodata->aio_buf = oque[i].buffer;
-						oque[i].aiodata->aio_offset = oque[i].fdoffset;
-						oque[i].aiodata->aio_reqprio = 0;
+			tint = copy_parsesize(optarg);
 
-						oque[i].aiodata->aio_sigevent.sigev_notify = SIGEV_SIGNAL;
-						oque[i].aiodata->aio_sigevent.sigev_signo = IO_SIGNAL;
-						oque[i].aiodata->aio_sigevent.sigev_value.sival_ptr = &oque[i];
+			if (tint == -1) {
 
-						if (aio_write(oque[i].aiodata) == -1) CUSTOMERROR("aio_write");
+				fprintf(stderr, "Wrong offset or size, suffix must be K, M or G!\n");
+				exit(EXIT_USAGE);
 
-						oqsize++ ;
-						ooff += ique[j].readyb;
+			}
 
-						#ifdef AIOBLKCOPY_DEBUG
-						fprintf(stderr, "WRITE QUEUED orqnum: %lld fd : %i offset: %li bytes: %i oqsize: %i\n", \
-							oque[i].rqnum, oque[i].aiodata->aio_fildes, oque[i].aiodata->aio_offset, \
-							oque[i].aiodata->aio_nbytes, oqsize);
-						#endif
+			if (opt == OPT_SKIP) globalparams.skip = tint;
+			else if (opt == OPT_SEEK) globalparams.seek = tint;
+			else globalparams.count = tint;
 
-						ique[j].aiodata->aio_buf = NULL;
+			break;
 
-						ique[j].status = QUEITEM_FREE;
+		case OPT_JOURNAL:
 
-						iqsize-- ;
+			globalparams.journal = optarg;
 
-						break;
+			break;
+
+		case OPT_JOBS:
+
+			jobsfile = optarg;
+
+			break;
+
+		case OPT_PARALLEL:
 
-					default:
+			tint = atoi(optarg);
 
-						CUSTOMERROR("aio_error()");
-						break;
+			if ((tint < 1) || (tint > MAX_STREAMS)) {
 
-					}
+				fprintf(stderr, "Number of parallel jobs must be between 1 and %i!\n", MAX_STREAMS);
+				exit(EXIT_USAGE);
+
+			}
+
+			jobsparallel = tint;
+
+			break;
 
-					j++;
+		case OPT_INFLIGHT:
 
-					/*
-					 * Go to the next free output request.
-					 */
-					if (oque[i].status ==  QUEITEM_INPROGRESS) break;
+			tint = atoi(optarg);
+
+			if ((tint < 1) || (tint > MAX_STREAMS * MAX_QUEUESIZE)) {
+
+				fprintf(stderr, "Number of blocks in flight must be between 1 and %i!\n", MAX_STREAMS * MAX_QUEUESIZE);
+				exit(EXIT_USAGE);
+
+			}
+
+			jobsinflight = tint;
+
+			break;
+
+		case OPT_NUMA:
+		case OPT_SQPOLL:
+
+			tint = (opt == OPT_NUMA) ? NUMA_AUTO : NUMA_CPU_AUTO;
+
+			if (optarg != NULL) {
+
+				tint = strtol(optarg, &bsuffix, 10);
+
+				if ((bsuffix == optarg) || (*bsuffix != '\0') || (tint < 0) || (tint >= ((opt == OPT_NUMA) ? NUMA_MAXNODES : CPU_SETSIZE))) {
+
+					fprintf(stderr, "Wrong %s number %s!\n", (opt == OPT_NUMA) ? "NUMA node" : "CPU", optarg);
+					exit(EXIT_USAGE);
 
 				}
 
 			}
 
+			if (opt == OPT_NUMA) globalparams.numa = tint;
+			else globalparams.sqpoll = tint;
+
+			break;
+
+		case 'h':
+
+			usage();
+			exit(EXIT_USAGE);
+			break;
+
+		default:
+
+			break;
 
 		}
 
-		/*
-		 * if we complete all requests and end of data detected we can break main loop.
-		 */
 
-		if ((iqsize == 0) && (oqsize == 0) && (eof == 1)) break;
+	}
 
-		/*
-		 *  Wait for signals.
-		 *  Timer delay calculated with help of russian PPP method.
-		 */
+	if (jobsfile != NULL) return runbatch();
 
-		to.tv_sec = 0;
-		to.tv_usec = 100;
+	job = copy_job_create(&globalparams);
 
-		#ifdef AIOBLKCOPY_DEBUG
+	if (job == NULL) CUSTOMERROR("copy_job_create()");
 
-		to.tv_sec = 1;
-		to.tv_usec = 0;
+	if (globalparams.progress != 0) copy_job_setprogress(job, progressreport, &progress);
 
-		fprintf(stderr, "select(): tv_sec: %i tv_usec:%i \n", to.tv_sec, to.tv_usec);
+	copy_job_setverifyfail(job, verifyreport, NULL);
 
-		#endif
+	progress.job = job;
 
-		select(0, NULL,NULL,NULL, &to);
+	startstatus(&progress);
 
-		#ifdef AIOBLKCOPY_DEBUG
-		fprintf(stderr, "iqsize: %i oqsize:%i eof: %i \n", iqsize , oqsize,  eof);
-		#endif
+	tint = copy_job_run(job);
 
-	}
+	stopstatus(&progress);
+
+	if (tint == -1) joberror(copy_job_error(job));
+
+	res = copy_job_result(job);
 
 	/*
 	 * Write some statistics in dd-like format.
 	 */
-	if (gettimeofday(&endtime, NULL) == -1) CUSTOMERROR("gettimeofday()");
 
-	workingtime =  (double) (endtime.tv_sec * 1000000 + endtime.tv_usec - starttime.tv_sec * 1000000 - starttime.tv_usec) / 1000000;
+	if (globalparams.autotune == 1) {
 
-	fprintf(stderr, "%lld bytes copied, %.2f s, %.2f MB/s\n", ooff , workingtime, ooff / workingtime / 1024 / 1024);
+		for(i = 0; i < res->streams; i++) {
 
-	for(i = 0; i < imaxqsize; i++) {
+			if (res->streams > 1) fprintf(stderr, "stream %i ", i);
 
-		close(ique[i].fd);
-		free(ique[i].aiodata);
+			fprintf(stderr, "autotune: read depth %i, write depth %i, block size %zu\n", \
+					res->autotune[i].rdepth, res->autotune[i].wdepth, res->autotune[i].blksize);
+
+		}
 
 	}
 
-	free(ique);
+	if (globalparams.sparse != SPARSE_NONE) fprintf(stderr, "%lld bytes not written as sparse\n", (long long)res->sparseb);
+
+	if (globalparams.delta == 1) fprintf(stderr, "%lld bytes not written as equal\n", (long long)res->deltab);
+
+	if (res->compress != COMPRESS_NONE) fprintf(stderr, "%lld bytes sent as %lld compressed bytes\n", (long long)res->zinb, (long long)res->zoutb);
 
-	for(i = 0; i < omaxqsize; i++) {
+	if (globalparams.resume == 1) fprintf(stderr, "%lld bytes skipped as written before\n", (long long)res->resumeb);
 
-		close(oque[i].fd);
-		free(oque[i].aiodata);
+	if (res->badranges != 0) {
+
+		fprintf(stderr, "%lld bytes in %i ranges couldn't be read and were %s\n", res->badbytes, \
+				res->badranges, (globalparams.onerror == RESCUE_SKIP) ? "skipped" : "written as zeroes");
 
 	}
 
-	free(oque);
+	fprintf(stderr, "%lld bytes copied, %.2f s, %.2f MB/s\n", (long long)res->copied , res->seconds, res->copied / res->seconds / 1024 / 1024);
+
+	if ((globalparams.progress != 0) && (res->zerocopy == 0)) {
+
+		stats_printlat(stderr, "read", &res->snap.rd);
+
+		fprintf(stderr, ", ");
+
+		stats_printlat(stderr, "write", &res->snap.wr);
+
+		fprintf(stderr, "\n");
+
+	}
+
+	if (res->verify != VERIFY_NONE) {
+
+		fprintf(stderr, "XXH3 digest %016llx\n", (unsigned long long)res->digest);
+
+		if (res->verifyfail != 0) fprintf(stderr, "%lld blocks failed verification\n", res->verifyfail);
+
+	}
+
+	tint = (res->verifyfail != 0) ? EXIT_FAILURE : EXIT_SUCCESS;
+
+	copy_job_destroy(job);
 
-	return EXIT_SUCCESS;
+	return tint;
 
 }
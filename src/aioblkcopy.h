@@ -26,16 +26,47 @@ along with this program; if not, write to the Free Software
 Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 */
 
-#define IO_SIGNAL SIGUSR1
+#ifndef AIOBLKCOPY_H
+#define AIOBLKCOPY_H
+
+/*
+ * Completion notifications must be queued, not merged, so realtime signal is used.
+ */
+#define IO_SIGNAL (SIGRTMIN + 1)
+
+/*
+ * Copy stream N uses signal IO_SIGNAL + N, so there must be enough realtime signals.
+ */
+#define MAX_STREAMS 16
+
+/*
+ * Every block read is written to all outputs given with -o.
+ */
+#define MAX_OUTPUTS 8
 
 #define EXIT_USAGE 1
 
+/*
+ * Default block size is rounded up to a multiple of optimal io size of both sides.
+ */
 #define DEFAULT_BLKSIZE 1048576
+#define MAX_BLKSIZE (16 * 1024 * 1024)
 #define DEFAULT_MAXQUEUESIZE 8
+#define MAX_QUEUESIZE 32
+
+/*
+ * When written data is made durable: never, once after the copy, or every given number of bytes and after the copy.
+ */
+#define SYNC_NONE 0
+#define SYNC_END 1
+#define SYNC_EVERY 2
 
 #define QUEITEM_FREE 0
 #define QUEITEM_READY 1
 #define QUEITEM_INPROGRESS 2
+#define QUEITEM_COMPARING 3
+#define QUEITEM_WORKING 4
+#define QUEITEM_VERIFYING 5
 
 #define CUSTOMERROR(errfunc) { \
 fprintf(stderr, "Error occurred at file %s line(%d):\n", __FILE__, __LINE__); \
@@ -46,14 +77,52 @@ exit(EXIT_FAILURE); \
 }
 
 
+#include <stdint.h>
+#include <sys/types.h>
+#include <time.h>
 #include <aio.h>
 
+/*
+ * Returns CLOCK_MONOTONIC time in nanoseconds.
+ */
+
+static inline long long nstime( void ) {
+
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+
+}
+
+/*
+ * Items are aligned to cache lines, so neighbours in the queue array don't share them.
+ */
+
 struct blkqueitem {
 
+	/*
+	 * Links of the list the item is on, an item is on one list at most: free, ready or completed.
+	 */
+	struct blkqueitem *next;
+
+	struct blkqueitem *prev;
+
 	long long rqnum;
 
+	/*
+	 * Outputs which haven't taken the block read yet.
+	 */
+	int pending;
+
 	int fd;
 
+	/*
+	 * Descriptor of the same file without direct io, -1 if fd isn't opened with O_DIRECT.
+	 */
+	int bouncefd;
+
 	int status;
 
 	int retcode;
@@ -64,7 +133,123 @@ struct blkqueitem {
 
 	size_t readyb;
 
-	struct aiocb *aiodata;
+	/*
+	 * Size of the block requested by the read.
+	 */
+	size_t blklen;
+
+	/*
+	 * Failed read: retries done and the time of the next one, length of pieces while the block is bisected,
+	 * zero if it's read whole, bytes of the block which couldn't be read.
+	 */
+	int retries;
+
+	long long retryat;
+
+	size_t rescuelen;
+
+	size_t badb;
+
+	/*
+	 * Parameters of the request handed to the I/O engine, iofd is fd or bouncefd.
+	 */
+	int iofd;
+
+	char *iobuf;
+
+	size_t iolen;
+
+	off_t iooff;
+
+	/*
+	 * Result of the completed request filled by the I/O engine.
+	 */
+	ssize_t iores;
+
+	/*
+	 * Private request slot of the I/O engine.
+	 */
+	int ioslot;
+
+	/*
+	 * Time the request was given to the I/O engine, CLOCK_MONOTONIC nanoseconds.
+	 */
+	long long iostart;
+
+	/*
+	 * Output data read back for comparison by delta copy or verification.
+	 */
+	char *cmpbuf;
+
+	/*
+	 * Network block header is being received into the buffer headroom.
+	 */
+	int nethdr;
+
+	/*
+	 * Compressed form of the block, zlen bytes in zbuf. zbuf is NULL if the block isn't sent compressed.
+	 */
+	char *zbuf;
+
+	size_t zlen;
+
+	/*
+	 * Hash of the block as it was read and as it was read back from output.
+	 */
+	uint64_t hash;
+
+	uint64_t hashback;
+
+	struct aiocb aiodata;
+
+} __attribute__ ((aligned (64)));
+
+struct itemlist {
+
+	struct blkqueitem *head;
+
+	struct blkqueitem *tail;
 
 };
 
+static inline void itemlist_push(struct itemlist *l, struct blkqueitem *item) {
+
+	item->next = NULL;
+	item->prev = l->tail;
+
+	if (l->tail != NULL) l->tail->next = item;
+	else l->head = item;
+
+	l->tail = item;
+
+}
+
+static inline void itemlist_remove(struct itemlist *l, struct blkqueitem *item) {
+
+	if (item->prev != NULL) item->prev->next = item->next;
+	else l->head = item->next;
+
+	if (item->next != NULL) item->next->prev = item->prev;
+	else l->tail = item->prev;
+
+	item->next = NULL;
+	item->prev = NULL;
+
+}
+
+/*
+ * Returns NULL if the list is empty.
+ */
+
+static inline struct blkqueitem *itemlist_pop(struct itemlist *l) {
+
+	struct blkqueitem *item = l->head;
+
+	if (item != NULL) itemlist_remove(l, item);
+
+	return item;
+
+}
+
+#endif
+
@@ -0,0 +1,305 @@
+/*
+ ============================================================================
+ Name        : autotune.c
+ Author      : Nikita Staroverov
+ Version     : 1.0.0
+ Copyright   : GPLv2
+ Description : Asynchronous block copying tool, queue depth and block size autotuning
+ ============================================================================
+ */
+
+/*
+Copyright (C) 2014  Nikita Staroverov
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "autotune.h"
+
+/*
+ * Startup doubles the depth every interval while throughput grows at least by that factor.
+ */
+#define AUTOTUNE_STARTUP_GROWTH 1.25
+#define AUTOTUNE_STARTUP_STALLS 3
+
+/*
+ * Block size step is kept only if it gives that much more throughput.
+ */
+#define AUTOTUNE_BLK_GAIN 1.05
+
+static const double depthgain[AUTOTUNE_CYCLE] = { 1.25, 0.75, 1, 1, 1, 1, 1, 1 };
+
+/*
+ * Startup phase is marked with negative phase, it counts intervals without throughput growth.
+ */
+
+static void autodepth_init(struct autodepth *ad, int maxdepth) {
+
+	memset(ad, 0, sizeof(struct autodepth));
+
+	ad->maxdepth = maxdepth;
+	ad->depth = (maxdepth < 2) ? maxdepth : 2;
+	ad->phase = -1;
+
+}
+
+static void autodepth_update(struct autodepth *ad, long long interval) {
+
+	double bw;
+	double lat;
+	double maxbw;
+	double bdp;
+	double startbw;
+	int target;
+	int i;
+
+	if ((ad->count == 0) || (ad->bytes == 0)) return;
+
+	bw = (double)ad->bytes / interval;
+	lat = (double)ad->latsum / ad->count;
+
+	/*
+	 * The best throughput before this interval is needed by startup.
+	 */
+	startbw = 0;
+
+	for(i = 0; i < AUTOTUNE_BWWINDOW; i++) if (ad->bw[i] > startbw) startbw = ad->bw[i];
+
+	ad->bw[ad->bwpos] = bw;
+	ad->bwpos = (ad->bwpos + 1) % AUTOTUNE_BWWINDOW;
+
+	if ((ad->minlat == 0) || (lat < ad->minlat) || (ad->probelat == 1)) {
+
+		ad->minlat = lat;
+		ad->minlatage = 0;
+
+	}
+	else {
+
+		ad->minlatage++ ;
+
+	}
+
+	maxbw = 0;
+
+	for(i = 0; i < AUTOTUNE_BWWINDOW; i++) if (ad->bw[i] > maxbw) maxbw = ad->bw[i];
+
+	/*
+	 * Requests needed in flight to keep the best throughput at the lowest latency.
+	 */
+	bdp = maxbw * ad->minlat / ((double)ad->bytes / ad->count);
+
+	if (ad->phase < 0) {
+
+		if (bw > startbw * AUTOTUNE_STARTUP_GROWTH) ad->phase = -1;
+		else ad->phase-- ;
+
+		if (-ad->phase <= AUTOTUNE_STARTUP_STALLS) {
+
+			target = ad->depth * 2;
+
+		}
+		else {
+
+			target = bdp + 0.5;
+
+			ad->phase = 0;
+
+		}
+
+	}
+	else {
+
+		target = bdp * depthgain[ad->phase] + 0.5;
+
+		/*
+		 * Probing must be able to leave small depths.
+		 */
+		if ((depthgain[ad->phase] > 1) && (target <= ad->depth)) target = ad->depth + 1;
+
+		ad->phase = (ad->phase + 1) % AUTOTUNE_CYCLE;
+
+	}
+
+	/*
+	 * Expired latency minimum is measured again with half of the queue, so queueing delay doesn't hide it.
+	 */
+
+	ad->probelat = 0;
+
+	if ((ad->phase >= 0) && (ad->minlatage >= AUTOTUNE_LATWINDOW)) {
+
+		ad->probelat = 1;
+
+		target = target / 2;
+
+	}
+
+	if (target < 1) target = 1;
+	if (target > ad->maxdepth) target = ad->maxdepth;
+
+	ad->depth = target;
+
+}
+
+static void autodepth_reset(struct autodepth *ad) {
+
+	ad->bytes = 0;
+	ad->latsum = 0;
+	ad->count = 0;
+
+}
+
+void autotune_init(struct autotune *at, int rmaxdepth, int wmaxdepth, size_t blksize, size_t maxblk, size_t align, long long now) {
+
+	memset(at, 0, sizeof(struct autotune));
+
+	autodepth_init(&at->rd, rmaxdepth);
+	autodepth_init(&at->wr, wmaxdepth);
+
+	at->blksize = blksize;
+	at->startblk = blksize;
+	at->bestblk = blksize;
+	at->maxblk = maxblk;
+	at->align = align;
+	at->blkstate = AUTOTUNE_BLK_UP;
+
+	at->lastupdate = now;
+
+}
+
+void autotune_read(struct autotune *at, size_t bytes, long long latns) {
+
+	at->rd.bytes += bytes;
+	at->rd.latsum += latns;
+	at->rd.count++ ;
+
+}
+
+void autotune_write(struct autotune *at, size_t bytes, long long latns) {
+
+	at->wr.bytes += bytes;
+	at->wr.latsum += latns;
+	at->wr.count++ ;
+
+}
+
+/*
+ * One step of block size hill climbing, at first up from the start size, then down if going up didn't help.
+ */
+
+static void autotune_blkstep(struct autotune *at) {
+
+	double bw = at->blkbw / at->blkintervals;
+
+	at->blkbw = 0;
+	at->blkintervals = 0;
+
+	if (bw > at->bestbw * AUTOTUNE_BLK_GAIN) {
+
+		at->bestbw = bw;
+		at->bestblk = at->blksize;
+
+	}
+	else if ((at->blkstate == AUTOTUNE_BLK_UP) && (at->bestblk == at->startblk)) {
+
+		at->blkstate = AUTOTUNE_BLK_DOWN;
+		at->blksize = at->startblk;
+
+	}
+	else {
+
+		at->blkstate = AUTOTUNE_BLK_DONE;
+
+	}
+
+	if ((at->blkstate == AUTOTUNE_BLK_UP) && (at->blksize * 2 > at->maxblk)) {
+
+		at->blkstate = (at->bestblk == at->startblk) ? AUTOTUNE_BLK_DOWN : AUTOTUNE_BLK_DONE;
+
+	}
+
+	if ((at->blkstate == AUTOTUNE_BLK_DOWN) && ((at->blksize / 2 < AUTOTUNE_MINBLKSIZE) || ((at->blksize / 2) % at->align != 0))) {
+
+		at->blkstate = AUTOTUNE_BLK_DONE;
+
+	}
+
+	/*
+	 * Latency depends on block size, the minimum must be measured again.
+	 */
+	at->rd.minlatage = AUTOTUNE_LATWINDOW;
+	at->wr.minlatage = AUTOTUNE_LATWINDOW;
+
+	switch(at->blkstate) {
+
+	case AUTOTUNE_BLK_UP:
+
+		at->blksize *= 2;
+		break;
+
+	case AUTOTUNE_BLK_DOWN:
+
+		at->blksize /= 2;
+		break;
+
+	default:
+
+		at->blksize = at->bestblk;
+		break;
+
+	}
+
+}
+
+/*
+ * Returns 1 if the interval is over and new values are calculated.
+ */
+
+int autotune_update(struct autotune *at, long long now) {
+
+	long long interval = now - at->lastupdate;
+
+	if (interval < AUTOTUNE_INTERVAL_NS) return 0;
+
+	autodepth_update(&at->rd, interval);
+	autodepth_update(&at->wr, interval);
+
+	if ((at->blkstate != AUTOTUNE_BLK_DONE) && (at->wr.count != 0)) {
+
+		at->blkbw += (double)at->wr.bytes / interval;
+		at->blkintervals++ ;
+
+		if (at->blkintervals == AUTOTUNE_BLKINTERVALS) autotune_blkstep(at);
+
+	}
+
+	#ifdef AIOBLKCOPY_DEBUG
+	fprintf(stderr, "autotune: read depth: %i write depth: %i blksize: %zu read bw: %.0f MB/s write bw: %.0f MB/s\n", \
+			at->rd.depth, at->wr.depth, at->blksize, \
+			(double)at->rd.bytes / interval * 1000000000 / 1024 / 1024, (double)at->wr.bytes / interval * 1000000000 / 1024 / 1024);
+	#endif
+
+	autodepth_reset(&at->rd);
+	autodepth_reset(&at->wr);
+
+	at->lastupdate = now;
+
+	return 1;
+
+}
@@ -0,0 +1,145 @@
+/*
+ ============================================================================
+ Name        : autotune.h
+ Author      : Nikita Staroverov
+ Version     : 1.0.0
+ Copyright   : GPLv2
+ Description : Asynchronous block copying tool, queue depth and block size autotuning
+ ============================================================================
+ */
+
+/*
+Copyright (C) 2014  Nikita Staroverov
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef AIOBLKCOPY_AUTOTUNE_H
+#define AIOBLKCOPY_AUTOTUNE_H
+
+#include <sys/types.h>
+
+/*
+ * Controller is updated once per interval.
+ */
+#define AUTOTUNE_INTERVAL_NS 100000000LL
+
+/*
+ * Throughput maximum is taken over that many intervals.
+ */
+#define AUTOTUNE_BWWINDOW 10
+
+/*
+ * Latency minimum expires after that many intervals and is measured again.
+ */
+#define AUTOTUNE_LATWINDOW 100
+
+/*
+ * Length of depth gain cycle in intervals.
+ */
+#define AUTOTUNE_CYCLE 8
+
+/*
+ * Block size is measured for that many intervals before the next step.
+ */
+#define AUTOTUNE_BLKINTERVALS 5
+
+#define AUTOTUNE_MINBLKSIZE (64 * 1024)
+#define AUTOTUNE_MAXBLKSIZE (4 * 1024 * 1024)
+
+/*
+ * Depth controller of one side.
+ * The depth follows bandwidth-delay product: maximum recent throughput multiplied by minimum recent latency,
+ * so the device is kept busy without growing its queue. Periodical gain above one probes for more throughput,
+ * gain below one drains the queue that probing has built.
+ * Latency minimum is measured again with reduced depth when it gets old or block size changes.
+ */
+
+struct autodepth {
+
+	int depth;
+
+	int maxdepth;
+
+	/*
+	 * Completions of the current interval.
+	 */
+	long long bytes;
+
+	long long latsum;
+
+	long long count;
+
+	double bw[AUTOTUNE_BWWINDOW];
+
+	int bwpos;
+
+	double minlat;
+
+	int minlatage;
+
+	int probelat;
+
+	int phase;
+
+};
+
+#define AUTOTUNE_BLK_UP 0
+#define AUTOTUNE_BLK_DOWN 1
+#define AUTOTUNE_BLK_DONE 2
+
+struct autotune {
+
+	struct autodepth rd;
+
+	struct autodepth wr;
+
+	/*
+	 * Block size hill climbing on copy (write) throughput.
+	 */
+	size_t blksize;
+
+	size_t startblk;
+
+	size_t maxblk;
+
+	/*
+	 * Every block size tried is a multiple of that.
+	 */
+	size_t align;
+
+	size_t bestblk;
+
+	double bestbw;
+
+	double blkbw;
+
+	int blkintervals;
+
+	int blkstate;
+
+	long long lastupdate;
+
+};
+
+void autotune_init(struct autotune *at, int rmaxdepth, int wmaxdepth, size_t blksize, size_t maxblk, size_t align, long long now);
+
+void autotune_read(struct autotune *at, size_t bytes, long long latns);
+
+void autotune_write(struct autotune *at, size_t bytes, long long latns);
+
+int autotune_update(struct autotune *at, long long now);
+
+#endif
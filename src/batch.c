@@ -0,0 +1,426 @@
+/*
+ ============================================================================
+ Name        : batch.c
+ Author      : Nikita Staroverov
+ Version     : 1.0.0
+ Copyright   : GPLv2
+ Description : Asynchronous block copying tool, batch of copy jobs
+ ============================================================================
+ */
+
+/*
+Copyright (C) 2014  Nikita Staroverov
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <pthread.h>
+
+#include "aioblkcopy.h"
+#include "batch.h"
+#include "jobsched.h"
+
+struct batchentry {
+
+	struct copyjob *job;
+
+	/*
+	 * Names are copied, the job refers to them.
+	 */
+	char *input;
+
+	char *outputs[MAX_OUTPUTS];
+
+	int noutputs;
+
+	/*
+	 * Bytes to copy the jobs are ordered by, zero if unknown.
+	 */
+	off_t size;
+
+	int added;
+
+};
+
+struct copybatch {
+
+	struct copyparams params;
+
+	struct sched sched;
+
+	struct batchentry *entries;
+
+	int count;
+
+	int allocated;
+
+	int parallel;
+
+	/*
+	 * The next job to run and the flag stopping the runners, both under lock.
+	 */
+	int next;
+
+	int cancel;
+
+	pthread_mutex_t lock;
+
+};
+
+struct copybatch *copy_batch_create(const struct copyparams *params, int parallel, int budget) {
+
+	struct copybatch *batch;
+
+	if ((parallel < 1) || (budget < 1)) {
+
+		errno = EINVAL;
+
+		return NULL;
+
+	}
+
+	batch = malloc(sizeof(struct copybatch));
+
+	if (batch == NULL) return NULL;
+
+	memset(batch, 0, sizeof(struct copybatch));
+
+	batch->params = *params;
+	batch->parallel = parallel;
+
+	/*
+	 * Jobs share buffers of one size. Rounding the default block up to topology of every job's devices
+	 * would give them different sizes, so the default is used as it is.
+	 */
+	if (batch->params.blksize == 0) batch->params.blksize = DEFAULT_BLKSIZE;
+
+	if (sched_init(&batch->sched, budget) == -1) {
+
+		free(batch);
+
+		return NULL;
+
+	}
+
+	if (pthread_mutex_init(&batch->lock, NULL) != 0) {
+
+		sched_destroy(&batch->sched);
+
+		free(batch);
+
+		return NULL;
+
+	}
+
+	return batch;
+
+}
+
+/*
+ * Size of input range the job copies, the order is only a hint, so unknown size is zero.
+ */
+
+static off_t batchsize(const struct copyparams *params, const char *path) {
+
+	struct stat statdata;
+	off_t size = 0;
+	int fd;
+
+	if (stat(path, &statdata) == -1) return 0;
+
+	if (S_ISREG(statdata.st_mode)) size = statdata.st_size;
+
+	/*
+	 * Block devices have st_size zero.
+	 */
+
+	if (S_ISBLK(statdata.st_mode)) {
+
+		fd = open(path, O_RDONLY);
+
+		if (fd == -1) return 0;
+
+		size = lseek(fd, 0, SEEK_END);
+
+		close(fd);
+
+		if (size == -1) return 0;
+
+	}
+
+	size -= params->skip;
+
+	if (size < 0) size = 0;
+
+	if ((params->count != -1) && (size > params->count)) size = params->count;
+
+	return size;
+
+}
+
+static void freeentry(struct batchentry *be) {
+
+	int i;
+
+	if (be->job != NULL) copy_job_destroy(be->job);
+
+	free(be->input);
+
+	for(i = 0; i < be->noutputs; i++) free(be->outputs[i]);
+
+}
+
+/*
+ * Adds the job copying input to outputs, returns -1 on error.
+ */
+
+int copy_batch_add(struct copybatch *batch, const char *input, char *const outputs[], int noutputs) {
+
+	struct copyparams params = batch->params;
+	struct batchentry *be;
+	void *entries;
+	int i;
+
+	if ((noutputs < 1) || (noutputs > MAX_OUTPUTS)) {
+
+		errno = EINVAL;
+
+		return -1;
+
+	}
+
+	if (batch->count == batch->allocated) {
+
+		i = (batch->allocated == 0) ? 16 : batch->allocated * 2;
+
+		entries = realloc(batch->entries, sizeof(struct batchentry) * i);
+
+		if (entries == NULL) return -1;
+
+		batch->entries = entries;
+		batch->allocated = i;
+
+	}
+
+	be = &batch->entries[batch->count];
+
+	memset(be, 0, sizeof(struct batchentry));
+
+	be->input = strdup(input);
+
+	if (be->input == NULL) return -1;
+
+	for(i = 0; i < noutputs; i++) {
+
+		be->outputs[i] = strdup(outputs[i]);
+
+		if (be->outputs[i] == NULL) {
+
+			freeentry(be);
+
+			return -1;
+
+		}
+
+		be->noutputs++ ;
+
+	}
+
+	params.inputfile = be->input;
+	params.outputs = noutputs;
+
+	for(i = 0; i < noutputs; i++) params.outputfile[i] = be->outputs[i];
+
+	be->job = copy_job_create(&params);
+
+	if (be->job == NULL) {
+
+		freeentry(be);
+
+		return -1;
+
+	}
+
+	copy_job_setsched(be->job, &batch->sched);
+
+	be->size = batchsize(&params, input);
+	be->added = batch->count;
+
+	batch->count++ ;
+
+	return 0;
+
+}
+
+/*
+ * The biggest first, jobs of the same size in the order they were added.
+ */
+
+static int entrycmp(const void *a, const void *b) {
+
+	const struct batchentry *ea = a;
+	const struct batchentry *eb = b;
+
+	if (ea->size != eb->size) return (ea->size > eb->size) ? -1 : 1;
+
+	return ea->added - eb->added;
+
+}
+
+/*
+ * Every runner takes the next job when its previous one ends.
+ */
+
+static void *batchthread(void *arg) {
+
+	struct copybatch *batch = arg;
+	struct batchentry *be;
+
+	for(;;) {
+
+		pthread_mutex_lock(&batch->lock);
+
+		be = ((batch->cancel == 0) && (batch->next < batch->count)) ? &batch->entries[batch->next++] : NULL;
+
+		pthread_mutex_unlock(&batch->lock);
+
+		if (be == NULL) break;
+
+		#ifdef AIOBLKCOPY_DEBUG
+		fprintf(stderr, "batch: job %s size: %lld\n", be->input, (long long)be->size);
+		#endif
+
+		copy_job_run(be->job);
+
+	}
+
+	return NULL;
+
+}
+
+/*
+ * Runs all jobs and returns -1 if any of them failed or didn't run, copy_batch_job() gives them in the order they ran.
+ * A failed job doesn't stop the others.
+ */
+
+int copy_batch_run(struct copybatch *batch) {
+
+	pthread_t *threads;
+	int nthreads;
+	int ret = 0;
+	int i;
+
+	qsort(batch->entries, batch->count, sizeof(struct batchentry), entrycmp);
+
+	nthreads = (batch->parallel < batch->count) ? batch->parallel : batch->count;
+
+	threads = malloc(sizeof(pthread_t) * (nthreads + 1));
+
+	if (threads == NULL) return -1;
+
+	for(i = 0; i < nthreads; i++) {
+
+		if (pthread_create(&threads[i], NULL, batchthread, batch) != 0) break;
+
+	}
+
+	/*
+	 * Fewer runners only make the batch longer.
+	 */
+
+	if ((i == 0) && (nthreads != 0)) {
+
+		free(threads);
+
+		errno = EAGAIN;
+
+		return -1;
+
+	}
+
+	nthreads = i;
+
+	for(i = 0; i < nthreads; i++) pthread_join(threads[i], NULL);
+
+	free(threads);
+
+	for(i = 0; i < batch->count; i++) {
+
+		if (copy_job_poll(batch->entries[i].job, NULL) != COPYJOB_DONE) ret = -1;
+
+	}
+
+	return ret;
+
+}
+
+/*
+ * Stops running jobs from any thread, jobs not started yet don't run.
+ */
+
+void copy_batch_cancel(struct copybatch *batch) {
+
+	int i;
+
+	pthread_mutex_lock(&batch->lock);
+
+	batch->cancel = 1;
+
+	for(i = 0; i < batch->count; i++) copy_job_cancel(batch->entries[i].job);
+
+	pthread_mutex_unlock(&batch->lock);
+
+}
+
+int copy_batch_count(struct copybatch *batch) {
+
+	return batch->count;
+
+}
+
+struct copyjob *copy_batch_job(struct copybatch *batch, int i) {
+
+	return batch->entries[i].job;
+
+}
+
+const char *copy_batch_input(struct copybatch *batch, int i) {
+
+	return batch->entries[i].input;
+
+}
+
+void copy_batch_destroy(struct copybatch *batch) {
+
+	int i;
+
+	for(i = 0; i < batch->count; i++) freeentry(&batch->entries[i]);
+
+	free(batch->entries);
+
+	sched_destroy(&batch->sched);
+
+	pthread_mutex_destroy(&batch->lock);
+
+	free(batch);
+
+}
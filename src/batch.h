@@ -0,0 +1,64 @@
+/*
+ ============================================================================
+ Name        : batch.h
+ Author      : Nikita Staroverov
+ Version     : 1.0.0
+ Copyright   : GPLv2
+ Description : Asynchronous block copying tool, batch of copy jobs
+ ============================================================================
+ */
+
+/*
+Copyright (C) 2014  Nikita Staroverov
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef AIOBLKCOPY_BATCH_H
+#define AIOBLKCOPY_BATCH_H
+
+#include "copyjob.h"
+
+/*
+ * Jobs of a batch copying at the same time by default.
+ */
+#define BATCH_DEFAULT_PARALLEL 4
+
+/*
+ * Batch copies many inputs to their outputs with the same parameters.
+ * Up to parallel jobs copy at once, the biggest inputs go first, so the last jobs running are short ones
+ * and the batch ends soon after its longest job. Running jobs share budget data buffers, they are
+ * divided equally between their streams, so jobs don't take more than a fair part of the devices they use together.
+ */
+
+struct copybatch;
+
+struct copybatch *copy_batch_create(const struct copyparams *params, int parallel, int budget);
+
+int copy_batch_add(struct copybatch *batch, const char *input, char *const outputs[], int noutputs);
+
+int copy_batch_run(struct copybatch *batch);
+
+void copy_batch_cancel(struct copybatch *batch);
+
+int copy_batch_count(struct copybatch *batch);
+
+struct copyjob *copy_batch_job(struct copybatch *batch, int i);
+
+const char *copy_batch_input(struct copybatch *batch, int i);
+
+void copy_batch_destroy(struct copybatch *batch);
+
+#endif
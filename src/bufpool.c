@@ -0,0 +1,274 @@
+/*
+ ============================================================================
+ Name        : bufpool.c
+ Author      : Nikita Staroverov
+ Version     : 1.0.0
+ Copyright   : GPLv2
+ Description : Asynchronous block copying tool, data buffers pool
+ ============================================================================
+ */
+
+/*
+Copyright (C) 2014  Nikita Staroverov
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "bufpool.h"
+#include "numa.h"
+
+/*
+ * Arena size is rounded to this value when huge pages are asked for.
+ */
+#define BUFPOOL_HUGEPAGE_SIZE (2 * 1024 * 1024)
+
+/*
+ * Arena placed on a node is faulted in after its policy is set. Placement is only an optimization,
+ * so memory is used even if the kernel can't place it.
+ */
+
+static void bufpool_place(struct bufpool *pool, int populated) {
+
+	if ((pool->node != -1) && (numa_bind(pool->arena, pool->arenasize, pool->node) == -1)) {
+
+		#ifdef AIOBLKCOPY_DEBUG
+		fprintf(stderr, "bufpool: mbind() to node %i failed: %s\n", pool->node, strerror(errno));
+		#endif
+
+	}
+
+	if (populated == 0) memset(pool->arena, 0, pool->arenasize);
+
+}
+
+/*
+ * Maps the arena, buffers are page aligned so they are good for O_DIRECT if headroom is a multiple of page size.
+ */
+
+static int bufpool_map(struct bufpool *pool) {
+
+	int populate = (pool->node == -1) ? MAP_POPULATE : 0;
+	int mflags = MAP_PRIVATE | MAP_ANONYMOUS;
+
+	pool->arenasize = pool->slotsize * pool->count;
+
+	if ((pool->flags & BUFPOOL_HUGEPAGES) != 0) {
+
+		#ifdef MAP_HUGETLB
+
+		pool->arenasize = (pool->arenasize + BUFPOOL_HUGEPAGE_SIZE - 1) / BUFPOOL_HUGEPAGE_SIZE * BUFPOOL_HUGEPAGE_SIZE;
+
+		pool->arena = mmap(NULL, pool->arenasize, PROT_READ | PROT_WRITE, mflags | populate | MAP_HUGETLB, -1, 0);
+
+		if (pool->arena != MAP_FAILED) {
+
+			bufpool_place(pool, populate);
+
+			return 0;
+
+		}
+
+		#ifdef AIOBLKCOPY_DEBUG
+		fprintf(stderr, "bufpool: MAP_HUGETLB failed: %s\n", strerror(errno));
+		#endif
+
+		#endif
+
+		/*
+		 * No reserved huge pages, transparent ones are the next best thing.
+		 */
+
+		pool->arena = mmap(NULL, pool->arenasize, PROT_READ | PROT_WRITE, mflags, -1, 0);
+
+		if (pool->arena == MAP_FAILED) return -1;
+
+		#ifdef MADV_HUGEPAGE
+
+		madvise(pool->arena, pool->arenasize, MADV_HUGEPAGE);
+
+		#endif
+
+		bufpool_place(pool, 0);
+
+		return 0;
+
+	}
+
+	pool->arena = mmap(NULL, pool->arenasize, PROT_READ | PROT_WRITE, mflags | populate, -1, 0);
+
+	if (pool->arena == MAP_FAILED) return -1;
+
+	bufpool_place(pool, populate);
+
+	return 0;
+
+}
+
+/*
+ * Pool on NUMA node, -1 for memory from any node.
+ */
+
+struct bufpool *bufpool_create(int count, size_t bufsize, size_t headroom, int flags, int node) {
+
+	struct bufpool *pool;
+	int i;
+
+	pool = malloc(sizeof(struct bufpool));
+
+	if (pool == NULL) return NULL;
+
+	memset(pool, 0, sizeof(struct bufpool));
+
+	pool->count = count;
+	pool->bufsize = bufsize;
+	pool->headroom = headroom;
+	pool->slotsize = headroom + bufsize;
+	pool->flags = flags;
+	pool->node = node;
+
+	pool->freelist = malloc(sizeof(char *) * count);
+	pool->refs = malloc(sizeof(int) * count);
+
+	if ((pool->freelist == NULL) || (pool->refs == NULL)) {
+
+		free(pool->freelist);
+		free(pool->refs);
+		free(pool);
+
+		return NULL;
+
+	}
+
+	memset(pool->refs, 0, sizeof(int) * count);
+
+	if (bufpool_map(pool) == -1) {
+
+		free(pool->freelist);
+		free(pool->refs);
+		free(pool);
+
+		return NULL;
+
+	}
+
+	if (((flags & BUFPOOL_MLOCK) != 0) && (mlock(pool->arena, pool->arenasize) == -1)) {
+
+		munmap(pool->arena, pool->arenasize);
+		free(pool->freelist);
+		free(pool->refs);
+		free(pool);
+
+		return NULL;
+
+	}
+
+	if (((flags & BUFPOOL_SHARED) != 0) && (pthread_mutex_init(&pool->lock, NULL) != 0)) {
+
+		munmap(pool->arena, pool->arenasize);
+		free(pool->freelist);
+		free(pool->refs);
+		free(pool);
+
+		return NULL;
+
+	}
+
+	for(i = 0; i < count; i++) pool->freelist[i] = pool->arena + pool->slotsize * (count - i - 1) + headroom;
+
+	pool->nfree = count;
+
+	#ifdef AIOBLKCOPY_DEBUG
+	fprintf(stderr, "bufpool: %i buffers of %zu bytes, arena %zu bytes, node %i\n", count, bufsize, pool->arenasize, node);
+	#endif
+
+	return pool;
+
+}
+
+void bufpool_destroy(struct bufpool *pool) {
+
+	if ((pool->flags & BUFPOOL_SHARED) != 0) pthread_mutex_destroy(&pool->lock);
+
+	munmap(pool->arena, pool->arenasize);
+
+	free(pool->freelist);
+	free(pool->refs);
+	free(pool);
+
+}
+
+/*
+ * Buffer starts headroom bytes into its slot, so division finds the slot.
+ */
+
+static inline int bufpool_slot(struct bufpool *pool, char *buf) {
+
+	return (buf - pool->arena) / pool->slotsize;
+
+}
+
+/*
+ * Returns NULL if all buffers are borrowed.
+ */
+
+char *bufpool_get(struct bufpool *pool) {
+
+	char *buf = NULL;
+
+	if ((pool->flags & BUFPOOL_SHARED) != 0) pthread_mutex_lock(&pool->lock);
+
+	if (pool->nfree != 0) {
+
+		buf = pool->freelist[--pool->nfree];
+
+		pool->refs[bufpool_slot(pool, buf)] = 1;
+
+	}
+
+	if ((pool->flags & BUFPOOL_SHARED) != 0) pthread_mutex_unlock(&pool->lock);
+
+	return buf;
+
+}
+
+/*
+ * One more holder of a borrowed buffer.
+ */
+
+void bufpool_hold(struct bufpool *pool, char *buf) {
+
+	if ((pool->flags & BUFPOOL_SHARED) != 0) pthread_mutex_lock(&pool->lock);
+
+	pool->refs[bufpool_slot(pool, buf)]++ ;
+
+	if ((pool->flags & BUFPOOL_SHARED) != 0) pthread_mutex_unlock(&pool->lock);
+
+}
+
+void bufpool_put(struct bufpool *pool, char *buf) {
+
+	if ((pool->flags & BUFPOOL_SHARED) != 0) pthread_mutex_lock(&pool->lock);
+
+	if (--pool->refs[bufpool_slot(pool, buf)] == 0) pool->freelist[pool->nfree++] = buf;
+
+	if ((pool->flags & BUFPOOL_SHARED) != 0) pthread_mutex_unlock(&pool->lock);
+
+}
@@ -0,0 +1,105 @@
+/*
+ ============================================================================
+ Name        : bufpool.h
+ Author      : Nikita Staroverov
+ Version     : 1.0.0
+ Copyright   : GPLv2
+ Description : Asynchronous block copying tool, data buffers pool
+ ============================================================================
+ */
+
+/*
+Copyright (C) 2014  Nikita Staroverov
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef AIOBLKCOPY_BUFPOOL_H
+#define AIOBLKCOPY_BUFPOOL_H
+
+#include <sys/types.h>
+#include <pthread.h>
+
+/*
+ * Pool flags.
+ */
+#define BUFPOOL_HUGEPAGES 1
+#define BUFPOOL_MLOCK 2
+
+/*
+ * Pool is used by several streams at once, every call takes its lock.
+ */
+#define BUFPOOL_SHARED 4
+
+/*
+ * All data buffers are cut from one arena allocated at startup.
+ * Queue items borrow buffers from the pool and give them back, the pool owns the memory.
+ * A buffer written to several outputs is shared by their queue items, every one of them holds a reference.
+ */
+
+struct bufpool {
+
+	char *arena;
+
+	size_t arenasize;
+
+	size_t bufsize;
+
+	/*
+	 * Bytes reserved before every buffer, the buffer is preceded by them in the arena.
+	 */
+	size_t headroom;
+
+	/*
+	 * Distance between buffers in the arena.
+	 */
+	size_t slotsize;
+
+	int count;
+
+	/*
+	 * Stack of unused buffers.
+	 */
+	char **freelist;
+
+	int nfree;
+
+	/*
+	 * References of every buffer, the buffer goes back to the stack when the last one is dropped.
+	 */
+	int *refs;
+
+	int flags;
+
+	/*
+	 * NUMA node the arena is placed on, -1 if it isn't.
+	 */
+	int node;
+
+	pthread_mutex_t lock;
+
+};
+
+struct bufpool *bufpool_create(int count, size_t bufsize, size_t headroom, int flags, int node);
+
+void bufpool_destroy(struct bufpool *pool);
+
+char *bufpool_get(struct bufpool *pool);
+
+void bufpool_hold(struct bufpool *pool, char *buf);
+
+void bufpool_put(struct bufpool *pool, char *buf);
+
+#endif
@@ -0,0 +1,205 @@
+/*
+ ============================================================================
+ Name        : compress.c
+ Author      : Nikita Staroverov
+ Version     : 1.0.0
+ Copyright   : GPLv2
+ Description : Asynchronous block copying tool, block compression
+ ============================================================================
+ */
+
+/*
+Copyright (C) 2014  Nikita Staroverov
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef HAVE_LZ4
+#include <lz4.h>
+#endif
+
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#include "compress.h"
+
+static const char *methods[] = { "none", "lz4", "zstd" };
+
+/*
+ * Returns method number or -1 if it's unknown or not built in.
+ */
+
+int compress_method(const char *name) {
+
+	#ifdef HAVE_LZ4
+	if (strcmp(name, "lz4") == 0) return COMPRESS_LZ4;
+	#endif
+
+	#ifdef HAVE_ZSTD
+	if (strcmp(name, "zstd") == 0) return COMPRESS_ZSTD;
+	#endif
+
+	return -1;
+
+}
+
+const char *compress_name(int method) {
+
+	if ((method < 0) || (method > COMPRESS_ZSTD)) return "unknown";
+
+	return methods[method];
+
+}
+
+void compress_list(FILE *stream) {
+
+	const char *sep = "";
+
+	#ifdef HAVE_LZ4
+	fprintf(stream, "%slz4", sep);
+	sep = "|";
+	#endif
+
+	#ifdef HAVE_ZSTD
+	fprintf(stream, "%szstd", sep);
+	sep = "|";
+	#endif
+
+	if (sep[0] == 0) fprintf(stream, "none built in");
+
+}
+
+void compress_init(struct compressctx *cc, int method, size_t bufsize) {
+
+	memset(cc, 0, sizeof(struct compressctx));
+
+	cc->method = method;
+	cc->bufsize = bufsize;
+
+	#ifdef HAVE_ZSTD
+	if (method == COMPRESS_ZSTD) {
+
+		cc->cctx = ZSTD_createCCtx();
+		cc->dctx = ZSTD_createDCtx();
+
+	}
+	#endif
+
+}
+
+void compress_free(struct compressctx *cc) {
+
+	#ifdef HAVE_ZSTD
+	if (cc->method == COMPRESS_ZSTD) {
+
+		ZSTD_freeCCtx(cc->cctx);
+		ZSTD_freeDCtx(cc->dctx);
+
+	}
+	#endif
+
+	cc->cctx = NULL;
+	cc->dctx = NULL;
+
+}
+
+/*
+ * Packed block is used only if it is smaller, otherwise 0 is returned and the block is sent as is.
+ */
+
+long long compress_pack(struct compressctx *cc, const char *src, size_t len, char *dst) {
+
+	long long ret = 0;
+
+	switch(cc->method) {
+
+	#ifdef HAVE_LZ4
+	case COMPRESS_LZ4:
+
+		ret = LZ4_compress_default(src, dst, len, cc->bufsize);
+
+		break;
+	#endif
+
+	#ifdef HAVE_ZSTD
+	case COMPRESS_ZSTD:
+
+		if (cc->cctx == NULL) break;
+
+		ret = ZSTD_compressCCtx(cc->cctx, dst, cc->bufsize, src, len, COMPRESS_ZSTD_LEVEL);
+
+		if (ZSTD_isError(ret)) ret = 0;
+
+		break;
+	#endif
+
+	default:
+
+		break;
+
+	}
+
+	if ((ret <= 0) || ((size_t)ret >= len)) return 0;
+
+	return ret;
+
+}
+
+/*
+ * Returns unpacked length or -1 if data is corrupted.
+ */
+
+long long compress_unpack(struct compressctx *cc, const char *src, size_t len, char *dst) {
+
+	long long ret = -1;
+
+	switch(cc->method) {
+
+	#ifdef HAVE_LZ4
+	case COMPRESS_LZ4:
+
+		ret = LZ4_decompress_safe(src, dst, len, cc->bufsize);
+
+		if (ret < 0) ret = -1;
+
+		break;
+	#endif
+
+	#ifdef HAVE_ZSTD
+	case COMPRESS_ZSTD:
+
+		if (cc->dctx == NULL) break;
+
+		ret = ZSTD_decompressDCtx(cc->dctx, dst, cc->bufsize, src, len);
+
+		if (ZSTD_isError(ret)) ret = -1;
+
+		break;
+	#endif
+
+	default:
+
+		break;
+
+	}
+
+	return ret;
+
+}
@@ -0,0 +1,78 @@
+/*
+ ============================================================================
+ Name        : compress.h
+ Author      : Nikita Staroverov
+ Version     : 1.0.0
+ Copyright   : GPLv2
+ Description : Asynchronous block copying tool, block compression
+ ============================================================================
+ */
+
+/*
+Copyright (C) 2014  Nikita Staroverov
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef AIOBLKCOPY_COMPRESS_H
+#define AIOBLKCOPY_COMPRESS_H
+
+#include <stdio.h>
+
+/*
+ * Compression methods, the number is sent to receiver in connection hello.
+ */
+#define COMPRESS_NONE 0
+#define COMPRESS_LZ4 1
+#define COMPRESS_ZSTD 2
+
+/*
+ * Faster zstd levels keep up with network links, higher ones cost more CPU than they save bandwidth.
+ */
+#define COMPRESS_ZSTD_LEVEL 1
+
+/*
+ * State of one compressing thread, zstd keeps its contexts between blocks.
+ * Contexts which couldn't be allocated are NULL, blocks are sent unpacked then.
+ * Both source and destination buffers are bufsize long.
+ */
+
+struct compressctx {
+
+	int method;
+
+	size_t bufsize;
+
+	void *cctx;
+
+	void *dctx;
+
+};
+
+int compress_method(const char *name);
+
+const char *compress_name(int method);
+
+void compress_list(FILE *stream);
+
+void compress_init(struct compressctx *cc, int method, size_t bufsize);
+
+void compress_free(struct compressctx *cc);
+
+long long compress_pack(struct compressctx *cc, const char *src, size_t len, char *dst);
+
+long long compress_unpack(struct compressctx *cc, const char *src, size_t len, char *dst);
+
+#endif
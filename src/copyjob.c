@@ -0,0 +1,4238 @@
+/*
+ ============================================================================
+ Name        : copyjob.c
+ Author      : Nikita Staroverov
+ Version     : 1.0.0
+ Copyright   : GPLv2
+ Description : Asynchronous block copying tool, copy engine library
+ ============================================================================
+ */
+
+/*
+Copyright (C) 2014  Nikita Staroverov
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <string.h>
+#include <limits.h>
+#include <sys/param.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <aio.h>
+#include <pthread.h>
+
+#include "aioblkcopy.h"
+#include "copyjob.h"
+#include "ioengine.h"
+#include "bufpool.h"
+#include "autotune.h"
+#include "sparse.h"
+#include "journal.h"
+#include "zerocopy.h"
+#include "net.h"
+#include "compress.h"
+#include "verify.h"
+#include "workers.h"
+#include "stats.h"
+#include "throttle.h"
+#include "topology.h"
+#include "rescue.h"
+#include "pagecache.h"
+#include "jobsched.h"
+#include "numa.h"
+
+/*
+ * Errors are recorded in the job instead of ending the program, the function using the macros
+ * has its job in variable job and cleans up after label fail.
+ */
+
+#define JOBERROR(errfunc) { \
+joberror(job, errno, 0, (errfunc), __FILE__, __LINE__, NULL); \
+\
+goto fail; \
+}
+
+#define JOBUSAGE(...) { \
+joberror(job, EINVAL, 1, NULL, NULL, 0, __VA_ARGS__); \
+\
+goto fail; \
+}
+
+/*
+ * The AIO signal handler.
+ * POSIX AIO engine keeps IO_SIGNAL blocked and takes it with sigtimedwait(),
+ * the handler only prevents process termination if the signal is unblocked.
+ */
+
+static void aiosighandler( int sig, siginfo_t *si, void *ucontext ) {
+
+	#ifdef AIOBLKCOPY_DEBUG
+	write(STDERR_FILENO, "IO_SIGNAL received\n", 20);
+	#endif
+
+}
+
+/*
+ * Converts size with optional K, M or G suffix to bytes.
+ * Returns -1 if the string isn't a valid size.
+ */
+
+long long copy_parsesize( const char *str ) {
+
+	long long size;
+	long long mult;
+	char *suffix;
+
+	errno = 0;
+
+	size = strtoll(str, &suffix, 10);
+
+	if ((errno != 0) || (suffix == str) || (size < 0)) return -1;
+
+	if (suffix[0] == '\0') return size;
+
+	if (suffix[1] != '\0') return -1;
+
+	switch(suffix[0]) {
+
+	case 'K':
+	case 'k':
+
+		mult = 1024;
+		break;
+
+	case 'M':
+	case 'm':
+
+		mult = 1024 * 1024;
+		break;
+
+	case 'G':
+	case 'g':
+
+		mult = 1024 * 1024 * 1024;
+		break;
+
+	default:
+
+		return -1;
+
+	}
+
+	if (size > LLONG_MAX / mult) return -1;
+
+	return size * mult;
+
+}
+
+/*
+ * Output file, every block read is written to all of them.
+ */
+
+struct outputsetup {
+	int fd;
+	int bouncefd;         /* output without direct io, -1 if output doesn't use it */
+	int seekable;
+	mode_t mode;
+	int maxqsize;         /* simultaneous write requests, 1 if output isn't seekable */
+	int sparse;           /* zeroing method for this output */
+	size_t sector;        /* logical block size, block devices zero only whole blocks */
+};
+
+/*
+ * Copy setup shared by all streams of a job, filled before streams start.
+ */
+
+struct copysetup {
+	int ifd;
+	int iseekable;
+	mode_t imode;
+	off_t isize;          /* input size, zero for not seekable input */
+	int ibouncefd;        /* input without direct io, -1 if input doesn't use it */
+	int outputs;
+	struct outputsetup out[MAX_OUTPUTS];
+	off_t odelta;         /* output offset minus input offset, set by --skip and --seek */
+	off_t alignphase;     /* blocks are aligned for direct io at offsets where offset + alignphase is aligned */
+	size_t dioalign;      /* offset and length alignment of direct io, the biggest of both sides */
+	size_t memalign;      /* memory alignment of direct io */
+	int imaxqsize;
+	int omaxqsize;        /* the biggest output depth */
+	int iquesize;
+	size_t maxblksize;
+	int directio;
+	int netverify;        /* sender sends hashes of blocks */
+	int throttled;        /* requests are limited by throttle */
+	struct throttle throttle;
+	int journaled;        /* jr is initialized */
+	struct journal jr;
+	int rescuing;         /* rescue is initialized */
+	struct rescue rescue;
+	int oseekable;        /* all outputs are seekable */
+	int idirect;
+	int zcmethod;         /* data is copied inside the kernel if it isn't ZEROCOPY_NONE */
+	int netfds[MAX_STREAMS];
+	int nnetfds;          /* connections of network streams */
+	struct timeval starttime;
+	int numanode;         /* node buffers are placed on, -1 if they aren't */
+	cpu_set_t cpus;       /* CPUs the copy threads run on if they are placed */
+	char *engine;         /* I/O engine with parameters of the kernel submission thread */
+	char enginebuf[32];
+};
+
+/*
+ * One range of input copied by its own thread.
+ */
+
+struct copystream {
+
+	struct copyjob *job;
+
+	int id;
+
+	/*
+	 * Completion signal of POSIX AIO engine is IO_SIGNAL + slot, slots are unique in the process.
+	 */
+	int slot;
+
+	/*
+	 * Input range, end is -1 if the stream copies up to the end of input.
+	 */
+	off_t start;
+
+	off_t end;
+
+	pthread_t thread;
+
+	/*
+	 * Descriptors of the stream, network streams have their own connections.
+	 * ofd is the first output, the others are shared by all streams.
+	 */
+	int ifd;
+
+	int ofd;
+
+	/*
+	 * Data bytes the sender reported in trailer of the connection.
+	 */
+	long long netexpect;
+
+	/*
+	 * Results merged into the final statistics.
+	 */
+	size_t copied;
+
+	size_t sparseb;
+
+	size_t deltab;
+
+	size_t resumeb;
+
+	/*
+	 * Bytes of compressed blocks before and after compression.
+	 */
+	size_t zinb;
+
+	size_t zoutb;
+
+	/*
+	 * Sum of block hashes, blocks failed verification.
+	 */
+	uint64_t digest;
+
+	long long verifyfail;
+
+	struct autotune at;
+
+	/*
+	 * Live counters read by progress reporting.
+	 */
+	struct streamstats st;
+
+};
+
+struct copyjob {
+
+	struct copyparams params;
+
+	struct copysetup setup;
+
+	/*
+	 * Streams exist while the job copies, progress is read from them under lock.
+	 */
+	struct copystream *streams;
+
+	int state;
+
+	/*
+	 * Set by the first error, the job fails when its streams have stopped.
+	 */
+	int failed;
+
+	/*
+	 * Set by copy_job_cancel() or by the first error, streams stop at their next loop iteration.
+	 */
+	int cancel;
+
+	pthread_mutex_t lock;
+
+	/*
+	 * Signaled when the job ends, wakes the monitor and waiters.
+	 */
+	pthread_cond_t cond;
+
+	copyprogress progresscb;
+
+	void *progressarg;
+
+	copyverifyfail verifycb;
+
+	void *verifyarg;
+
+	/*
+	 * Budget shared with other jobs of a batch, NULL if the job runs alone.
+	 */
+	struct sched *sched;
+
+	/*
+	 * Monitor thread calls the progress callback and rewrites statistics files.
+	 */
+	pthread_t monitor;
+
+	int monitoring;
+
+	int stopmonitor;
+
+	struct statsnap snap;
+
+	/*
+	 * Thread of copy_job_start().
+	 */
+	pthread_t thread;
+
+	int started;
+
+	/*
+	 * Start of the copy for snapshots, bytes to copy or zero if unknown.
+	 */
+	long long start;
+
+	off_t total;
+
+	struct copyresult result;
+
+	struct copyerror error;
+
+};
+
+/*
+ * Keeps the first error of the job and stops its streams. message is printf() format, NULL if there is none.
+ */
+
+static void joberror(struct copyjob *job, int code, int usage, const char *func, const char *file, int line, const char *fmt, ...) {
+
+	va_list ap;
+
+	pthread_mutex_lock(&job->lock);
+
+	if (job->failed == 0) {
+
+		job->failed = 1;
+
+		job->error.code = code;
+		job->error.usage = usage;
+		job->error.func = func;
+		job->error.file = file;
+		job->error.line = line;
+
+		if (fmt != NULL) {
+
+			va_start(ap, fmt);
+
+			vsnprintf(job->error.message, sizeof(job->error.message), fmt, ap);
+
+			va_end(ap);
+
+		}
+
+	}
+
+	STATS_SET(job->cancel, 1);
+
+	pthread_mutex_unlock(&job->lock);
+
+}
+
+
+/*
+ * Read block is given to workers if it must be hashed, packed or unpacked, it's ready when they are done.
+ * Received compressed block already has zbuf, block to send gets it here. off is the block offset in data.
+ * Returns -1 on error.
+ */
+
+static int startwork(struct copyjob *job, struct workers *wk, struct bufpool *pool, struct blkqueitem *item, int pack, uint64_t off) {
+
+	int ops = 0;
+
+	if (item->zbuf != NULL) ops |= WORK_UNPACK;
+
+	if (job->params.verify != VERIFY_NONE) ops |= WORK_HASH;
+
+	if (pack == 1) {
+
+		ops |= WORK_PACK;
+
+		item->zbuf = bufpool_get(pool);
+
+		if (item->zbuf == NULL) {
+
+			errno = ENOBUFS;
+
+			JOBERROR("bufpool_get()");
+
+		}
+
+	}
+
+	if (ops == 0) return 0;
+
+	item->status = QUEITEM_WORKING;
+
+	if (workers_queue(wk, item, ops, off) == -1) JOBERROR("workers_queue()");
+
+	return 0;
+
+fail:
+
+	return -1;
+
+}
+
+/*
+ * Direct io takes only aligned offset, length and memory, the rest goes through page cache by the other descriptor:
+ * unaligned head and tail of the copied range and retries after short transfers.
+ */
+
+static int queueio(struct copysetup *setup, struct ioengine *eng, struct blkqueitem *item, int op) {
+
+	item->iofd = item->fd;
+
+	if ((item->bouncefd != -1) && ((((uintptr_t)item->iobuf % setup->memalign) | (((uint64_t)item->iooff | item->iolen) % setup->dioalign)) != 0)) {
+
+		item->iofd = item->bouncefd;
+
+	}
+
+	return ioengine_queue(eng, item, op);
+
+}
+
+/*
+ * With --on-error=skip bad ranges of input aren't written, the block goes to output in pieces between them.
+ * Sets the piece which starts done bytes into the block or after the bad range there. Returns 0 if nothing is left.
+ */
+
+static int writepiece(struct copysetup *setup, struct blkqueitem *item, size_t done) {
+
+	off_t start = item->fdoffset - setup->odelta;
+	off_t end = start + item->blklen;
+	off_t bad;
+	off_t badend;
+
+	if (done == item->blklen) return 0;
+
+	bad = rescue_nextbad(&setup->rescue, start + done, end, &badend);
+
+	/*
+	 * Bad ranges are never adjacent, the next one starts after good data.
+	 */
+
+	if (bad == (off_t)(start + done)) {
+
+		if (badend == end) return 0;
+
+		done = badend - start;
+
+		bad = rescue_nextbad(&setup->rescue, badend, end, &badend);
+
+	}
+
+	item->iobuf = item->buffer + done;
+	item->iooff = item->fdoffset + done;
+	item->iolen = bad - start - done;
+
+	return 1;
+
+}
+
+/*
+ * Counts written block which differs from the block read and tells the caller where it is.
+ */
+
+static void verifyfailed(struct copystream *cs, size_t off, size_t len) {
+
+	if (cs->job->verifycb != NULL) cs->job->verifycb(cs->job, off, len, cs->job->verifyarg);
+
+	cs->verifyfail++ ;
+
+}
+
+/*
+ * Items of a queue visited by the main loop. Completed items come first, then free ones until a free item is left
+ * unused, the next ones would be left as well. The rest are in flight or wait for output and aren't touched.
+ * After the visit the item is put on the list its status belongs to.
+ */
+
+struct queuewalk {
+
+	struct blkqueitem *que;
+
+	int size;
+
+	struct itemlist done;
+
+	struct itemlist free;
+
+	/*
+	 * Blocks read and waiting for output, only in input queue.
+	 */
+	struct itemlist ready;
+
+	int cur;
+
+	int fromfree;
+
+	int usefree;
+
+};
+
+static void queuewalk_init(struct queuewalk *qw, struct blkqueitem *que, int size) {
+
+	int i;
+
+	memset(qw, 0, sizeof(struct queuewalk));
+
+	qw->que = que;
+	qw->size = size;
+	qw->cur = -1;
+
+	for(i = 0; i < size; i++) itemlist_push(&qw->free, &que[i]);
+
+}
+
+static void queuewalk_start(struct queuewalk *qw) {
+
+	qw->cur = -1;
+	qw->usefree = 1;
+
+}
+
+/*
+ * Returns index of the next item to visit or -1.
+ */
+
+static int queuewalk_next(struct queuewalk *qw) {
+
+	struct blkqueitem *item;
+
+	if (qw->cur != -1) {
+
+		item = &qw->que[qw->cur];
+
+		if (item->status == QUEITEM_FREE) {
+
+			itemlist_push(&qw->free, item);
+
+			if (qw->fromfree == 1) qw->usefree = 0;
+
+		}
+		else if (item->status == QUEITEM_READY) {
+
+			itemlist_push(&qw->ready, item);
+
+		}
+
+	}
+
+	qw->cur = -1;
+
+	item = itemlist_pop(&qw->done);
+
+	qw->fromfree = 0;
+
+	if ((item == NULL) && (qw->usefree == 1)) {
+
+		item = itemlist_pop(&qw->free);
+
+		qw->fromfree = 1;
+
+	}
+
+	if (item == NULL) return -1;
+
+	qw->cur = item - qw->que;
+
+	return qw->cur;
+
+}
+
+/*
+ * One output of a stream. Every output has its own queue and depth, so a slow output holds back only the input
+ * blocks it hasn't taken yet. With several outputs all of them take blocks in the order they were requested.
+ */
+
+struct streamoutput {
+
+	int fd;
+
+	int seekable;
+
+	mode_t mode;
+
+	struct blkqueitem *que;
+
+	int quesize;
+
+	struct queuewalk w;
+
+	/*
+	 * Requests in the queue, number of the last block taken from input queue.
+	 */
+	int qsize;
+
+	long long rqnum;
+
+	/*
+	 * Bytes done, it's the output offset if input isn't seekable.
+	 */
+	size_t off;
+
+	struct sparsemap sp;
+
+	/*
+	 * Sync request of --sync=every isn't in the queue, at most one is in flight.
+	 * Bytes written since the last one was queued.
+	 */
+	struct blkqueitem sync;
+
+	int syncing;
+
+	size_t unsynced;
+
+	struct pagecache pc;
+
+};
+
+/*
+ * Sorts items completed by the engine or workers by their queue.
+ */
+
+static void queuewalk_sort(struct itemlist *done, struct queuewalk *iw, struct streamoutput *outs, int nout) {
+
+	struct blkqueitem *item;
+	struct queuewalk *ow;
+	int k;
+
+	while((item = itemlist_pop(done)) != NULL) {
+
+		/*
+		 * Sync requests aren't walked, their result is checked in place.
+		 */
+
+		for(k = 0; k < nout; k++) if (item == &outs[k].sync) break;
+
+		if (k < nout) continue;
+
+		if ((item >= iw->que) && (item < iw->que + iw->size)) {
+
+			itemlist_push(&iw->done, item);
+
+			continue;
+
+		}
+
+		for(k = 0; k < nout - 1; k++) {
+
+			ow = &outs[k].w;
+
+			if ((item >= ow->que) && (item < ow->que + ow->size)) break;
+
+		}
+
+		itemlist_push(&outs[k].w.done, item);
+
+	}
+
+}
+
+/*
+ * Bytes done on all outputs.
+ */
+
+static size_t outputsdone(struct streamoutput *outs, int nout) {
+
+	size_t done = outs[0].off;
+	int k;
+
+	for(k = 1; k < nout; k++) if (outs[k].off < done) done = outs[k].off;
+
+	return done;
+
+}
+
+/*
+ * Copies one range of input with its own queues, I/O engine and buffers.
+ * Streams share only descriptors and the journal. Errors are recorded in the job.
+ */
+
+static void *copystream( void *arg ) {
+
+	struct copystream *cs = arg;
+	struct copyjob *job = cs->job;
+	struct copyparams *params = &job->params;
+	struct copysetup *setup = &job->setup;
+
+	int ifd = cs->ifd;
+
+	/*
+	 * Network receiver gets offsets in block headers, sender puts them there.
+	 */
+	int netin = (params->listen != NULL);
+	int netout = (params->connect != NULL);
+	uint64_t netoff;
+	uint32_t netlen;
+	uint32_t netwire;
+	uint64_t nethash;
+	int pack = netout & (params->compress != COMPRESS_NONE);
+
+	/*
+	 * Bytes read from input which isn't seekable, offsets of its blocks for hashing.
+	 */
+	size_t idone = 0;
+
+	/*
+	 * Requests numbering needed for write ordering.
+	 */
+	long long irqnum = 0;
+
+	/*
+	 * Next input offset.
+	 */
+	size_t ioff = cs->start;
+
+	/*
+	 * Current queue size. Mostly needed for debugging.
+	 */
+
+	int iqsize = 0;
+	int oqsize = 0;
+
+	int syncing = 0;
+
+	int imaxqsize = setup->imaxqsize;
+	int omaxqsize = setup->omaxqsize;
+	int oquesize = 0;
+	int iquesize = setup->iquesize;
+	int ireading = 0;
+
+	/*
+	 * Current limits of simultaneous requests and block size, changed only by autotuning.
+	 */
+	int ilimit;
+	int olimit;
+	size_t cblksize = params->blksize;
+	size_t maxblksize = setup->maxblksize;
+	struct autotune *at = &cs->at;
+	long long now = nstime();
+
+	int iseekable = setup->iseekable;
+	int ioffsets = iseekable | netin;
+	off_t isize = setup->isize;
+	off_t odelta = setup->odelta;
+
+	/*
+	 * Output ranges zeroed in place of input holes are aligned to that, block devices zero only whole sectors.
+	 */
+	off_t zalign = 1;
+	off_t zoff;
+	off_t zend;
+	off_t alignphase = setup->alignphase;
+
+	struct journal *jr = &setup->jr;
+	struct rescue *rs = &setup->rescue;
+	struct throttle *thr = (setup->throttled == 1) ? &setup->throttle : NULL;
+	struct timespec ts;
+
+	/*
+	 * Used for end of data detection.
+	 */
+	int eof = 0;
+
+	/*
+	 * Working queues, oque is the queue of the output being visited.
+	 */
+	struct blkqueitem *ique = NULL;
+	struct blkqueitem *oque;
+
+	/*
+	 * Input items by request number modulo iquesize. Blocks not taken by all outputs have numbers from the lowest
+	 * output rqnum + 1 up to irqnum, there are at most iquesize of them, so they never share a slot.
+	 * Output which isn't seekable and every one of several outputs take the next block from here instead of
+	 * searching the input queue.
+	 */
+	int *inorder = NULL;
+
+	struct queuewalk iw;
+
+	/*
+	 * Page cache hints of input without direct io, the window covers at least two blocks.
+	 */
+	struct pagecache ipc;
+	size_t cachewindow = (maxblksize * 2 > PAGECACHE_WINDOW) ? maxblksize * 2 : PAGECACHE_WINDOW;
+
+	/*
+	 * Failed reads waiting for their retry time.
+	 */
+	struct itemlist retry = { NULL, NULL };
+	struct blkqueitem *item;
+	struct blkqueitem *nextitem;
+	size_t badb;
+
+	struct streamoutput outs[MAX_OUTPUTS];
+	struct streamoutput *out;
+	int nout = setup->outputs;
+
+	/*
+	 * I/O engine serving both queues.
+	 */
+	struct ioengine *eng = NULL;
+
+	/*
+	 * Data buffers of all requests. Blocks of a batch job are read to buffers of the pool shared with other jobs,
+	 * its own pool has only the buffers taken beside them.
+	 */
+	struct bufpool *pool = NULL;
+	struct bufpool *dpool = NULL;
+	struct sched *sc = job->sched;
+	int starved = 0;
+
+	/*
+	 * Workers hashing blocks, packing blocks to send or unpacking received ones.
+	 */
+	struct workers *wk = NULL;
+
+	int iofds[2 * (1 + MAX_OUTPUTS)];
+	int i;
+	int j;
+	int k;
+	long long tint;
+
+	memset(outs, 0, sizeof(outs));
+
+	/*
+	 * Initialize input and output queues.
+	 */
+
+	ique = aligned_alloc(__alignof__(struct blkqueitem), sizeof(struct blkqueitem) * iquesize);
+
+	if (ique == NULL) JOBERROR("aligned_alloc()");
+
+	inorder = malloc(sizeof(int) * iquesize);
+
+	if (inorder == NULL) JOBERROR("malloc()");
+
+	memset(inorder, 0, sizeof(int) * iquesize);
+
+	memset(ique, 0, sizeof(struct blkqueitem) * iquesize);
+
+	for(i = 0; i < iquesize; i++) {
+
+		ique[i].status = QUEITEM_FREE;
+
+		ique[i].fd = ifd;
+		ique[i].bouncefd = setup->ibouncefd;
+
+	}
+
+	/*
+	 * The first output of a network stream is its own connection.
+	 */
+
+	for(k = 0; k < nout; k++) {
+
+		out = &outs[k];
+
+		out->fd = (k == 0) ? cs->ofd : setup->out[k].fd;
+		out->seekable = setup->out[k].seekable;
+		out->mode = setup->out[k].mode;
+		out->quesize = setup->out[k].maxqsize;
+
+		if (S_ISREG(out->mode) == 0) zalign = topology_lcm(zalign, setup->out[k].sector);
+
+		out->que = aligned_alloc(__alignof__(struct blkqueitem), sizeof(struct blkqueitem) * out->quesize);
+
+		if (out->que == NULL) JOBERROR("aligned_alloc()");
+
+		memset(out->que, 0, sizeof(struct blkqueitem) * out->quesize);
+
+		for(i = 0; i < out->quesize; i++) {
+
+			out->que[i].status =  QUEITEM_FREE;
+
+			out->que[i].fd = out->fd;
+			out->que[i].bouncefd = setup->out[k].bouncefd;
+
+		}
+
+		oquesize += out->quesize;
+
+	}
+
+	/*
+	 * The engine can hold all requests of both queues.
+	 */
+
+	eng = ioengine_create(setup->engine, imaxqsize + oquesize + nout, setup->directio, cs->slot);
+
+	if (eng == NULL) JOBERROR("ioengine_create()");
+
+	/*
+	 * A buffer is borrowed by input item and shared with output items, so all queues can hold buffers at once.
+	 * Delta copy and read back need one more buffer per output item for output data, compression one more per item
+	 * for packed data. Batch job reads to the shared pool, its own pool has only these extra buffers, if any.
+	 */
+
+	j = (params->hugepages ? BUFPOOL_HUGEPAGES : 0) | (params->mlock ? BUFPOOL_MLOCK : 0);
+
+	tint = (iquesize + oquesize) * (params->compress != COMPRESS_NONE) + oquesize * ((params->delta == 1) || (params->verify == VERIFY_READBACK));
+
+	if (sc != NULL) {
+
+		dpool = sched_join(sc, maxblksize, (netin | netout) ? NET_HEADROOM : 0, j, setup->numanode);
+
+		if (dpool == NULL) JOBERROR("sched_join()");
+
+	}
+	else {
+
+		tint += iquesize + oquesize;
+
+	}
+
+	if (tint != 0) {
+
+		pool = bufpool_create(tint, maxblksize, (netin | netout) ? NET_HEADROOM : 0, j, setup->numanode);
+
+		if (pool == NULL) JOBERROR("bufpool_create()");
+
+	}
+
+	if (sc == NULL) dpool = pool;
+
+	/*
+	 * Descriptors and buffers don't change during the copy, the engine may register them once.
+	 */
+
+	iofds[0] = ifd;
+	j = 1;
+
+	if (setup->ibouncefd != -1) iofds[j++] = setup->ibouncefd;
+
+	for(k = 0; k < nout; k++) {
+
+		iofds[j++] = outs[k].fd;
+
+		if (setup->out[k].bouncefd != -1) iofds[j++] = setup->out[k].bouncefd;
+
+	}
+
+	if (ioengine_setfiles(eng, iofds, j) == -1) JOBERROR("ioengine_setfiles()");
+
+	if (ioengine_setbuffers(eng, dpool->arena, dpool->arenasize, dpool->slotsize) == -1) JOBERROR("ioengine_setbuffers()");
+
+	if ((params->compress != COMPRESS_NONE) || (params->verify != VERIFY_NONE)) {
+
+		wk = workers_create(params->compress, params->workthreads, iquesize + oquesize, maxblksize);
+
+		if (wk == NULL) JOBERROR("workers_create()");
+
+	}
+
+	queuewalk_init(&iw, ique, iquesize);
+
+	/*
+	 * Input holes are looked for with the map of the first output.
+	 */
+
+	for(k = 0; k < nout; k++) {
+
+		queuewalk_init(&outs[k].w, outs[k].que, outs[k].quesize);
+
+		sparse_init(&outs[k].sp, (S_ISREG(setup->imode) && (iseekable == 1)) ? ifd : -1, outs[k].fd, setup->out[k].sparse, jr);
+
+	}
+
+	/*
+	 * Descriptors opened with O_DIRECT don't fill page cache.
+	 */
+
+	j = (params->dropcache == 1) && (netin == 0) && (iseekable == 1) && (setup->ibouncefd == -1);
+
+	if (pagecache_init(&ipc, j ? ifd : -1, 1, cachewindow) == -1) JOBERROR("posix_fadvise()");
+
+	for(k = 0; k < nout; k++) {
+
+		j = (params->dropcache == 1) && (setup->out[k].bouncefd == -1) && (S_ISREG(outs[k].mode) || S_ISBLK(outs[k].mode));
+
+		if (pagecache_init(&outs[k].pc, j ? outs[k].fd : -1, 0, cachewindow) == -1) JOBERROR("posix_fadvise()");
+
+	}
+
+	ilimit = imaxqsize;
+	olimit = omaxqsize;
+
+	if (params->autotune == 1) {
+
+		autotune_init(at, imaxqsize, omaxqsize, cblksize, maxblksize, setup->dioalign, nstime());
+
+		ilimit = at->rd.depth;
+		olimit = at->wr.depth;
+
+	}
+
+	/*
+	 * Main loop of the stream.
+	 */
+
+	for(;;) {
+
+		if (STATS_GET(job->cancel) == 1) {
+
+			errno = ECANCELED;
+
+			JOBERROR("copystream()");
+
+		}
+
+		starved = 0;
+
+		if ((params->autotune == 1) && (autotune_update(at, now) == 1)) {
+
+			ilimit = at->rd.depth;
+			olimit = at->wr.depth;
+			cblksize = at->blksize;
+
+		}
+
+		/*
+		 * Check completed input items and send unused items to AIO working queue.
+		 */
+
+		queuewalk_sort(&eng->done, &iw, outs, nout);
+
+		if (wk != NULL) queuewalk_sort(&wk->reaped, &iw, outs, nout);
+
+		queuewalk_start(&iw);
+
+		for(i = queuewalk_next(&iw); i != -1; i = queuewalk_next(&iw)) {
+
+			if (ique[i].status == QUEITEM_READY) continue;
+
+			/*
+			 * Check for hashed, packed or unpacked blocks.
+			 */
+
+			if (ique[i].status == QUEITEM_WORKING) {
+
+				if (ique[i].retcode == EINPROGRESS) continue;
+
+				/*
+				 * Block with packed buffer failed packing or unpacking, other blocks were only hashed.
+				 */
+
+				if (ique[i].retcode != 0) {
+
+					errno = ique[i].retcode;
+
+					JOBERROR((ique[i].zbuf == NULL) ? "worker" : ((netin == 1) ? "decompress" : "compress"));
+
+				}
+
+				cs->digest += ique[i].hash;
+
+				if (netin == 1) {
+
+					/*
+					 * Block header is still in the headroom of the buffer.
+					 */
+					net_getheader(ique[i].buffer - NET_HDRSIZE, &netoff, &netlen, &netwire, &nethash);
+
+					if (ique[i].zbuf != NULL) {
+
+						if (ique[i].readyb != netlen) {
+
+							errno = EPROTO;
+
+							JOBERROR("decompress");
+
+						}
+
+						bufpool_put(pool, ique[i].zbuf);
+
+						ique[i].zbuf = NULL;
+
+						ique[i].blklen = ique[i].readyb;
+
+					}
+
+					if ((setup->netverify == 1) && (ique[i].hash != nethash)) verifyfailed(cs, ique[i].fdoffset, ique[i].readyb);
+
+				}
+				else if ((ique[i].zbuf != NULL) && (ique[i].zlen == 0)) {
+
+					/*
+					 * Packing didn't make the block smaller, it's sent as is.
+					 */
+					bufpool_put(pool, ique[i].zbuf);
+
+					ique[i].zbuf = NULL;
+
+				}
+
+				ique[i].status = QUEITEM_READY;
+
+				continue;
+
+			}
+
+			/*
+			 * Check for input operations in progress.
+			 */
+
+			if (ique[i].status == QUEITEM_INPROGRESS) {
+
+				switch(ique[i].retcode) {
+
+				case 0:
+
+					if (params->autotune == 1) autotune_read(at, ique[i].iores, now - ique[i].iostart);
+
+					lathist_add(&cs->st.rd, now - ique[i].iostart);
+
+					STATS_ADD(cs->st.rlatsum, now - ique[i].iostart);
+					STATS_ADD(cs->st.reads, 1);
+					STATS_ADD(cs->st.rbytes, ique[i].iores);
+
+					ique[i].retcode = ique[i].iores;
+
+					if (ique[i].retcode == 0) {
+
+						/*
+						 * Sender always ends the connection with trailer.
+						 */
+						if (netin == 1) {
+
+							errno = ECONNRESET;
+
+							JOBERROR("read");
+
+						}
+
+						eof = 1;
+
+						#ifdef AIOBLKCOPY_DEBUG
+						fprintf(stderr, "READ EOF rqnum: %lld fd: %i offset: %lld bytes: %i iqsize: %i\n", \
+								ique[i].rqnum, ique[i].fd, (long long)ique[i].iooff, \
+								ique[i].retcode, iqsize);
+						#endif
+
+						if (ique[i].readyb != 0) {
+
+							ique[i].status = QUEITEM_READY;
+							ireading-- ;
+
+							if ((wk != NULL) && (startwork(job, wk, pool, &ique[i], pack, (ioffsets == 1) ? ique[i].fdoffset - params->skip : idone) == -1)) goto fail;
+
+							idone += ique[i].readyb;
+
+							continue;
+
+						}
+
+						break;
+
+					}
+
+					ique[i].readyb += ique[i].retcode;
+
+					if (pagecache_read(&ipc, ique[i].iooff, ique[i].retcode) == -1) JOBERROR("posix_fadvise()");
+
+					/*
+					 * If we haven't got full block we'll try again and again and again...
+					 */
+
+					if (ique[i].readyb != ique[i].blklen) {
+
+						STATS_ADD(cs->st.shortreads, 1);
+
+						ique[i].iobuf += ique[i].retcode;
+
+						if (iseekable == 1)	{
+
+							ique[i].iooff = ique[i].fdoffset + ique[i].readyb;
+
+						}
+						else {
+
+							ique[i].iooff = 0;
+
+						}
+
+						ique[i].iolen = ique[i].blklen - ique[i].readyb;
+
+						if (ique[i].rescuelen != 0) rescue_next(&ique[i]);
+
+						if (queueio(setup, eng, &ique[i], IOENGINE_READ) == -1) JOBERROR("ioengine_queue()");
+
+						#ifdef AIOBLKCOPY_DEBUG
+						fprintf(stderr, "READ INPROGRESS rqnum: %lld fd: %i offset: %lld bytes: %zu iqsize: %i\n", \
+							ique[i].rqnum, ique[i].fd, (long long)ique[i].iooff, \
+							ique[i].iolen, iqsize);
+						#endif
+
+						continue;
+
+					}
+
+					/*
+					 * Network block header is received, the block itself follows it.
+					 */
+
+					if (ique[i].nethdr == 1) {
+
+						net_getheader(ique[i].buffer - NET_HDRSIZE, &netoff, &netlen, &netwire, &nethash);
+
+						ique[i].nethdr = 0;
+
+						if (netlen == 0) {
+
+							cs->netexpect = netoff;
+
+							eof = 1;
+
+							break;
+
+						}
+
+						if ((netlen > maxblksize) || (netwire > netlen) || ((netwire < netlen) && (params->compress == COMPRESS_NONE))) {
+
+							errno = EPROTO;
+
+							JOBERROR("read");
+
+						}
+
+						if (params->compress != COMPRESS_NONE) {
+
+							cs->zinb += netlen;
+							cs->zoutb += netwire;
+
+						}
+
+						ique[i].fdoffset = netoff;
+						ique[i].blklen = netlen;
+						ique[i].readyb = 0;
+
+						ique[i].iobuf = ique[i].buffer;
+						ique[i].iolen = netlen;
+						ique[i].iooff = 0;
+
+						/*
+						 * Compressed block is received to its own buffer and unpacked to the item buffer.
+						 */
+
+						if (netwire < netlen) {
+
+							ique[i].zbuf = bufpool_get(pool);
+
+							if (ique[i].zbuf == NULL) {
+
+								errno = ENOBUFS;
+
+								JOBERROR("bufpool_get()");
+
+							}
+
+							ique[i].zlen = netwire;
+
+							ique[i].blklen = netwire;
+							ique[i].iobuf = ique[i].zbuf;
+							ique[i].iolen = netwire;
+
+						}
+
+						if (queueio(setup, eng, &ique[i], IOENGINE_READ) == -1) JOBERROR("ioengine_queue()");
+
+						continue;
+
+					}
+
+					ique[i].status = QUEITEM_READY;
+					ireading-- ;
+
+					#ifdef AIOBLKCOPY_DEBUG
+					fprintf(stderr, "READ COMPLETED rqnum: %lld fd: %i offset: %lld bytes: %zu iqsize: %i\n", \
+							ique[i].rqnum, ique[i].fd, (long long)ique[i].iooff, \
+							ique[i].readyb, iqsize);
+					#endif
+
+					if ((wk != NULL) && (startwork(job, wk, pool, &ique[i], pack, (ioffsets == 1) ? ique[i].fdoffset - params->skip : idone) == -1)) goto fail;
+
+					idone += ique[i].readyb;
+
+					continue;
+
+				case EINPROGRESS:
+
+					continue;
+
+				case ECANCELED:
+
+					STATS_ADD(cs->st.rcancels, 1);
+
+					#ifdef AIOBLKCOPY_DEBUG
+					fprintf(stderr, "READ CANCELED rqnum: %lld fd: %i offset:  %lld bytes: %zi iqsize: %i\n", \
+						ique[i].rqnum, ique[i].fd, (long long)ique[i].iooff, \
+						ique[i].iores, iqsize);
+					#endif
+
+					break;
+
+				default:
+
+					STATS_ADD(cs->st.rerrors, 1);
+
+					badb = ique[i].badb;
+
+					tint = (rs->mode == RESCUE_ABORT) ? -1 : rescue_failed(rs, &ique[i], now);
+
+					if (tint == -1) {
+
+						errno = ique[i].retcode;
+
+						JOBERROR("read");
+
+					}
+
+					STATS_ADD(cs->st.badb, ique[i].badb - badb);
+
+					#ifdef AIOBLKCOPY_DEBUG
+					fprintf(stderr, "READ FAILED rqnum: %lld fd: %i offset: %lld error: %i rescue: %lld\n", \
+						ique[i].rqnum, ique[i].fd, (long long)ique[i].iooff, ique[i].retcode, tint);
+					#endif
+
+					if (tint == RESCUE_WAIT) {
+
+						itemlist_push(&retry, &ique[i]);
+
+						continue;
+
+					}
+
+					if (tint == RESCUE_AGAIN) {
+
+						if (queueio(setup, eng, &ique[i], IOENGINE_READ) == -1) JOBERROR("ioengine_queue()");
+
+						continue;
+
+					}
+
+					/*
+					 * The last sector of the block was bad.
+					 */
+
+					ique[i].status = QUEITEM_READY;
+					ireading-- ;
+
+					if ((wk != NULL) && (startwork(job, wk, pool, &ique[i], pack, ique[i].fdoffset - params->skip) == -1)) goto fail;
+
+					idone += ique[i].readyb;
+
+					continue;
+
+				}
+
+				ique[i].status = QUEITEM_FREE;
+
+				bufpool_put(dpool, ique[i].buffer);
+
+				ique[i].buffer = NULL;
+
+				if (ique[i].zbuf != NULL) {
+
+					bufpool_put(pool, ique[i].zbuf);
+
+					ique[i].zbuf = NULL;
+
+				}
+
+				iqsize-- ;
+				ireading-- ;
+
+			}
+			/*
+			 * Prepare and send unused queitems to AIO working queue.
+			 */
+			else {
+
+				if (eof == 1) continue;
+
+				if (ireading >= ilimit) continue;
+
+				/*
+				 * Batch job holds at most its share of the shared buffers. Every item of both queues counts,
+				 * so a block written to several outputs is counted more than once.
+				 */
+
+				if ((sc != NULL) && (iqsize + oqsize >= sched_share(sc))) continue;
+
+				if ((thr != NULL) && (throttle_allow(thr, THROTTLE_READ, now) == 0)) continue;
+
+				/*
+				 * Skip ranges written by interrupted copy.
+				 */
+
+				if (params->resume == 1) {
+
+					tint = journal_nextmissing(jr, ioff);
+
+					if ((cs->end != -1) && (tint > cs->end)) tint = cs->end;
+
+					if ((size_t)tint > ioff) {
+
+						cs->resumeb += tint - ioff;
+
+						for(k = 0; k < nout; k++) outs[k].off += tint - ioff;
+
+						ioff = tint;
+
+					}
+
+				}
+
+				/*
+				 * Skip input holes, the output range is zeroed instead.
+				 */
+
+				if ((params->sparse != SPARSE_NONE) && (iseekable == 1)) {
+
+					tint = sparse_nextdata(&outs[0].sp, ioff, cblksize);
+
+					if (tint == -1) {
+
+						if (errno != ENXIO) JOBERROR("lseek()");
+
+						/*
+						 * Only a hole is left up to the end of input.
+						 */
+						tint = isize;
+
+						eof = 1;
+
+					}
+
+					if ((cs->end != -1) && (tint >= cs->end)) {
+
+						tint = cs->end;
+
+						eof = 1;
+
+					}
+
+					/*
+					 * Hole is zeroed from an aligned output offset up to the last aligned one,
+					 * the rest is read and written as data.
+					 */
+
+					zend = (tint + odelta) / zalign * zalign - odelta;
+
+					if ((((off_t)ioff + odelta) % zalign != 0) || (zend < (off_t)ioff)) zend = ioff;
+
+					if (zend < tint) eof = 0;
+
+					if (zend > (off_t)ioff) {
+
+						for(k = 0; k < nout; k++) {
+
+							if (sparse_zero(&outs[k].sp, ioff + odelta, zend - ioff) == -1) JOBERROR("sparse_zero()");
+
+							cs->sparseb += zend - ioff;
+							outs[k].off += zend - ioff;
+
+						}
+
+						ioff = zend;
+
+					}
+
+					if (eof == 1) continue;
+
+				}
+
+				/*
+				 * The stream ends where the next one starts.
+				 */
+
+				if ((cs->end != -1) && ((off_t)ioff >= cs->end)) {
+
+					eof = 1;
+
+					continue;
+
+				}
+
+				/*
+				 * Unreadable sectors are filled only up to the end of input.
+				 */
+
+				if ((rs->mode != RESCUE_ABORT) && ((off_t)ioff >= isize)) {
+
+					eof = 1;
+
+					continue;
+
+				}
+
+				ique[i].buffer = bufpool_get(dpool);
+
+				if (ique[i].buffer == NULL) {
+
+					/*
+					 * Other jobs haven't given back buffers above their share yet.
+					 */
+
+					if (sc != NULL) {
+
+						starved = 1;
+
+						continue;
+
+					}
+
+					errno = ENOBUFS;
+
+					JOBERROR("bufpool_get()");
+
+				}
+
+				ique[i].rqnum = ++irqnum;
+				ique[i].pending = nout;
+
+				inorder[irqnum % iquesize] = i;
+				ique[i].status = QUEITEM_INPROGRESS;
+				ique[i].retcode = EINPROGRESS;
+				ique[i].readyb = 0;
+				ique[i].retries = 0;
+				ique[i].rescuelen = 0;
+				ique[i].badb = 0;
+
+				if (iseekable == 1) {
+
+					ique[i].fdoffset = ioff;
+
+				}
+				else {
+
+					ique[i].fdoffset = 0;
+
+				}
+
+				ique[i].iobuf = ique[i].buffer;
+				ique[i].iooff = ique[i].fdoffset;
+				ique[i].blklen = cblksize;
+
+				/*
+				 * Unaligned start of the range is read up to a block boundary, so the next blocks are aligned
+				 * for direct io.
+				 */
+
+				if ((netin == 0) && ((ioff + alignphase) % setup->dioalign != 0)) ique[i].blklen = cblksize - (ioff + alignphase) % cblksize;
+
+				if ((cs->end != -1) && ((off_t)(ioff + cblksize) > cs->end)) ique[i].blklen = cs->end - ioff;
+
+				if ((rs->mode != RESCUE_ABORT) && ((off_t)(ioff + ique[i].blklen) > isize)) ique[i].blklen = isize - ioff;
+
+				ique[i].iolen = ique[i].blklen;
+
+				if (pagecache_ahead(&ipc, ioff + ique[i].blklen) == -1) JOBERROR("posix_fadvise()");
+
+				/*
+				 * Network receiver reads block header first.
+				 */
+
+				if (netin == 1) {
+
+					ique[i].nethdr = 1;
+
+					ique[i].iobuf = ique[i].buffer - NET_HDRSIZE;
+					ique[i].blklen = NET_HDRSIZE;
+					ique[i].iolen = NET_HDRSIZE;
+
+				}
+
+				if (queueio(setup, eng, &ique[i], IOENGINE_READ) == -1) JOBERROR("ioengine_queue()");
+
+				if (thr != NULL) throttle_charge(thr, THROTTLE_READ, ique[i].iolen);
+
+				ioff += ique[i].blklen;
+
+				iqsize++ ;
+				ireading++ ;
+
+				#ifdef AIOBLKCOPY_DEBUG
+				fprintf(stderr, "READ QUEUED rqnum: %lld fd: %i offset: %lld bytes: %zu iqsize: %i\n", \
+						ique[i].rqnum, ique[i].fd, (long long)ique[i].iooff, \
+						ique[i].iolen, iqsize);
+				#endif
+
+			}
+
+		}
+
+		/*
+		 * Failed reads are queued again when their backoff is over.
+		 */
+
+		for(item = retry.head; item != NULL; item = nextitem) {
+
+			nextitem = item->next;
+
+			if (item->retryat > now) continue;
+
+			itemlist_remove(&retry, item);
+
+			if (queueio(setup, eng, item, IOENGINE_READ) == -1) JOBERROR("ioengine_queue()");
+
+		}
+
+		/*
+		 * Check completed output items, then give blocks read to free output items.
+		 */
+
+		for(k = 0; k < nout; k++) {
+
+			out = &outs[k];
+			oque = out->que;
+
+			queuewalk_start(&out->w);
+
+			for(i = queuewalk_next(&out->w); i != -1; i = queuewalk_next(&out->w)) {
+
+				/*
+				 * Verification reads written block back and hashes it.
+				 */
+
+				if (oque[i].status == QUEITEM_VERIFYING) {
+
+					switch(oque[i].retcode) {
+
+					case 0:
+
+						if (oque[i].iores > 0) {
+
+							oque[i].readyb += oque[i].iores;
+
+							if (oque[i].readyb < oque[i].blklen) {
+
+								oque[i].iobuf = oque[i].cmpbuf + oque[i].readyb;
+								oque[i].iooff = oque[i].fdoffset + oque[i].readyb;
+								oque[i].iolen = oque[i].blklen - oque[i].readyb;
+
+								if (queueio(setup, eng, &oque[i], IOENGINE_READ) == -1) JOBERROR("ioengine_queue()");
+
+								continue;
+
+							}
+
+						}
+
+						break;
+
+					case EINPROGRESS:
+
+						continue;
+
+					default:
+
+						errno = oque[i].retcode;
+
+						JOBERROR("read");
+						break;
+
+					}
+
+					if (oque[i].readyb == oque[i].blklen) {
+
+						oque[i].status = QUEITEM_WORKING;
+
+						if (workers_queue(wk, &oque[i], WORK_HASHBACK, oque[i].fdoffset - params->seek) == -1) JOBERROR("workers_queue()");
+
+						continue;
+
+					}
+
+					/*
+					 * Output is shorter than the block written.
+					 */
+					oque[i].hashback = ~oque[i].hash;
+					oque[i].retcode = 0;
+					oque[i].status = QUEITEM_WORKING;
+
+				}
+
+				if (oque[i].status == QUEITEM_WORKING) {
+
+					if (oque[i].retcode == EINPROGRESS) continue;
+
+					if (oque[i].hashback != oque[i].hash) verifyfailed(cs, oque[i].fdoffset, oque[i].blklen);
+					else if (journal_done(jr, oque[i].fdoffset, oque[i].blklen) == -1) JOBERROR("journal_done()");
+
+					bufpool_put(pool, oque[i].cmpbuf);
+
+					oque[i].cmpbuf = NULL;
+
+					oque[i].status = QUEITEM_FREE;
+
+					bufpool_put(dpool, oque[i].buffer);
+
+					oque[i].buffer = NULL;
+
+					if (oque[i].zbuf != NULL) {
+
+						bufpool_put(pool, oque[i].zbuf);
+
+						oque[i].zbuf = NULL;
+
+					}
+
+					oqsize-- ;
+					out->qsize-- ;
+
+				}
+
+				/*
+				 * Delta copy reads output block before writing, equal block isn't written.
+				 */
+
+				else if (oque[i].status == QUEITEM_COMPARING) {
+
+					switch(oque[i].retcode) {
+
+					case 0:
+
+						/*
+						 * Short read is retried, zero read means output is smaller than input.
+						 */
+
+						if (oque[i].iores > 0) {
+
+							oque[i].readyb += oque[i].iores;
+
+							if (oque[i].readyb < oque[i].blklen) {
+
+								oque[i].iobuf = oque[i].cmpbuf + oque[i].readyb;
+								oque[i].iooff = oque[i].fdoffset + oque[i].readyb;
+								oque[i].iolen = oque[i].blklen - oque[i].readyb;
+
+								if (queueio(setup, eng, &oque[i], IOENGINE_READ) == -1) JOBERROR("ioengine_queue()");
+
+								continue;
+
+							}
+
+						}
+
+						break;
+
+					case EINPROGRESS:
+
+						continue;
+
+					case ECANCELED:
+
+						break;
+
+					default:
+
+						errno = oque[i].retcode;
+
+						JOBERROR("read");
+						break;
+
+					}
+
+					if ((oque[i].retcode == 0) && (oque[i].readyb == oque[i].blklen) && \
+							(memcmp(oque[i].buffer, oque[i].cmpbuf, oque[i].blklen) == 0)) {
+
+						#ifdef AIOBLKCOPY_DEBUG
+						fprintf(stderr, "WRITE EQUAL orqnum: %lld fd : %i offset: %lld bytes: %zu oqsize: %i\n", \
+								oque[i].rqnum, oque[i].fd, (long long)oque[i].fdoffset, \
+								oque[i].blklen, oqsize-1);
+						#endif
+
+						cs->deltab += oque[i].blklen;
+
+						if (pagecache_read(&out->pc, oque[i].fdoffset, oque[i].blklen) == -1) JOBERROR("posix_fadvise()");
+
+						if (journal_done(jr, oque[i].fdoffset, oque[i].blklen) == -1) JOBERROR("journal_done()");
+
+						oque[i].retcode = ECANCELED;
+
+					}
+
+					bufpool_put(pool, oque[i].cmpbuf);
+
+					oque[i].cmpbuf = NULL;
+
+					if (oque[i].retcode == 0) {
+
+						oque[i].status = QUEITEM_INPROGRESS;
+
+						oque[i].iobuf = oque[i].buffer;
+						oque[i].iolen = oque[i].blklen;
+						oque[i].iooff = oque[i].fdoffset;
+
+						if ((rs->mode == RESCUE_SKIP) && (oque[i].badb != 0)) writepiece(setup, &oque[i], 0);
+
+						if (queueio(setup, eng, &oque[i], IOENGINE_WRITE) == -1) JOBERROR("ioengine_queue()");
+
+						continue;
+
+					}
+
+					oque[i].status = QUEITEM_FREE;
+
+					bufpool_put(dpool, oque[i].buffer);
+
+					oque[i].buffer = NULL;
+
+					oqsize-- ;
+					out->qsize-- ;
+
+				}
+
+				else if (oque[i].status == QUEITEM_INPROGRESS) {
+
+					switch(oque[i].retcode) {
+
+						case 0:
+
+							if (params->autotune == 1) autotune_write(at, oque[i].iores, now - oque[i].iostart);
+
+							lathist_add(&cs->st.wr, now - oque[i].iostart);
+
+							STATS_ADD(cs->st.wlatsum, now - oque[i].iostart);
+							STATS_ADD(cs->st.writes, 1);
+							STATS_ADD(cs->st.wbytes, oque[i].iores);
+
+							out->unsynced += oque[i].iores;
+
+							oque[i].retcode = oque[i].iores;
+
+							/*
+							 * Pipes and sockets may accept only a part of the block, write the rest.
+							 */
+
+							if ((oque[i].retcode > 0) && ((size_t)oque[i].retcode < oque[i].iolen)) {
+
+								STATS_ADD(cs->st.shortwrites, 1);
+
+								oque[i].iobuf += oque[i].retcode;
+								oque[i].iolen -= oque[i].retcode;
+
+								if (out->seekable == 1) oque[i].iooff += oque[i].retcode;
+
+								if (queueio(setup, eng, &oque[i], IOENGINE_WRITE) == -1) JOBERROR("ioengine_queue()");
+
+								continue;
+
+							}
+
+							/*
+							 * The next piece between skipped bad ranges.
+							 */
+
+							if ((rs->mode == RESCUE_SKIP) && (oque[i].badb != 0) && (oque[i].retcode > 0) && \
+									(writepiece(setup, &oque[i], oque[i].iooff + oque[i].retcode - oque[i].fdoffset) == 1)) {
+
+								if (queueio(setup, eng, &oque[i], IOENGINE_WRITE) == -1) JOBERROR("ioengine_queue()");
+
+								continue;
+
+							}
+
+							#ifdef AIOBLKCOPY_DEBUG
+							fprintf(stderr, "WRITE COMPLETED orqnum: %lld fd : %i offset: %lld bytes: %i oqsize: %i\n", \
+									oque[i].rqnum, oque[i].fd, (long long)oque[i].iooff, \
+									oque[i].retcode, oqsize-1);
+							#endif
+
+							if (oque[i].retcode == 0) eof = 1;
+
+							if ((oque[i].retcode > 0) && (pagecache_written(&out->pc, oque[i].fdoffset, oque[i].blklen) == -1)) JOBERROR("sync_file_range()");
+
+							/*
+							 * Block is recorded in journal when it's read back.
+							 */
+
+							if ((params->verify == VERIFY_READBACK) && (oque[i].retcode > 0)) {
+
+								oque[i].cmpbuf = bufpool_get(pool);
+
+								if (oque[i].cmpbuf == NULL) {
+
+									errno = ENOBUFS;
+
+									JOBERROR("bufpool_get()");
+
+								}
+
+								oque[i].status = QUEITEM_VERIFYING;
+
+								oque[i].iobuf = oque[i].cmpbuf;
+								oque[i].iolen = oque[i].blklen;
+								oque[i].iooff = oque[i].fdoffset;
+								oque[i].readyb = 0;
+
+								if (queueio(setup, eng, &oque[i], IOENGINE_READ) == -1) JOBERROR("ioengine_queue()");
+
+								continue;
+
+							}
+
+							if (journal_done(jr, oque[i].fdoffset, oque[i].blklen) == -1) JOBERROR("journal_done()");
+
+							break;
+
+						case EINPROGRESS:
+
+							continue;
+
+						case ECANCELED:
+
+							STATS_ADD(cs->st.wcancels, 1);
+
+							#ifdef AIOBLKCOPY_DEBUG
+							fprintf(stderr, "WRITE CANCELED orqnum: %lld fd : %i offset: %lld bytes: %zu oqsize: %i\n", \
+									oque[i].rqnum, oque[i].fd, (long long)oque[i].iooff, \
+									oque[i].iolen, oqsize-1);
+							#endif
+
+							break;
+
+						case EFBIG:
+
+							/*
+							 * It's possible that output device smaller than input data size.
+							 */
+							eof = 1;
+
+							STATS_ADD(cs->st.efbig, 1);
+
+							#ifdef AIOBLKCOPY_DEBUG
+							fprintf(stderr, "WRITE EOF orqnum: %lld fd : %i offset: %lld bytes: %zu oqsize: %i\n", \
+								oque[i].rqnum, oque[i].fd, (long long)oque[i].iooff, \
+								oque[i].iolen, oqsize-1);
+							#endif
+							break;
+
+						default:
+
+							errno = oque[i].retcode;
+
+							JOBERROR("write");
+							break;
+
+					}
+
+					oque[i].status = QUEITEM_FREE;
+
+					bufpool_put(dpool, oque[i].buffer);
+
+					oque[i].buffer = NULL;
+
+					if (oque[i].zbuf != NULL) {
+
+						bufpool_put(pool, oque[i].zbuf);
+
+						oque[i].zbuf = NULL;
+
+					}
+
+					oqsize-- ;
+					out->qsize-- ;
+
+
+				}
+
+				else {
+
+					if (out->qsize >= olimit) continue;
+
+					if ((thr != NULL) && (throttle_allow(thr, THROTTLE_WRITE, now) == 0)) continue;
+
+					/*
+					 * Check input queue for completed data and send it to output.
+					 */
+					for(;;) {
+
+						/*
+						 * If output isn't seekable or there are several outputs we must wait for the next block,
+						 * the others stay in the input queue. The block leaves ready list with the last output taking it.
+						 */
+
+						if ((out->seekable == 0) || (nout > 1)) {
+
+							j = inorder[(out->rqnum + 1) % iquesize];
+
+							if ((ique[j].rqnum != out->rqnum + 1) || (ique[j].status != QUEITEM_READY)) break;
+
+							if (ique[j].pending == 1) itemlist_remove(&iw.ready, &ique[j]);
+
+						}
+						else {
+
+							if (iw.ready.head == NULL) break;
+
+							j = itemlist_pop(&iw.ready) - ique;
+
+						}
+
+						switch(ique[j].status) {
+
+						case QUEITEM_READY:
+
+							/*
+							 * Zero block is not written. Block devices zero only whole sectors.
+							 * Block which couldn't be read at all isn't written with --on-error=skip.
+							 */
+
+							zoff = ((ioffsets == 0) ? cs->start + out->off : ique[j].fdoffset) + odelta;
+
+							if (((params->sparse != SPARSE_NONE) && (ique[j].badb == 0) && (sparse_iszero(ique[j].buffer, ique[j].readyb) == 1) && \
+									(S_ISREG(out->mode) || (((ique[j].readyb % setup->out[k].sector) == 0) && ((zoff % (off_t)setup->out[k].sector) == 0)))) || \
+									((rs->mode == RESCUE_SKIP) && (ique[j].badb == ique[j].readyb))) {
+
+								if ((ique[j].badb == 0) && (sparse_zero(&out->sp, zoff, ique[j].readyb) == -1)) JOBERROR("sparse_zero()");
+
+								out->rqnum++ ;
+
+								if (ique[j].badb == 0) cs->sparseb += ique[j].readyb;
+								out->off += ique[j].readyb;
+
+								if (--ique[j].pending == 0) {
+
+									bufpool_put(dpool, ique[j].buffer);
+
+									ique[j].buffer = NULL;
+
+									ique[j].status = QUEITEM_FREE;
+
+									itemlist_push(&iw.free, &ique[j]);
+
+									iqsize-- ;
+
+								}
+
+								break;
+
+							}
+
+							oque[i].status = QUEITEM_INPROGRESS;
+
+							oque[i].rqnum = ++out->rqnum;
+
+							oque[i].buffer = ique[j].buffer;
+							oque[i].hash = ique[j].hash;
+
+							bufpool_hold(dpool, oque[i].buffer);
+
+							if (ioffsets == 0) oque[i].fdoffset = cs->start + out->off + odelta;
+							else oque[i].fdoffset = ique[j].fdoffset + odelta;
+
+							oque[i].iobuf = oque[i].buffer;
+							oque[i].iolen = ique[j].readyb;
+							oque[i].iooff = oque[i].fdoffset;
+							oque[i].blklen = ique[j].readyb;
+							oque[i].badb = ique[j].badb;
+
+							oque[i].zbuf = ique[j].zbuf;
+							oque[i].zlen = ique[j].zlen;
+
+							ique[j].zbuf = NULL;
+
+							/*
+							 * Block is sent together with its header standing before it in the buffer,
+							 * packed block is sent from its own buffer.
+							 */
+
+							if (netout == 1) {
+
+								if (oque[i].zbuf != NULL) {
+
+									net_putheader(oque[i].zbuf - NET_HDRSIZE, oque[i].fdoffset, ique[j].readyb, oque[i].zlen, ique[j].hash);
+
+									oque[i].iobuf = oque[i].zbuf - NET_HDRSIZE;
+									oque[i].iolen = oque[i].zlen + NET_HDRSIZE;
+
+								}
+								else {
+
+									net_putheader(oque[i].buffer - NET_HDRSIZE, oque[i].fdoffset, ique[j].readyb, ique[j].readyb, ique[j].hash);
+
+									oque[i].iobuf = oque[i].buffer - NET_HDRSIZE;
+									oque[i].iolen = ique[j].readyb + NET_HDRSIZE;
+
+								}
+
+								if (params->compress != COMPRESS_NONE) {
+
+									cs->zinb += ique[j].readyb;
+									cs->zoutb += oque[i].iolen - NET_HDRSIZE;
+
+								}
+
+								/*
+								 * Sockets refuse requests with offset.
+								 */
+								oque[i].iooff = 0;
+
+							}
+
+							if (params->delta == 1) {
+
+								oque[i].cmpbuf = bufpool_get(pool);
+
+								if (oque[i].cmpbuf == NULL) {
+
+									errno = ENOBUFS;
+
+									JOBERROR("bufpool_get()");
+
+								}
+
+								oque[i].status = QUEITEM_COMPARING;
+
+								oque[i].iobuf = oque[i].cmpbuf;
+								oque[i].readyb = 0;
+
+								if (queueio(setup, eng, &oque[i], IOENGINE_READ) == -1) JOBERROR("ioengine_queue()");
+
+							}
+							else {
+
+								if ((rs->mode == RESCUE_SKIP) && (oque[i].badb != 0)) writepiece(setup, &oque[i], 0);
+
+								if (queueio(setup, eng, &oque[i], IOENGINE_WRITE) == -1) JOBERROR("ioengine_queue()");
+
+							}
+
+							if (thr != NULL) throttle_charge(thr, THROTTLE_WRITE, oque[i].iolen);
+
+							oqsize++ ;
+							out->qsize++ ;
+							out->off += ique[j].readyb;
+
+							#ifdef AIOBLKCOPY_DEBUG
+							fprintf(stderr, "WRITE QUEUED orqnum: %lld fd : %i offset: %lld bytes: %zu oqsize: %i\n", \
+								oque[i].rqnum, oque[i].fd, (long long)oque[i].iooff, \
+								oque[i].iolen, oqsize);
+							#endif
+
+							if (--ique[j].pending == 0) {
+
+								bufpool_put(dpool, ique[j].buffer);
+
+								ique[j].buffer = NULL;
+								ique[j].iobuf = NULL;
+
+								ique[j].status = QUEITEM_FREE;
+
+								itemlist_push(&iw.free, &ique[j]);
+
+								iqsize-- ;
+
+							}
+
+							break;
+
+						default:
+
+							JOBERROR("aio_error()");
+							break;
+
+						}
+
+						/*
+						 * Go to the next free output request.
+						 */
+						if (oque[i].status != QUEITEM_FREE) break;
+
+					}
+
+				}
+
+
+			}
+
+			/*
+			 * Data written so far is synced while the next blocks are written.
+			 */
+
+			if (out->syncing == 1) {
+
+				if (out->sync.retcode == EINPROGRESS) continue;
+
+				if (out->sync.retcode != 0) {
+
+					errno = out->sync.retcode;
+
+					JOBERROR("fdatasync");
+
+				}
+
+				#ifdef AIOBLKCOPY_DEBUG
+				fprintf(stderr, "SYNC COMPLETED fd: %i ns: %lld\n", out->fd, now - out->sync.iostart);
+				#endif
+
+				out->syncing = 0;
+
+				syncing-- ;
+
+			}
+
+			if ((params->sync == SYNC_EVERY) && (out->unsynced >= (size_t)params->syncevery) && \
+					(S_ISREG(out->mode) || S_ISBLK(out->mode))) {
+
+				out->sync.iofd = out->fd;
+
+				if (ioengine_queue(eng, &out->sync, IOENGINE_SYNC) == -1) JOBERROR("ioengine_queue()");
+
+				out->syncing = 1;
+				out->unsynced = 0;
+
+				syncing++ ;
+
+			}
+
+		}
+
+		/*
+		 * Send all requests prepared on this iteration at once.
+		 */
+
+		if (ioengine_submit(eng) == -1) JOBERROR("ioengine_submit()");
+
+		/*
+		 * if we complete all requests and end of data detected we can break main loop.
+		 */
+
+		if ((iqsize == 0) && (oqsize == 0) && (syncing == 0) && (eof == 1)) break;
+
+		/*
+		 *  Wait for completions. Workers are waited for only if there is no I/O to wait for,
+		 *  otherwise their results are picked up with the next I/O completion.
+		 */
+
+		if ((wk != NULL) && (eng->inflight == 0)) {
+
+			tint = workers_reap(wk, 1);
+
+		}
+		else {
+
+			tint = ioengine_reap(eng, 1);
+
+			if (tint == -1) JOBERROR("ioengine_reap()");
+
+			if (wk != NULL) tint += workers_reap(wk, 0);
+
+		}
+
+		/*
+		 * Nothing was in flight, all new requests are held by throttle, wait for retry or for shared buffers.
+		 */
+
+		if ((tint == 0) && ((thr != NULL) || (retry.head != NULL) || (starved == 1))) {
+
+			now = nstime();
+
+			tint = (thr != NULL) ? throttle_delay(thr, now) : 0;
+
+			for(item = retry.head; item != NULL; item = item->next) {
+
+				if ((tint == 0) || (item->retryat - now < tint)) tint = item->retryat - now;
+
+			}
+
+			if ((starved == 1) && ((tint == 0) || (tint > SCHED_WAIT_NS))) tint = SCHED_WAIT_NS;
+
+			ts.tv_sec = tint / 1000000000;
+			ts.tv_nsec = tint % 1000000000;
+
+			if (tint > 0) nanosleep(&ts, NULL);
+
+		}
+
+		now = nstime();
+
+		STATS_SET(cs->st.done, outputsdone(outs, nout));
+		STATS_SET(cs->st.iqsize, iqsize);
+		STATS_SET(cs->st.oqsize, oqsize);
+		STATS_SET(cs->st.ilimit, ilimit);
+		STATS_SET(cs->st.olimit, olimit);
+		STATS_SET(cs->st.sparseb, cs->sparseb);
+		STATS_SET(cs->st.deltab, cs->deltab);
+		STATS_ADD(cs->st.iqsum, iqsize);
+		STATS_ADD(cs->st.oqsum, oqsize);
+		STATS_ADD(cs->st.samples, 1);
+
+		/*
+		 * Recorded writes are made durable before the journal says they are done.
+		 */
+
+		if (journal_commit(jr, outs[0].fd, now, 0) == -1) JOBERROR("journal_commit()");
+
+		#ifdef AIOBLKCOPY_DEBUG
+		fprintf(stderr, "iqsize: %i oqsize:%i eof: %i \n", iqsize , oqsize,  eof);
+		#endif
+
+	}
+
+	for(k = 0; k < nout; k++) {
+
+		if ((params->sparse != SPARSE_NONE) && (sparse_flush(&outs[k].sp) == -1)) JOBERROR("sparse_flush()");
+
+		if (pagecache_flush(&outs[k].pc) == -1) JOBERROR("sync_file_range()");
+
+	}
+
+	cs->copied = outputsdone(outs, nout);
+
+	if ((netout == 1) && (net_finish(outs[0].fd, cs->copied) == -1)) JOBERROR("net_finish()");
+
+	if ((netin == 1) && (cs->netexpect != (long long)cs->copied)) {
+
+		joberror(job, EPROTO, 0, "read", __FILE__, __LINE__, "Received %lld bytes, sender has sent %lld!", (long long)cs->copied, cs->netexpect);
+
+		goto fail;
+
+	}
+
+	STATS_SET(cs->st.done, cs->copied);
+	STATS_SET(cs->st.sparseb, cs->sparseb);
+	STATS_SET(cs->st.deltab, cs->deltab);
+	STATS_SET(cs->st.iqsize, 0);
+	STATS_SET(cs->st.oqsize, 0);
+
+fail:
+
+	/*
+	 * Stream stopped by an error waits for its requests in flight before their buffers are freed.
+	 */
+
+	if (eng != NULL) {
+
+		if ((eng->inflight > 0) && (ioengine_submit(eng) == 0)) {
+
+			while((eng->inflight > 0) && (ioengine_reap(eng, 1) != -1));
+
+		}
+
+		ioengine_destroy(eng);
+
+	}
+
+	/*
+	 * Workers may still hash or pack the blocks, they are stopped before buffers are given back.
+	 */
+
+	if (wk != NULL) workers_destroy(wk);
+
+	/*
+	 * Shared buffers are given back by every item still holding them.
+	 */
+
+	if ((sc != NULL) && (dpool != NULL)) {
+
+		for(i = 0; (ique != NULL) && (i < iquesize); i++) if (ique[i].buffer != NULL) bufpool_put(dpool, ique[i].buffer);
+
+		for(k = 0; k < nout; k++) {
+
+			for(i = 0; (outs[k].que != NULL) && (i < outs[k].quesize); i++) {
+
+				if (outs[k].que[i].buffer != NULL) bufpool_put(dpool, outs[k].que[i].buffer);
+
+			}
+
+		}
+
+		sched_leave(sc);
+
+	}
+
+	if (pool != NULL) bufpool_destroy(pool);
+
+	free(ique);
+
+	free(inorder);
+
+	for(k = 0; k < nout; k++) free(outs[k].que);
+
+	return NULL;
+
+}
+
+/*
+ * Reads and throws away len bytes of input which isn't seekable, returns -1 on error.
+ * Input shorter than that is left at its end.
+ */
+
+static int discardinput( int fd, long long len, size_t bufsize ) {
+
+	char *buf;
+	ssize_t ret;
+
+	if (len == 0) return 0;
+
+	buf = malloc(bufsize);
+
+	if (buf == NULL) return -1;
+
+	while(len > 0) {
+
+		ret = read(fd, buf, ((long long)bufsize < len) ? bufsize : (size_t)len);
+
+		if (ret == -1) {
+
+			if (errno == EINTR) continue;
+
+			free(buf);
+
+			return -1;
+
+		}
+
+		if (ret == 0) break;
+
+		len -= ret;
+
+	}
+
+	free(buf);
+
+	return 0;
+
+}
+
+/*
+ * Completion signals of POSIX AIO engine are shared by all jobs of the process, every stream takes its own slot.
+ * Handlers are installed when the first slots are taken.
+ */
+
+static pthread_mutex_t slotlock = PTHREAD_MUTEX_INITIALIZER;
+static int slotused[MAX_STREAMS];
+static int slotsignals = 0;
+
+/*
+ * Returns -1 with errno EBUSY if there aren't enough free slots.
+ */
+
+static int getslots(struct copystream *streams, int count) {
+
+	struct sigaction sa;
+	int slot = 0;
+	int i;
+
+	pthread_mutex_lock(&slotlock);
+
+	if (slotsignals == 0) {
+
+		sigemptyset(&sa.sa_mask);
+
+		sa.sa_flags = SA_RESTART | SA_SIGINFO;
+		sa.sa_sigaction = aiosighandler;
+
+		for(i = 0; i < MAX_STREAMS; i++) {
+
+			if (sigaction(IO_SIGNAL + i, &sa, NULL) == -1) {
+
+				pthread_mutex_unlock(&slotlock);
+
+				return -1;
+
+			}
+
+		}
+
+		slotsignals = 1;
+
+	}
+
+	for(i = 0; i < count; i++) {
+
+		while((slot < MAX_STREAMS) && (slotused[slot] == 1)) slot++ ;
+
+		if (slot == MAX_STREAMS) break;
+
+		slotused[slot] = 1;
+
+		streams[i].slot = slot;
+
+	}
+
+	if (i < count) {
+
+		while(i-- > 0) {
+
+			slotused[streams[i].slot] = 0;
+
+			streams[i].slot = -1;
+
+		}
+
+		pthread_mutex_unlock(&slotlock);
+
+		errno = EBUSY;
+
+		return -1;
+
+	}
+
+	pthread_mutex_unlock(&slotlock);
+
+	return 0;
+
+}
+
+static void putslots(struct copystream *streams, int count) {
+
+	int i;
+
+	pthread_mutex_lock(&slotlock);
+
+	for(i = 0; i < count; i++) {
+
+		if (streams[i].slot != -1) slotused[streams[i].slot] = 0;
+
+		streams[i].slot = -1;
+
+	}
+
+	pthread_mutex_unlock(&slotlock);
+
+}
+
+/*
+ * Signals the library uses for completions, threads of the program should keep them blocked,
+ * so they are taken only by the streams waiting for them.
+ */
+
+void copy_job_sigset(sigset_t *set) {
+
+	int i;
+
+	sigemptyset(set);
+
+	for(i = 0; i < MAX_STREAMS; i++) sigaddset(set, IO_SIGNAL + i);
+
+}
+
+/*
+ * Sum of all streams, called with job lock held.
+ */
+
+static void takesnap(struct copyjob *job, struct statsnap *snap, long long now) {
+
+	int i;
+
+	stats_clear(snap, now - job->start, job->total);
+
+	for(i = 0; i < job->params.streams; i++) stats_add(snap, &job->streams[i].st);
+
+}
+
+/*
+ * Statistics files are best effort, copy goes on if they can't be written.
+ */
+
+static void writestats(const struct copyparams *params, const struct statsnap *snap) {
+
+	if ((params->statsjson != NULL) && (stats_writejson(params->statsjson, snap) == -1)) {
+
+		perror(params->statsjson);
+
+	}
+
+	if ((params->statsprom != NULL) && (stats_writeprom(params->statsprom, snap) == -1)) {
+
+		perror(params->statsprom);
+
+	}
+
+}
+
+/*
+ * Progress callback is called every params.progress seconds, statistics files are rewritten
+ * on the same interval or every STATS_INTERVAL seconds.
+ */
+
+static void *monitorthread(void *arg) {
+
+	struct copyjob *job = arg;
+	struct timespec ts;
+	int interval = (job->params.progress != 0) ? job->params.progress : STATS_INTERVAL;
+
+	pthread_mutex_lock(&job->lock);
+
+	for(;;) {
+
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+
+		ts.tv_sec += interval;
+
+		while((job->stopmonitor == 0) && (pthread_cond_timedwait(&job->cond, &job->lock, &ts) != ETIMEDOUT));
+
+		if (job->stopmonitor == 1) break;
+
+		takesnap(job, &job->snap, nstime());
+
+		/*
+		 * The callback may poll the job.
+		 */
+
+		pthread_mutex_unlock(&job->lock);
+
+		writestats(&job->params, &job->snap);
+
+		if ((job->params.progress != 0) && (job->progresscb != NULL)) job->progresscb(job, &job->snap, job->progressarg);
+
+		pthread_mutex_lock(&job->lock);
+
+	}
+
+	pthread_mutex_unlock(&job->lock);
+
+	return NULL;
+
+}
+
+/*
+ * Checks parameters, opens files and connections and splits input into streams.
+ */
+
+static int jobsetup(struct copyjob *job) {
+
+	struct copyparams *params = &job->params;
+	struct copysetup *setup = &job->setup;
+
+	/*
+	 * Temporary file descriptors.
+	 */
+	int ifd = -1;
+
+	/*
+	 * Maximum queues size.
+	 */
+	int imaxqsize;
+	int omaxqsize;
+
+	/*
+	 * Input queue items, read requests in progress are limited by imaxqsize,
+	 * the rest items hold completed blocks waiting for output queue.
+	 */
+	int iquesize;
+	size_t maxblksize;
+
+	/*
+	 * Block sizes of one side and the size blocks are made a multiple of.
+	 */
+	struct topology tp;
+	size_t blkunit;
+	size_t isector = TOPOLOGY_SECTOR;
+
+	/*
+	 * pipes, fifos, character devices can't do lseek(), so queueing on them is useless.
+	 * oseekable is set if all outputs are seekable.
+	 */
+	int iseekable;
+	int oseekable;
+
+	/*
+	 * File type, size of regular input file.
+	 */
+	mode_t imode = 0;
+	off_t isize = 0;
+
+	/*
+	 * Outputs are set up right in copysetup.
+	 */
+	struct outputsetup *out;
+
+	/*
+	 * Copy streams.
+	 */
+	struct copystream *streams;
+	off_t streamsize;
+	off_t rangestart;
+	off_t rangeend;
+	off_t splitend;
+	int netfeatures;
+
+	int i;
+
+	/*
+	 * Only needed on initialization.
+	 */
+	struct stat statdata;
+	int fflags;
+	int directio;
+	int idirect = 0;
+	int odirect = 0;
+	long long tint;
+
+	/*
+	 * Nothing is opened yet, cleanup closes only what is.
+	 */
+
+	setup->ifd = -1;
+	setup->ibouncefd = -1;
+
+	for(i = 0; i < MAX_OUTPUTS; i++) {
+
+		setup->out[i].fd = -1;
+		setup->out[i].bouncefd = -1;
+
+	}
+
+	if (STATS_GET(job->cancel) == 1) {
+
+		joberror(job, ECANCELED, 0, NULL, NULL, 0, "Copy is canceled!");
+
+		goto fail;
+
+	}
+
+	/*
+	 * Command line parsing checks these already, programs using the library may give anything.
+	 */
+
+	if ((params->blksize < 0) || (params->blksize > MAX_BLKSIZE) || ((params->blksize % TOPOLOGY_SECTOR) != 0)) {
+
+		JOBUSAGE("Block size must be multiple of %i up to %i bytes!", TOPOLOGY_SECTOR, MAX_BLKSIZE);
+
+	}
+
+	if ((params->maxqsize < 1) || (params->maxqsize > MAX_QUEUESIZE) || (params->rdepth < 0) || (params->rdepth > MAX_QUEUESIZE) || \
+			(params->wdepth < 0) || (params->wdepth > MAX_QUEUESIZE)) {
+
+		JOBUSAGE("Wrong maximum queue size, must be positive decimal between 1 and %i!", MAX_QUEUESIZE);
+
+	}
+
+	if ((params->streams < 1) || (params->streams > MAX_STREAMS)) JOBUSAGE("Number of streams must be between 1 and %i!", MAX_STREAMS);
+
+	if ((params->outputs < 0) || (params->outputs > MAX_OUTPUTS)) JOBUSAGE("At most %i output files can be given!", MAX_OUTPUTS);
+
+	if ((params->engine != NULL) && (ioengine_exists(params->engine) == 0)) JOBUSAGE("Unknown I/O engine %s!", params->engine);
+
+	if ((params->numa < NUMA_AUTO) || (params->numa >= NUMA_MAXNODES) || (params->sqpoll < NUMA_CPU_AUTO) || \
+			(params->sqpoll >= CPU_SETSIZE)) {
+
+		JOBUSAGE("Wrong NUMA node or CPU number!");
+
+	}
+
+	if ((params->staging < 0) || (params->skip < 0) || (params->seek < 0) || (params->count < -1) || \
+			((params->sync == SYNC_EVERY) && (params->syncevery <= 0))) {
+
+		JOBUSAGE("Sizes and offsets must not be negative!");
+
+	}
+
+	imaxqsize = (params->rdepth != 0) ? params->rdepth : params->maxqsize;
+	omaxqsize = (params->wdepth != 0) ? params->wdepth : params->maxqsize;
+
+	/*
+	 * Autotuning needs room to grow, queues are limited only if the user asked.
+	 */
+
+	if (params->autotune == 1) {
+
+		if ((params->rdepth == 0) && (params->maxqsize == DEFAULT_MAXQUEUESIZE)) imaxqsize = MAX_QUEUESIZE;
+		if ((params->wdepth == 0) && (params->maxqsize == DEFAULT_MAXQUEUESIZE)) omaxqsize = MAX_QUEUESIZE;
+
+	}
+
+	/*
+	 * Check if the input file is regular file or block device.
+	 * I suppose that only on regular files and block devices are possible to do lseek() and
+	 * submit simultaneous read/write requests.
+	 * Also for these descriptors there is no point to do many requests simultaneously.
+ 	 */
+
+	if ((params->listen != NULL) && ((params->inputfile != NULL) || (params->connect != NULL))) {
+
+		JOBUSAGE("Listen can't be used with input file or connect!");
+
+	}
+
+	if ((params->connect != NULL) && (params->outputs != 0)) {
+
+		JOBUSAGE("Connect can't be used with output file!");
+
+	}
+
+	if ((params->compress != COMPRESS_NONE) && (params->connect == NULL)) {
+
+		JOBUSAGE("Compression is used only with connect, receiver takes the method from the sender!");
+
+	}
+
+	/*
+	 * Sender chooses the range, receiver chooses where it goes.
+	 */
+
+	if ((params->listen != NULL) && ((params->skip != 0) || (params->count != -1))) {
+
+		JOBUSAGE("Skip and count can't be used with listen, they are given to the sender!");
+
+	}
+
+	if ((params->connect != NULL) && (params->seek != 0)) {
+
+		JOBUSAGE("Seek can't be used with connect, it's given to the receiver!");
+
+	}
+
+	/*
+	 * Network side is read or written one request at a time on every connection.
+	 */
+
+	if (params->listen != NULL) {
+
+		iseekable = 0;
+
+		imaxqsize = 1;
+
+	}
+	else if (params->inputfile != NULL) {
+
+		if (stat(params->inputfile, &statdata) == -1) JOBERROR("stat()");
+
+		imode = statdata.st_mode;
+		isize = statdata.st_size;
+
+		if ( !( S_ISREG(statdata.st_mode) || S_ISBLK(statdata.st_mode) ) ) {
+
+			iseekable = 0;
+
+			imaxqsize = 1;
+
+		}
+		else {
+
+			iseekable = 1;
+
+		}
+
+	}
+	else {
+
+		iseekable = 0;
+
+		imaxqsize = 1;
+
+		/*
+		 * if a user doesn't give us a input file name we'll use STDIN.
+		 */
+
+		ifd = STDIN_FILENO;
+
+	}
+
+	/*
+	 * The same for every output file.
+	 */
+
+	if (params->connect != NULL) {
+
+		setup->outputs = 1;
+
+		setup->out[0].fd = -1;
+		setup->out[0].bouncefd = -1;
+		setup->out[0].seekable = 0;
+
+	}
+	else if (params->outputs != 0) {
+
+		setup->outputs = params->outputs;
+
+		for(i = 0; i < setup->outputs; i++) {
+
+			out = &setup->out[i];
+
+			out->fd = -1;
+			out->bouncefd = -1;
+
+			/*
+			 * Not existing output will be created as regular file.
+			 */
+
+			if (stat(params->outputfile[i], &statdata) == -1) {
+
+				if (errno != ENOENT) JOBERROR("stat()");
+
+				statdata.st_mode = S_IFREG;
+
+			}
+
+			out->mode = statdata.st_mode;
+
+			out->seekable = (S_ISREG(statdata.st_mode) || S_ISBLK(statdata.st_mode)) ? 1 : 0;
+
+		}
+
+	}
+	else {
+
+		setup->outputs = 1;
+
+		/*
+		 * if a user doesn't give us a output file name we'll use STDOUT.
+		*/
+
+		setup->out[0].fd = STDOUT_FILENO;
+		setup->out[0].bouncefd = -1;
+		setup->out[0].seekable = 0;
+
+
+	}
+
+	/*
+	 * Every output has its own queue, output which isn't seekable gets one request at a time.
+	 */
+
+	oseekable = 1;
+	tint = 1;
+
+	for(i = 0; i < setup->outputs; i++) {
+
+		out = &setup->out[i];
+
+		out->maxqsize = (out->seekable == 1) ? omaxqsize : 1;
+
+		if (out->seekable == 0) oseekable = 0;
+
+		if (out->maxqsize > tint) tint = out->maxqsize;
+
+	}
+
+	omaxqsize = tint;
+
+	/*
+	 * Offsets in journal have sense only if both sides are seekable.
+	 */
+
+	if ((params->resume == 1) && (params->journal == NULL)) {
+
+		JOBUSAGE("Resume needs --journal!");
+
+	}
+
+	if ((params->journal != NULL) && ((iseekable == 0) || (oseekable == 0))) {
+
+		JOBUSAGE("Journal needs regular file or block device input and output!");
+
+	}
+
+	/*
+	 * Journal records what is done on one output.
+	 */
+
+	if ((params->journal != NULL) && (setup->outputs > 1)) {
+
+		JOBUSAGE("Journal can be used only with one output file!");
+
+	}
+
+	/*
+	 * Streams need offsets on both sides.
+	 */
+
+	if ((params->streams > 1) && (params->listen == NULL) && \
+			((iseekable == 0) || ((oseekable == 0) && (params->connect == NULL)))) {
+
+		JOBUSAGE("Streams need regular file or block device input and output!");
+
+	}
+
+	/*
+	 * Output blocks are read back only on seekable output.
+	 */
+
+	if ((params->delta == 1) && (oseekable == 0)) {
+
+		JOBUSAGE("Delta copy needs regular file or block device output!");
+
+	}
+
+	if ((params->verify == VERIFY_READBACK) && (oseekable == 0)) {
+
+		JOBUSAGE("Read back verification needs regular file or block device output!");
+
+	}
+
+	if ((params->seek != 0) && (oseekable == 0)) {
+
+		JOBUSAGE("Seek needs regular file or block device output!");
+
+	}
+
+	/*
+	 * Failed blocks are read again by offset. Skipped ranges are left in output as they are,
+	 * so it must be seekable and isn't read back.
+	 */
+
+	if ((params->onerror != RESCUE_ABORT) && (iseekable == 0)) {
+
+		JOBUSAGE("Error handling needs regular file or block device input!");
+
+	}
+
+	if ((params->onerror == RESCUE_SKIP) && ((oseekable == 0) || (params->connect != NULL) || \
+			(params->verify == VERIFY_READBACK))) {
+
+		JOBUSAGE("Skipping bad ranges needs regular file or block device output and can't be used with read back!");
+
+	}
+
+	if ((params->errormap != NULL) && (params->onerror != RESCUE_SKIP) && (params->onerror != RESCUE_ZERO)) {
+
+		JOBUSAGE("Error map needs --on-error=skip or zero!");
+
+	}
+
+	/*
+	 * Zero ranges can be made only on seekable output.
+	 */
+
+	if (params->sparse != SPARSE_NONE) {
+
+		if (oseekable == 0) {
+
+			JOBUSAGE("Sparse copy needs regular file or block device output!");
+
+		}
+
+		/*
+		 * Output isn't truncated by delta copy, seek and skipping bad ranges, so its old data must be really zeroed.
+		 * Automatic method is chosen for every output by its type.
+		 */
+
+		for(i = 0; i < setup->outputs; i++) {
+
+			out = &setup->out[i];
+
+			out->sparse = params->sparse;
+
+			if (out->sparse == SPARSE_AUTO) {
+
+				if (S_ISBLK(out->mode)) out->sparse = SPARSE_ZEROOUT;
+				else out->sparse = ((params->delta == 1) || (params->seek != 0) || (params->onerror == RESCUE_SKIP)) ? SPARSE_PUNCH : SPARSE_SKIP;
+
+			}
+
+			if ((out->sparse == SPARSE_SKIP) && ((params->delta == 1) || (params->seek != 0) || (params->onerror == RESCUE_SKIP))) {
+
+				JOBUSAGE("Sparse method skip can't be used with delta copy, seek or skipping bad ranges!");
+
+			}
+
+			if (((out->sparse == SPARSE_ZEROOUT) || (out->sparse == SPARSE_DISCARD)) && !S_ISBLK(out->mode)) {
+
+				JOBUSAGE("Sparse methods zeroout and discard are only for block device output!");
+
+			}
+
+			if ((out->sparse == SPARSE_PUNCH) && !S_ISREG(out->mode)) {
+
+				JOBUSAGE("Sparse method punch is only for regular file output!");
+
+			}
+
+		}
+
+	}
+
+	/*
+	 * Every request carries its own offset, so one descriptor per side is shared by all of them.
+	 * Files opened with direct io get one more descriptor for unaligned requests.
+	 */
+
+	setup->ibouncefd = -1;
+
+	if ((ifd == -1) && (params->listen == NULL)) {
+
+		fflags = O_RDONLY;
+
+		#ifdef _GNU_SOURCE
+
+		if ((params->wo_di_inp == 0) && (iseekable == 1)) {
+
+			fflags = fflags | O_DIRECT;
+
+		}
+
+		#endif
+
+		ifd = open(params->inputfile, fflags);
+
+		if (ifd == -1) JOBERROR("open()");
+
+		setup->ifd = ifd;
+
+		/*
+		 * Requests direct io refuses are read through page cache.
+		 */
+
+		#ifdef _GNU_SOURCE
+
+		if ((fflags & O_DIRECT) != 0) {
+
+			setup->ibouncefd = open(params->inputfile, O_RDONLY);
+
+			if (setup->ibouncefd == -1) JOBERROR("open()");
+
+		}
+
+		#endif
+
+	}
+
+	for(i = 0; (i < setup->outputs) && (params->connect == NULL); i++) {
+
+		out = &setup->out[i];
+
+		if (out->fd != -1) continue;
+
+		/*
+		 * Output data is kept by delta copy, resume, seek and skipping bad ranges.
+		 */
+
+		if (params->delta == 1) fflags = O_RDWR | O_CREAT;
+		else if ((params->resume == 1) || (params->seek != 0) || (params->onerror == RESCUE_SKIP)) fflags = O_WRONLY | O_CREAT;
+		else fflags = O_WRONLY | O_CREAT | O_TRUNC;
+
+		/*
+		 * Written blocks are read back by verification.
+		 */
+		if (params->verify == VERIFY_READBACK) fflags = (fflags & ~O_WRONLY) | O_RDWR;
+
+		#ifdef _GNU_SOURCE
+
+		if ((params->wo_di_out == 0) && (out->seekable == 1)) {
+
+			fflags = fflags | O_DIRECT ;
+
+		}
+
+		#endif
+
+		out->fd = open(params->outputfile[i], fflags,  S_IRUSR |  S_IWUSR | S_IRGRP );
+
+		if (out->fd == -1) JOBERROR("open()");
+
+		#ifdef _GNU_SOURCE
+
+		if ((fflags & O_DIRECT) != 0) {
+
+			out->bouncefd = open(params->outputfile[i], fflags & ~(O_DIRECT | O_CREAT | O_TRUNC));
+
+			if (out->bouncefd == -1) JOBERROR("open()");
+
+		}
+
+		#endif
+
+	}
+
+	/*
+	 * Requests are aligned to the biggest logical block size of sides using direct io.
+	 * Default block size is a multiple of optimal io size of both sides, so devices get whole stripes.
+	 * Receiver holds blocks of the sender's size, over the network the default isn't changed.
+	 */
+
+	setup->dioalign = TOPOLOGY_SECTOR;
+	setup->memalign = TOPOLOGY_SECTOR;
+
+	blkunit = TOPOLOGY_SECTOR;
+
+	if (ifd != -1) {
+
+		if (topology_query(ifd, &tp) == -1) JOBERROR("topology_query()");
+
+		/*
+		 * Failing blocks are bisected down to sectors, page cache reads whole pages.
+		 */
+		isector = tp.dioalign;
+
+		if (setup->ibouncefd == -1) isector = topology_lcm(isector, sysconf(_SC_PAGESIZE));
+
+		if (setup->ibouncefd != -1) {
+
+			setup->dioalign = topology_lcm(setup->dioalign, tp.dioalign);
+			setup->memalign = topology_lcm(setup->memalign, tp.memalign);
+
+		}
+
+		blkunit = topology_lcm(blkunit, topology_unit(&tp));
+
+	}
+
+	for(i = 0; i < setup->outputs; i++) {
+
+		out = &setup->out[i];
+
+		out->sector = TOPOLOGY_SECTOR;
+
+		if (out->fd == -1) continue;
+
+		if (topology_query(out->fd, &tp) == -1) JOBERROR("topology_query()");
+
+		out->sector = tp.dioalign;
+
+		if (out->bouncefd != -1) {
+
+			setup->dioalign = topology_lcm(setup->dioalign, tp.dioalign);
+			setup->memalign = topology_lcm(setup->memalign, tp.memalign);
+
+		}
+
+		blkunit = topology_lcm(blkunit, topology_unit(&tp));
+
+	}
+
+	if (params->blksize == 0) {
+
+		params->blksize = DEFAULT_BLKSIZE;
+
+		blkunit = (DEFAULT_BLKSIZE + blkunit - 1) / blkunit * blkunit;
+
+		if ((params->listen == NULL) && (params->connect == NULL) && (blkunit <= MAX_BLKSIZE)) params->blksize = blkunit;
+
+	}
+
+	if ((params->blksize % setup->dioalign) != 0) {
+
+		JOBUSAGE("Block size must be multiple of %zu, logical block size of direct io side!", setup->dioalign);
+
+	}
+
+	/*
+	 * Autotuning needs room to grow the block.
+	 */
+
+	maxblksize = params->blksize;
+
+	if ((params->autotune == 1) && (maxblksize < AUTOTUNE_MAXBLKSIZE)) maxblksize = AUTOTUNE_MAXBLKSIZE;
+
+	iquesize = imaxqsize + params->staging / maxblksize;
+
+	#ifdef AIOBLKCOPY_DEBUG
+	printf("inputfile: %s\noutputs: %i \niseekable: %i : %i imaxqsize: %i omaxqsize: %i iquesize: %i maxqsize: %i blksize: %i\n", \
+			params->inputfile, setup->outputs, iseekable, oseekable, imaxqsize, omaxqsize, iquesize, \
+			params->maxqsize, params->blksize);
+	#endif
+
+
+	/*
+	 * Receiver learns the number of streams, compression method and hashing from the sender.
+	 */
+
+	if (params->connect != NULL) {
+
+		netfeatures = params->compress | ((params->verify != VERIFY_NONE) ? NET_HELLO_VERIFY : 0);
+
+		if (net_connect(params->connect, params->streams, netfeatures, setup->netfds) == -1) JOBERROR("net_connect()");
+
+		setup->nnetfds = params->streams;
+
+	}
+
+	setup->netverify = 0;
+
+	if (params->listen != NULL) {
+
+		tint = net_listen(params->listen, setup->netfds, &netfeatures);
+
+		if (tint == -1) JOBERROR("net_listen()");
+
+		setup->nnetfds = tint;
+
+		params->streams = tint;
+
+		params->compress = netfeatures & NET_HELLO_METHOD;
+
+		if ((params->compress != COMPRESS_NONE) && (compress_method(compress_name(params->compress)) == -1)) {
+
+			joberror(job, EPROTONOSUPPORT, 0, NULL, NULL, 0, "Sender compresses blocks with %s, it isn't built in!", compress_name(params->compress));
+
+			goto fail;
+
+		}
+
+		if ((netfeatures & NET_HELLO_VERIFY) != 0) {
+
+			if (verify_available() == 0) {
+
+				joberror(job, EPROTONOSUPPORT, 0, NULL, NULL, 0, "Sender hashes blocks with XXH3, it isn't built in!");
+
+				goto fail;
+
+			}
+
+			if (params->verify == VERIFY_NONE) params->verify = VERIFY_HASH;
+
+			setup->netverify = 1;
+
+		}
+
+		if ((params->streams > 1) && (oseekable == 0)) {
+
+			JOBUSAGE("Sender uses %i connections, they need regular file or block device output!", params->streams);
+
+		}
+
+	}
+
+	/*
+	 * Buffers are placed on the node of input device, of output device if input has none,
+	 * and the copy threads run on CPUs of the node.
+	 */
+
+	setup->numanode = -1;
+	setup->engine = params->engine;
+
+	if (params->numa != NUMA_NONE) {
+
+		tint = params->numa;
+
+		if (tint == NUMA_AUTO) tint = numa_devnode(ifd);
+
+		if (tint == -1) tint = numa_devnode(setup->out[0].fd);
+
+		if (tint != -1) {
+
+			if (numa_nodecpus(tint, &setup->cpus) == -1) JOBUSAGE("NUMA node %lld has no CPUs!", tint);
+
+			setup->numanode = tint;
+
+		}
+
+		#ifdef AIOBLKCOPY_DEBUG
+		fprintf(stderr, "numa: node %i, %i CPUs\n", setup->numanode, (setup->numanode != -1) ? CPU_COUNT(&setup->cpus) : 0);
+		#endif
+
+	}
+
+	/*
+	 * Kernel submission thread of uring gets the last CPU of the node, the copy threads run on the others.
+	 */
+
+	if (params->sqpoll != NUMA_CPU_NONE) {
+
+		if ((params->engine != NULL) && (strcmp(params->engine, "uring") != 0)) JOBUSAGE("Kernel submission thread is used only by uring engine!");
+
+		if (ioengine_exists("uring") == 0) JOBUSAGE("Kernel submission thread needs uring engine, it isn't built in!");
+
+		tint = params->sqpoll;
+
+		if ((tint == NUMA_CPU_AUTO) && (setup->numanode != -1)) {
+
+			for(tint = CPU_SETSIZE - 1; CPU_ISSET(tint, &setup->cpus) == 0; tint--);
+
+		}
+
+		if ((tint >= 0) && (setup->numanode != -1) && (CPU_COUNT(&setup->cpus) > 1)) CPU_CLR(tint, &setup->cpus);
+
+		if (tint >= 0) snprintf(setup->enginebuf, sizeof(setup->enginebuf), "uring:sqpoll=%lld", tint);
+		else snprintf(setup->enginebuf, sizeof(setup->enginebuf), "uring:sqpoll");
+
+		setup->engine = setup->enginebuf;
+
+	}
+
+	/*
+	 * Streams share all processors for compression and hashing by default.
+	 */
+
+	if (params->workthreads == 0) {
+
+		tint = (setup->numanode != -1) ? CPU_COUNT(&setup->cpus) : sysconf(_SC_NPROCESSORS_ONLN);
+
+		tint /= params->streams;
+
+		if (tint < 1) tint = 1;
+		if (tint > WORKERS_MAXTHREADS) tint = WORKERS_MAXTHREADS;
+
+		params->workthreads = tint;
+
+	}
+
+	#ifdef _GNU_SOURCE
+
+	if ((params->wo_di_inp == 0) && (iseekable == 1)) idirect = 1;
+	if ((params->wo_di_out == 0) && (oseekable == 1)) odirect = 1;
+
+	#endif
+
+	directio = idirect & odirect;
+
+	/*
+	 * Data which isn't looked at can be copied inside the kernel without user buffers.
+	 */
+
+	setup->zcmethod = ZEROCOPY_NONE;
+
+	if ((params->wo_zerocopy == 0) && (params->sparse == SPARSE_NONE) && (params->delta == 0) && \
+			(params->journal == NULL) && (params->streams == 1) && (params->autotune == 0) && \
+			(params->listen == NULL) && (params->connect == NULL) && (params->verify == VERIFY_NONE) && \
+			(params->maxrate == 0) && (params->maxiops == 0) && (params->throttlefile == NULL) && \
+			(setup->outputs == 1) && (params->skip == 0) && (params->seek == 0) && (params->count == -1) && \
+			(params->onerror == RESCUE_ABORT) && (params->sync != SYNC_EVERY) && (params->dropcache == 0) && \
+			(params->sqpoll == NUMA_CPU_NONE) && ((params->engine == NULL) || (ioengine_manual(params->engine) == 0))) {
+
+		setup->zcmethod = zerocopy_method(ifd, idirect, setup->out[0].fd, odirect);
+
+	}
+
+	/*
+	 * Block devices have st_size zero.
+	 */
+
+	if (S_ISBLK(imode)) {
+
+		isize = lseek(ifd, 0, SEEK_END);
+
+		if (isize == -1) JOBERROR("lseek()");
+
+	}
+
+	/*
+	 * Journal is bound to input size.
+	 */
+
+	if (journal_init(&setup->jr, params->journal, isize, nstime()) == -1) JOBERROR("journal_init()");
+
+	setup->journaled = 1;
+
+	/*
+	 * Blocks go to output shifted by the difference of --seek and --skip. Input offsets are aligned for direct io
+	 * if input uses it, otherwise output offsets are.
+	 */
+
+	setup->odelta = params->seek - params->skip;
+	setup->alignphase = (idirect == 1) ? 0 : setup->odelta;
+
+	setup->jr.shift = setup->odelta;
+
+	if (rescue_init(&setup->rescue, params->onerror, isector, params->errormap, nstime()) == -1) JOBERROR("rescue_init()");
+
+	setup->rescuing = 1;
+
+	if ((params->maxrate != 0) || (params->maxiops != 0) || (params->throttlefile != NULL)) {
+
+		if (throttle_init(&setup->throttle, params->maxrate, params->maxiops, nstime()) == -1) JOBERROR("throttle_init()");
+
+		setup->throttled = 1;
+
+	}
+
+	if ((params->resume == 1) && (journal_load(&setup->jr) == -1)) {
+
+		joberror(job, errno, 0, "journal_load()", __FILE__, __LINE__, \
+				(errno == EINVAL) ? "Journal %s is damaged or made for other input!" : NULL, params->journal);
+
+		goto fail;
+
+	}
+
+	/*
+	 * Input which isn't seekable is read up to the start of the range.
+	 */
+
+	if ((iseekable == 0) && (params->listen == NULL) && (discardinput(ifd, params->skip, params->blksize) == -1)) JOBERROR("read()");
+
+	/*
+	 * Used only for statistics.
+	 */
+
+	if (gettimeofday(&setup->starttime, NULL) == -1) JOBERROR("gettimeofday()");
+
+	setup->ifd = ifd;
+	setup->iseekable = iseekable;
+	setup->imode = imode;
+	setup->isize = isize;
+	setup->imaxqsize = imaxqsize;
+	setup->omaxqsize = omaxqsize;
+	setup->iquesize = iquesize;
+	setup->maxblksize = maxblksize;
+	setup->directio = directio;
+
+	/*
+	 * Copied range is split into ranges of whole blocks, the last stream copies up to the end of input or --count.
+	 * Streams start at multiples of block size, only the first one starts at --skip.
+	 */
+
+	streams = malloc(sizeof(struct copystream) * params->streams);
+
+	if (streams == NULL) JOBERROR("malloc()");
+
+	memset(streams, 0, sizeof(struct copystream) * params->streams);
+
+	for(i = 0; i < params->streams; i++) streams[i].slot = -1;
+
+	pthread_mutex_lock(&job->lock);
+
+	job->streams = streams;
+
+	pthread_mutex_unlock(&job->lock);
+
+	if (getslots(streams, params->streams) == -1) {
+
+		if (errno != EBUSY) JOBERROR("sigaction()");
+
+		joberror(job, EBUSY, 0, NULL, NULL, 0, "All %i copy streams of the process are in use!", MAX_STREAMS);
+
+		goto fail;
+
+	}
+
+	rangeend = (params->count != -1) ? params->skip + params->count : -1;
+
+	splitend = ((rangeend != -1) && ((iseekable == 0) || (rangeend < isize))) ? rangeend : isize;
+
+	if (splitend < params->skip) splitend = params->skip;
+
+	rangestart = params->skip - params->skip % params->blksize;
+
+	streamsize = ((splitend - rangestart) / params->streams + params->blksize - 1) / params->blksize * params->blksize;
+
+	for(i = 0; i < params->streams; i++) {
+
+		streams[i].job = job;
+		streams[i].id = i;
+		streams[i].start = (i == 0) ? params->skip : rangestart + streamsize * i;
+		streams[i].end = (i == params->streams - 1) ? rangeend : rangestart + streamsize * (i + 1);
+
+		if (streams[i].start > splitend) streams[i].start = splitend;
+		if (streams[i].end > splitend) streams[i].end = splitend;
+
+		streams[i].ifd = ifd;
+		streams[i].ofd = setup->out[0].fd;
+
+		if (params->connect != NULL) streams[i].ofd = setup->netfds[i];
+
+		/*
+		 * Receiving streams write wherever the sender says.
+		 */
+
+		if (params->listen != NULL) {
+
+			streams[i].ifd = setup->netfds[i];
+			streams[i].start = 0;
+			streams[i].end = -1;
+
+		}
+
+	}
+
+	job->total = ((params->listen == NULL) && ((iseekable == 1) || (rangeend != -1))) ? splitend - params->skip : 0;
+
+	return 0;
+
+fail:
+
+	return -1;
+
+}
+
+/*
+ * Copies the data inside the kernel or by the streams.
+ */
+
+static int jobcopy(struct copyjob *job) {
+
+	struct copyparams *params = &job->params;
+	struct copysetup *setup = &job->setup;
+	struct copystream *streams = job->streams;
+	long long tint;
+	int started;
+	int i;
+
+	if (setup->zcmethod != ZEROCOPY_NONE) {
+
+		tint = zerocopy_run(setup->ifd, setup->out[0].fd, setup->zcmethod, params->blksize, &streams[0].st.done, &job->cancel);
+
+		/*
+		 * Refused before anything is copied, the usual way still works.
+		 */
+
+		if (tint == -1) {
+
+			if (errno == ECANCELED) {
+
+				joberror(job, ECANCELED, 0, NULL, NULL, 0, "Copy is canceled!");
+
+				goto fail;
+
+			}
+
+			if (errno != EOPNOTSUPP) JOBERROR("zerocopy_run()");
+
+			setup->zcmethod = ZEROCOPY_NONE;
+
+		}
+		else {
+
+			streams[0].copied = tint;
+
+		}
+
+	}
+
+	if (setup->zcmethod != ZEROCOPY_NONE) {
+
+		#ifdef AIOBLKCOPY_DEBUG
+		fprintf(stderr, "zerocopy: method %i\n", setup->zcmethod);
+		#endif
+
+	}
+	else if (params->streams == 1) {
+
+		copystream(&streams[0]);
+
+	}
+	else {
+
+		/*
+		 * Streams already started stop on the error.
+		 */
+
+		for(started = 0; started < params->streams; started++) {
+
+			if (pthread_create(&streams[started].thread, NULL, copystream, &streams[started]) != 0) {
+
+				joberror(job, EAGAIN, 0, "pthread_create()", __FILE__, __LINE__, NULL);
+
+				break;
+
+			}
+
+		}
+
+		for(i = 0; i < started; i++) pthread_join(streams[i].thread, NULL);
+
+	}
+
+	/*
+	 * Streams record their errors in the job.
+	 */
+
+	if (job->failed == 1) return -1;
+
+	return 0;
+
+fail:
+
+	return -1;
+
+}
+
+/*
+ * Merges results of the streams and makes the outputs complete.
+ */
+
+static int jobfinish(struct copyjob *job) {
+
+	struct copyparams *params = &job->params;
+	struct copysetup *setup = &job->setup;
+	struct copystream *streams = job->streams;
+	struct copyresult *res = &job->result;
+	struct stat statdata;
+	struct timeval endtime;
+	int i;
+
+	res->streams = params->streams;
+	res->compress = params->compress;
+	res->verify = params->verify;
+	res->zerocopy = (setup->zcmethod != ZEROCOPY_NONE);
+
+	for(i = 0; i < params->streams; i++) {
+
+		res->copied += streams[i].copied;
+		res->sparseb += streams[i].sparseb;
+		res->deltab += streams[i].deltab;
+		res->digest += streams[i].digest;
+		res->verifyfail += streams[i].verifyfail;
+		res->zinb += streams[i].zinb;
+		res->zoutb += streams[i].zoutb;
+		res->resumeb += streams[i].resumeb;
+
+		res->autotune[i].rdepth = streams[i].at.rd.depth;
+		res->autotune[i].wdepth = streams[i].at.wr.depth;
+		res->autotune[i].blksize = streams[i].at.blksize;
+
+	}
+
+	/*
+	 * Set size of regular output files, their tails can be holes. Data after the range written with --seek is kept.
+	 */
+
+	for(i = 0; i < setup->outputs; i++) {
+
+		if (((params->sparse != SPARSE_NONE) || (params->delta == 1) || (params->onerror == RESCUE_SKIP)) && \
+				S_ISREG(setup->out[i].mode)) {
+
+			if (fstat(setup->out[i].fd, &statdata) == -1) JOBERROR("fstat()");
+
+			if ((params->seek == 0) || (statdata.st_size < (off_t)(params->seek + res->copied))) {
+
+				if (ftruncate(setup->out[i].fd, params->seek + res->copied) == -1) JOBERROR("ftruncate()");
+
+			}
+
+		}
+
+	}
+
+	/*
+	 * Outputs are synced before the end time is taken, so the rate includes flushing.
+	 */
+
+	if (params->sync != SYNC_NONE) {
+
+		for(i = 0; i < setup->outputs; i++) {
+
+			if ((S_ISREG(setup->out[i].mode) || S_ISBLK(setup->out[i].mode)) && (fdatasync(setup->out[i].fd) == -1)) JOBERROR("fdatasync()");
+
+		}
+
+	}
+
+	if (journal_commit(&setup->jr, setup->out[0].fd, nstime(), 1) == -1) JOBERROR("journal_commit()");
+
+	if (rescue_commit(&setup->rescue, nstime(), 1) == -1) JOBERROR("rescue_commit()");
+
+	res->badbytes = setup->rescue.badbytes;
+	res->badranges = setup->rescue.nranges;
+
+	if (gettimeofday(&endtime, NULL) == -1) JOBERROR("gettimeofday()");
+
+	res->seconds = (double) (endtime.tv_sec * 1000000 + endtime.tv_usec - setup->starttime.tv_sec * 1000000 - setup->starttime.tv_usec) / 1000000;
+
+	return 0;
+
+fail:
+
+	return -1;
+
+}
+
+/*
+ * Frees what setup has made, descriptors the job didn't open are left open.
+ */
+
+static void jobcleanup(struct copyjob *job) {
+
+	struct copyparams *params = &job->params;
+	struct copysetup *setup = &job->setup;
+	int i;
+
+	pthread_mutex_lock(&job->lock);
+
+	if (job->streams != NULL) {
+
+		putslots(job->streams, params->streams);
+
+		free(job->streams);
+
+		job->streams = NULL;
+
+	}
+
+	if (setup->throttled == 1) {
+
+		setup->throttled = 0;
+
+		throttle_destroy(&setup->throttle);
+
+	}
+
+	pthread_mutex_unlock(&job->lock);
+
+	if (setup->journaled == 1) journal_destroy(&setup->jr);
+
+	if (setup->rescuing == 1) rescue_destroy(&setup->rescue);
+
+	for(i = 0; i < setup->nnetfds; i++) close(setup->netfds[i]);
+
+	if ((params->inputfile != NULL) && (setup->ifd != -1)) close(setup->ifd);
+	if (setup->ibouncefd != -1) close(setup->ibouncefd);
+
+	for(i = 0; (i < params->outputs) && (params->connect == NULL); i++) {
+
+		if (setup->out[i].fd != -1) close(setup->out[i].fd);
+		if (setup->out[i].bouncefd != -1) close(setup->out[i].bouncefd);
+
+	}
+
+}
+
+/*
+ * Defaults of all parameters, the same as without options.
+ */
+
+void copy_params_init(struct copyparams *params) {
+
+	memset(params, 0, sizeof(struct copyparams));
+
+	params->blksize = 0;
+	params->maxqsize = DEFAULT_MAXQUEUESIZE;
+	params->rdepth = 0;
+	params->wdepth = 0;
+	params->staging = 0;
+	params->inputfile = NULL;
+	params->outputs = 0;
+	params->engine = NULL;
+	params->hugepages = 0;
+	params->mlock = 0;
+	params->autotune = 0;
+	params->sparse = SPARSE_NONE;
+	params->delta = 0;
+	params->journal = NULL;
+	params->resume = 0;
+	params->streams = 1;
+	params->wo_zerocopy = 0;
+	params->listen = NULL;
+	params->connect = NULL;
+	params->compress = COMPRESS_NONE;
+	params->workthreads = 0;
+	params->verify = VERIFY_NONE;
+	params->skip = 0;
+	params->seek = 0;
+	params->count = -1;
+	params->onerror = RESCUE_ABORT;
+	params->errormap = NULL;
+	params->sync = SYNC_NONE;
+	params->syncevery = 0;
+	params->dropcache = 0;
+	params->numa = NUMA_NONE;
+	params->sqpoll = NUMA_CPU_NONE;
+	params->wo_di_inp = 0;
+	params->wo_di_out = 0;
+
+}
+
+/*
+ * Parameters are copied, nothing is opened until the job runs. Returns NULL on error.
+ */
+
+struct copyjob *copy_job_create(const struct copyparams *params) {
+
+	struct copyjob *job;
+	pthread_condattr_t attr;
+
+	job = malloc(sizeof(struct copyjob));
+
+	if (job == NULL) return NULL;
+
+	memset(job, 0, sizeof(struct copyjob));
+
+	job->params = *params;
+	job->state = COPYJOB_CREATED;
+
+	/*
+	 * Monitor sleeps by monotonic clock.
+	 */
+
+	if ((pthread_condattr_init(&attr) != 0) || (pthread_condattr_setclock(&attr, CLOCK_MONOTONIC) != 0) || \
+			(pthread_cond_init(&job->cond, &attr) != 0)) {
+
+		free(job);
+
+		return NULL;
+
+	}
+
+	pthread_condattr_destroy(&attr);
+
+	if (pthread_mutex_init(&job->lock, NULL) != 0) {
+
+		pthread_cond_destroy(&job->cond);
+
+		free(job);
+
+		return NULL;
+
+	}
+
+	return job;
+
+}
+
+void copy_job_setprogress(struct copyjob *job, copyprogress cb, void *arg) {
+
+	job->progresscb = cb;
+	job->progressarg = arg;
+
+}
+
+void copy_job_setverifyfail(struct copyjob *job, copyverifyfail cb, void *arg) {
+
+	job->verifycb = cb;
+	job->verifyarg = arg;
+
+}
+
+/*
+ * Streams of the job take data buffers from the scheduler shared with other jobs, it must exist while the job runs.
+ */
+
+void copy_job_setsched(struct copyjob *job, struct sched *sc) {
+
+	job->sched = sc;
+
+}
+
+/*
+ * Runs the job in the calling thread until it's done, fails or is canceled. Returns -1 if it fails,
+ * copy_job_error() tells why. A job runs only once.
+ */
+
+int copy_job_run(struct copyjob *job) {
+
+	struct copyparams *params = &job->params;
+	sigset_t ioset;
+	sigset_t oldset;
+	cpu_set_t oldcpus;
+	int pinned = 0;
+	int ret;
+
+	pthread_mutex_lock(&job->lock);
+
+	if (job->state != COPYJOB_CREATED) {
+
+		pthread_mutex_unlock(&job->lock);
+
+		errno = EINVAL;
+
+		return -1;
+
+	}
+
+	job->state = COPYJOB_RUNNING;
+
+	pthread_mutex_unlock(&job->lock);
+
+	/*
+	 * Threads started by the job inherit the mask, so completion signals are taken only by their streams.
+	 */
+
+	copy_job_sigset(&ioset);
+
+	pthread_sigmask(SIG_BLOCK, &ioset, &oldset);
+
+	ret = jobsetup(job);
+
+	if (ret == 0) {
+
+		job->start = nstime();
+
+		if ((params->progress != 0) || (params->statsjson != NULL) || (params->statsprom != NULL)) {
+
+			if (pthread_create(&job->monitor, NULL, monitorthread, job) != 0) {
+
+				joberror(job, EAGAIN, 0, "pthread_create()", __FILE__, __LINE__, NULL);
+
+				ret = -1;
+
+			}
+			else {
+
+				job->monitoring = 1;
+
+			}
+
+		}
+
+	}
+
+	/*
+	 * Threads started by the copy inherit the affinity: streams, their workers and AIO threads of the posix engine.
+	 */
+
+	if ((ret == 0) && (job->setup.numanode != -1)) {
+
+		ret = pthread_getaffinity_np(pthread_self(), sizeof(cpu_set_t), &oldcpus);
+
+		if (ret == 0) ret = pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &job->setup.cpus);
+
+		if (ret != 0) {
+
+			joberror(job, ret, 0, "pthread_setaffinity_np()", __FILE__, __LINE__, NULL);
+
+			ret = -1;
+
+		}
+		else {
+
+			pinned = 1;
+
+		}
+
+	}
+
+	if (ret == 0) ret = jobcopy(job);
+
+	if (pinned == 1) pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &oldcpus);
+
+	if (job->monitoring == 1) {
+
+		pthread_mutex_lock(&job->lock);
+
+		job->stopmonitor = 1;
+
+		pthread_cond_broadcast(&job->cond);
+
+		pthread_mutex_unlock(&job->lock);
+
+		pthread_join(job->monitor, NULL);
+
+		job->monitoring = 0;
+
+	}
+
+	/*
+	 * The last snapshot stays in the result after streams are freed.
+	 */
+
+	if (job->streams != NULL) {
+
+		pthread_mutex_lock(&job->lock);
+
+		takesnap(job, &job->result.snap, nstime());
+
+		pthread_mutex_unlock(&job->lock);
+
+	}
+
+	if (ret == 0) {
+
+		job->result.snap.finished = 1;
+
+		writestats(params, &job->result.snap);
+
+		ret = jobfinish(job);
+
+	}
+
+	jobcleanup(job);
+
+	pthread_sigmask(SIG_SETMASK, &oldset, NULL);
+
+	pthread_mutex_lock(&job->lock);
+
+	job->state = (job->failed == 1) ? COPYJOB_FAILED : COPYJOB_DONE;
+
+	pthread_mutex_unlock(&job->lock);
+
+	return (ret == 0) ? 0 : -1;
+
+}
+
+static void *jobthread(void *arg) {
+
+	copy_job_run(arg);
+
+	return NULL;
+
+}
+
+/*
+ * Runs the job in its own thread, copy_job_wait() waits for it.
+ */
+
+int copy_job_start(struct copyjob *job) {
+
+	if (job->started == 1) {
+
+		errno = EINVAL;
+
+		return -1;
+
+	}
+
+	if (pthread_create(&job->thread, NULL, jobthread, job) != 0) {
+
+		errno = EAGAIN;
+
+		return -1;
+
+	}
+
+	job->started = 1;
+
+	return 0;
+
+}
+
+/*
+ * Returns the state of the job, snap gets statistics of the whole copy if it isn't NULL.
+ * Can be called from any thread.
+ */
+
+int copy_job_poll(struct copyjob *job, struct statsnap *snap) {
+
+	int state;
+
+	pthread_mutex_lock(&job->lock);
+
+	state = job->state;
+
+	if (snap != NULL) {
+
+		if (job->streams != NULL) takesnap(job, snap, nstime());
+		else if (state == COPYJOB_RUNNING) stats_clear(snap, 0, 0);
+		else *snap = job->result.snap;
+
+	}
+
+	pthread_mutex_unlock(&job->lock);
+
+	return state;
+
+}
+
+/*
+ * Waits for the job started by copy_job_start() and returns its state.
+ */
+
+int copy_job_wait(struct copyjob *job) {
+
+	if (job->started == 1) {
+
+		pthread_join(job->thread, NULL);
+
+		job->started = 0;
+
+	}
+
+	return copy_job_poll(job, NULL);
+
+}
+
+/*
+ * Stops the job from any thread, requests in flight are waited for. The job fails with ECANCELED.
+ * Journal keeps the last commit, so the copy can be resumed.
+ */
+
+void copy_job_cancel(struct copyjob *job) {
+
+	STATS_SET(job->cancel, 1);
+
+}
+
+/*
+ * Changes limits of a job throttled by its parameters, zero means no limit.
+ */
+
+int copy_job_throttle(struct copyjob *job, long long rate, long long iops) {
+
+	int ret = 0;
+
+	if ((rate < 0) || (iops < 0)) {
+
+		errno = EINVAL;
+
+		return -1;
+
+	}
+
+	pthread_mutex_lock(&job->lock);
+
+	if (job->setup.throttled == 1) throttle_set(&job->setup.throttle, rate, iops);
+	else ret = -1;
+
+	pthread_mutex_unlock(&job->lock);
+
+	if (ret == -1) errno = EINVAL;
+
+	return ret;
+
+}
+
+const struct copyresult *copy_job_result(struct copyjob *job) {
+
+	return &job->result;
+
+}
+
+/*
+ * Returns NULL if the job hasn't failed.
+ */
+
+const struct copyerror *copy_job_error(struct copyjob *job) {
+
+	if (job->failed == 0) return NULL;
+
+	return &job->error;
+
+}
+
+/*
+ * Waits for the job if it's started and frees it.
+ */
+
+void copy_job_destroy(struct copyjob *job) {
+
+	copy_job_wait(job);
+
+	pthread_mutex_destroy(&job->lock);
+	pthread_cond_destroy(&job->cond);
+
+	free(job);
+
+}
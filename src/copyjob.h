@@ -0,0 +1,253 @@
+/*
+ ============================================================================
+ Name        : copyjob.h
+ Author      : Nikita Staroverov
+ Version     : 1.0.0
+ Copyright   : GPLv2
+ Description : Asynchronous block copying tool, copy engine library interface
+ ============================================================================
+ */
+
+/*
+Copyright (C) 2014  Nikita Staroverov
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef AIOBLKCOPY_COPYJOB_H
+#define AIOBLKCOPY_COPYJOB_H
+
+#include <stdint.h>
+#include <signal.h>
+#include <sys/types.h>
+
+#include "aioblkcopy.h"
+#include "stats.h"
+
+/*
+ * Copy engine used by aioblkcopy, it can be linked into other programs as libaioblkcopy.
+ * A job copies one input to its outputs with the parameters it's created with. Every job has its own
+ * streams, queues, I/O engines and buffers, so several jobs can run in one process at the same time.
+ * Nothing ends the program, errors are kept in the job and the job fails.
+ */
+
+/*
+ * Copy parameters, the options of aioblkcopy the fields are set by are given after them.
+ * File names and other strings aren't copied, they must not change while the job exists.
+ */
+
+struct copyparams {
+    int blksize;       /* working block size, 0 for the default -b and --blocksize*/
+    int maxqsize;    /* maximum queue size -q and --maxqsize*/
+    int rdepth;        /* maximum simultaneous read requests --read-depth */
+    int wdepth;        /* maximum simultaneous write requests --write-depth */
+    long long staging; /* memory for data read but not written yet --staging */
+    char *inputfile;   /* input file, standard input if NULL -i */
+    char *outputfile[MAX_OUTPUTS]; /* output files -o, can be given several times */
+    int outputs;       /* number of output files, standard output if 0 */
+    char *engine;      /* I/O engine --engine */
+    int hugepages;     /* back data buffers with huge pages --hugepages */
+    int mlock;         /* lock data buffers in memory --mlock */
+    int autotune;      /* adjust queue depths and block size on the fly --auto */
+    int sparse;        /* skip holes and zero blocks --sparse */
+    int delta;         /* write only blocks differing from output --delta */
+    char *journal;     /* copy progress file --journal */
+    int resume;        /* copy only ranges missing in journal --resume */
+    int streams;       /* parallel copy streams over input ranges --streams */
+    int wo_zerocopy;   /* disable splice() and copy_file_range() --without-zerocopy */
+    char *listen;      /* receive blocks from network instead of input --listen */
+    char *connect;     /* send blocks to network instead of output --connect */
+    int compress;      /* compression method of network blocks --compress */
+    int workthreads;   /* hashing and compression threads of every stream --work-threads */
+    int verify;        /* hash blocks, read them back after writing --verify */
+    int progress;      /* seconds between progress callbacks --progress */
+    char *statsjson;   /* statistics file in JSON --stats-json */
+    char *statsprom;   /* statistics file in Prometheus text format --stats-prom */
+    long long maxrate; /* bytes per second of every side --max-rate */
+    long long maxiops; /* requests per second of every side --max-iops */
+    char *throttlefile; /* limits are changed by copy_job_throttle() --throttle-file */
+    long long skip;    /* input offset to start from --skip */
+    long long seek;    /* output offset to start from --seek */
+    long long count;   /* bytes to copy, -1 up to the end of input --count */
+    int onerror;       /* what is done on read errors --on-error */
+    char *errormap;    /* bad input ranges file --error-map */
+    int sync;          /* when outputs are synced --sync */
+    long long syncevery; /* bytes written between syncs --sync=every */
+    int dropcache;     /* keep files without direct io out of page cache --drop-cache */
+    int numa;          /* NUMA node of buffers and copy threads --numa */
+    int sqpoll;        /* CPU of uring kernel submission thread --sqpoll */
+
+    /*
+     * Used only where O_DIRECT is available, the fields are always there so the layout doesn't depend on it.
+     */
+
+    int wo_di_inp;     /* disable O_DIRECT on input --without-directio-input*/
+    int wo_di_out;     /* disable O_DIRECT on output --without-directio-output*/
+
+};
+
+/*
+ * Job states returned by copy_job_poll() and copy_job_wait().
+ */
+#define COPYJOB_CREATED 0
+#define COPYJOB_RUNNING 1
+#define COPYJOB_DONE 2
+#define COPYJOB_FAILED 3
+
+/*
+ * Results of a finished job, valid once it's done.
+ */
+
+struct copyresult {
+
+	/*
+	 * Bytes of input range done, of them not written as zero, equal to output or written before the resumed copy.
+	 */
+	size_t copied;
+
+	size_t sparseb;
+
+	size_t deltab;
+
+	size_t resumeb;
+
+	/*
+	 * Bytes of blocks sent compressed before and after compression.
+	 */
+	size_t zinb;
+
+	size_t zoutb;
+
+	/*
+	 * Sum of block hashes, blocks failed verification.
+	 */
+	uint64_t digest;
+
+	long long verifyfail;
+
+	/*
+	 * Unreadable input skipped or written as zeroes.
+	 */
+	long long badbytes;
+
+	int badranges;
+
+	/*
+	 * Time from the start of the copy to the end of the last sync.
+	 */
+	double seconds;
+
+	/*
+	 * Set if data was copied inside the kernel, streams have no queues then.
+	 */
+	int zerocopy;
+
+	/*
+	 * Parameters as they were used, receiver takes them from the sender.
+	 */
+	int streams;
+
+	int compress;
+
+	int verify;
+
+	/*
+	 * Values autotuning settled on in every stream.
+	 */
+	struct {
+
+		int rdepth;
+
+		int wdepth;
+
+		size_t blksize;
+
+	} autotune[MAX_STREAMS];
+
+	/*
+	 * Statistics of the whole copy.
+	 */
+	struct statsnap snap;
+
+};
+
+/*
+ * The first error of a failed job. Errors of system calls have func, file and line where they failed,
+ * wrong parameters have usage set. message explains errors when errno alone doesn't.
+ */
+
+struct copyerror {
+
+	int code;
+
+	int usage;
+
+	const char *func;
+
+	const char *file;
+
+	int line;
+
+	char message[256];
+
+};
+
+struct copyjob;
+
+struct sched;
+
+/*
+ * Called by the job's own thread every params.progress seconds while it copies.
+ */
+typedef void (*copyprogress)(struct copyjob *job, const struct statsnap *snap, void *arg);
+
+/*
+ * Called by the stream which found written block of len bytes at input offset off different from the block read.
+ */
+typedef void (*copyverifyfail)(struct copyjob *job, long long off, size_t len, void *arg);
+
+void copy_params_init(struct copyparams *params);
+
+long long copy_parsesize(const char *str);
+
+void copy_job_sigset(sigset_t *set);
+
+struct copyjob *copy_job_create(const struct copyparams *params);
+
+void copy_job_setprogress(struct copyjob *job, copyprogress cb, void *arg);
+
+void copy_job_setverifyfail(struct copyjob *job, copyverifyfail cb, void *arg);
+
+void copy_job_setsched(struct copyjob *job, struct sched *sc);
+
+int copy_job_run(struct copyjob *job);
+
+int copy_job_start(struct copyjob *job);
+
+int copy_job_poll(struct copyjob *job, struct statsnap *snap);
+
+int copy_job_wait(struct copyjob *job);
+
+void copy_job_cancel(struct copyjob *job);
+
+int copy_job_throttle(struct copyjob *job, long long rate, long long iops);
+
+const struct copyresult *copy_job_result(struct copyjob *job);
+
+const struct copyerror *copy_job_error(struct copyjob *job);
+
+void copy_job_destroy(struct copyjob *job);
+
+#endif
@@ -0,0 +1,237 @@
+/*
+ ============================================================================
+ Name        : ioengine.c
+ Author      : Nikita Staroverov
+ Version     : 1.0.0
+ Copyright   : GPLv2
+ Description : Asynchronous block copying tool, I/O engines selection
+ ============================================================================
+ */
+
+/*
+Copyright (C) 2014  Nikita Staroverov
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+
+#include "ioengine.h"
+
+/*
+ * Known engines in order of preference.
+ * The first one which can be initialized is used by default.
+ */
+
+static const struct ioengineops *engines[] = {
+
+	#ifdef HAVE_LIBURING
+	&ioengine_uring,
+	#endif
+
+	#ifdef HAVE_LINUX_AIO_ABI_H
+	&ioengine_libaio,
+	#endif
+
+	&ioengine_posix,
+
+	#ifdef HAVE_DELAY_ENGINE
+	&ioengine_delay,
+	#endif
+
+	NULL
+};
+
+/*
+ * Engine name can be followed by colon and parameters if the engine takes them.
+ */
+
+static int ioengine_match(const char *name, const struct ioengineops *ops) {
+
+	size_t len = strcspn(name, ":");
+
+	if ((name[len] == ':') && (ops->takesparams == 0)) return 0;
+
+	return (strncmp(name, ops->name, len) == 0) && (ops->name[len] == '\0');
+
+}
+
+int ioengine_exists(const char *name) {
+
+	int i;
+
+	for(i = 0; engines[i] != NULL; i++) {
+
+		if (ioengine_match(name, engines[i]) == 1) return 1;
+
+	}
+
+	return 0;
+
+}
+
+/*
+ * Returns 1 if the engine isn't meant for copying, so the copy must go through it.
+ */
+
+int ioengine_manual(const char *name) {
+
+	int i;
+
+	for(i = 0; engines[i] != NULL; i++) {
+
+		if (ioengine_match(name, engines[i]) == 1) return engines[i]->manual;
+
+	}
+
+	return 0;
+
+}
+
+/*
+ * Prints names of built engines separated by '|'.
+ */
+
+void ioengine_list(FILE *stream) {
+
+	int i;
+
+	for(i = 0; engines[i] != NULL; i++) {
+
+		fprintf(stream, "%s%s", (i == 0) ? "" : "|", engines[i]->name);
+
+	}
+
+}
+
+/*
+ * Creates engine by name or the best available one if name is NULL.
+ * directio tells whether all descriptors are opened with O_DIRECT.
+ */
+
+struct ioengine *ioengine_create(const char *name, int depth, int directio, int stream) {
+
+	struct ioengine *eng;
+	int i;
+
+	eng = malloc(sizeof(struct ioengine));
+
+	if (eng == NULL) return NULL;
+
+	for(i = 0; engines[i] != NULL; i++) {
+
+		if ((name != NULL) && (ioengine_match(name, engines[i]) == 0)) continue;
+
+		if ((name == NULL) && (((engines[i]->directonly == 1) && (directio == 0)) || (engines[i]->manual == 1))) continue;
+
+		memset(eng, 0, sizeof(struct ioengine));
+
+		eng->ops = engines[i];
+		eng->depth = depth;
+		eng->stream = stream;
+		eng->params = ((name != NULL) && (name[strcspn(name, ":")] == ':')) ? name + strcspn(name, ":") + 1 : NULL;
+
+		if (eng->ops->init(eng) == 0) {
+
+			#ifdef AIOBLKCOPY_DEBUG
+			fprintf(stderr, "ioengine: %s depth: %i\n", eng->ops->name, eng->depth);
+			#endif
+
+			return eng;
+
+		}
+
+		#ifdef AIOBLKCOPY_DEBUG
+		fprintf(stderr, "ioengine: %s init failed: %s\n", engines[i]->name, strerror(errno));
+		#endif
+
+		if (name != NULL) {
+
+			free(eng);
+
+			return NULL;
+
+		}
+
+	}
+
+	free(eng);
+
+	errno = ENOENT;
+
+	return NULL;
+
+}
+
+void ioengine_destroy(struct ioengine *eng) {
+
+	eng->ops->destroy(eng);
+
+	free(eng);
+
+}
+
+int ioengine_setfiles(struct ioengine *eng, const int *fds, int nfds) {
+
+	if (eng->ops->setfiles == NULL) return 0;
+
+	return eng->ops->setfiles(eng, fds, nfds);
+
+}
+
+int ioengine_setbuffers(struct ioengine *eng, char *arena, size_t size, size_t bufsize) {
+
+	if (eng->ops->setbuffers == NULL) return 0;
+
+	return eng->ops->setbuffers(eng, arena, size, bufsize);
+
+}
+
+int ioengine_queue(struct ioengine *eng, struct blkqueitem *item, int direction) {
+
+	item->retcode = EINPROGRESS;
+	item->iores = 0;
+	item->iostart = nstime();
+
+	if (eng->ops->queue(eng, item, direction) == -1) return -1;
+
+	eng->inflight++ ;
+
+	return 0;
+
+}
+
+int ioengine_submit(struct ioengine *eng) {
+
+	return eng->ops->submit(eng);
+
+}
+
+int ioengine_reap(struct ioengine *eng, int wait) {
+
+	int ret;
+
+	if (eng->inflight == 0) return 0;
+
+	ret = eng->ops->reap(eng, wait);
+
+	if (ret > 0) eng->inflight -= ret;
+
+	return ret;
+
+}
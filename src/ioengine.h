@@ -0,0 +1,173 @@
+/*
+ ============================================================================
+ Name        : ioengine.h
+ Author      : Nikita Staroverov
+ Version     : 1.0.0
+ Copyright   : GPLv2
+ Description : Asynchronous block copying tool, I/O engines interface
+ ============================================================================
+ */
+
+/*
+Copyright (C) 2014  Nikita Staroverov
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef AIOBLKCOPY_IOENGINE_H
+#define AIOBLKCOPY_IOENGINE_H
+
+#include <stdio.h>
+
+#include "aioblkcopy.h"
+
+#define IOENGINE_READ 0
+#define IOENGINE_WRITE 1
+#define IOENGINE_SYNC 2
+
+struct ioengine;
+
+/*
+ * Every I/O engine implements these operations.
+ * All of them return -1 and set errno on failure.
+ *
+ * queue()  - prepares request described by item->iobuf, item->iolen and item->iooff on item->fd.
+ *            The engine may hold the request until submit() is called.
+ *            IOENGINE_SYNC request flushes written data of item->iofd like fdatasync(), buffer isn't used.
+ * submit() - sends all queued requests to the kernel.
+ * reap()   - collects completed requests. For every completed item retcode is set to 0 or errno
+ *            and iores to the transferred bytes, and the item is put on the done list with ioengine_done().
+ *            If wait isn't zero and nothing is completed reap() waits for completions.
+ *            Returns number of completed requests.
+ *
+ * Optional operations, may be NULL:
+ *
+ * setfiles()   - tells the engine all descriptors requests will use, so it can keep references to them.
+ * setbuffers() - tells the engine the arena all request buffers are cut from, so it can pin it once.
+ */
+
+struct ioengineops {
+
+	const char *name;
+
+	/*
+	 * The engine is chosen automatically only if all descriptors use O_DIRECT.
+	 */
+	int directonly;
+
+	/*
+	 * The engine is never chosen automatically, only by name.
+	 */
+	int manual;
+
+	/*
+	 * The engine takes parameters after colon in its name.
+	 */
+	int takesparams;
+
+	int (*init)(struct ioengine *eng);
+
+	int (*queue)(struct ioengine *eng, struct blkqueitem *item, int direction);
+
+	int (*submit)(struct ioengine *eng);
+
+	int (*reap)(struct ioengine *eng, int wait);
+
+	void (*destroy)(struct ioengine *eng);
+
+	int (*setfiles)(struct ioengine *eng, const int *fds, int nfds);
+
+	int (*setbuffers)(struct ioengine *eng, char *arena, size_t size, size_t bufsize);
+
+};
+
+struct ioengine {
+
+	const struct ioengineops *ops;
+
+	/*
+	 * Maximum number of simultaneous requests.
+	 */
+	int depth;
+
+	/*
+	 * Number of requests given to the engine and not reaped yet.
+	 */
+	int inflight;
+
+	/*
+	 * Copy stream owning the engine, engines of different streams must not share notifications.
+	 */
+	int stream;
+
+	/*
+	 * Engine parameters given after colon in its name, NULL if there are none.
+	 */
+	const char *params;
+
+	/*
+	 * Items completed by reap(), taken by the caller.
+	 */
+	struct itemlist done;
+
+	void *priv;
+
+};
+
+/*
+ * Called by engines for every completed item after its retcode and iores are set.
+ */
+
+static inline void ioengine_done(struct ioengine *eng, struct blkqueitem *item) {
+
+	itemlist_push(&eng->done, item);
+
+}
+
+extern const struct ioengineops ioengine_posix;
+
+#ifdef HAVE_LIBURING
+extern const struct ioengineops ioengine_uring;
+#endif
+
+#ifdef HAVE_LINUX_AIO_ABI_H
+extern const struct ioengineops ioengine_libaio;
+#endif
+
+#ifdef HAVE_DELAY_ENGINE
+extern const struct ioengineops ioengine_delay;
+#endif
+
+int ioengine_exists(const char *name);
+
+int ioengine_manual(const char *name);
+
+void ioengine_list(FILE *stream);
+
+struct ioengine *ioengine_create(const char *name, int depth, int directio, int stream);
+
+void ioengine_destroy(struct ioengine *eng);
+
+int ioengine_setfiles(struct ioengine *eng, const int *fds, int nfds);
+
+int ioengine_setbuffers(struct ioengine *eng, char *arena, size_t size, size_t bufsize);
+
+int ioengine_queue(struct ioengine *eng, struct blkqueitem *item, int direction);
+
+int ioengine_submit(struct ioengine *eng);
+
+int ioengine_reap(struct ioengine *eng, int wait);
+
+#endif
@@ -0,0 +1,315 @@
+/*
+ ============================================================================
+ Name        : ioengine_delay.c
+ Author      : Nikita Staroverov
+ Version     : 1.0.0
+ Copyright   : GPLv2
+ Description : Asynchronous block copying tool, engine simulating device latency
+ ============================================================================
+ */
+
+/*
+Copyright (C) 2014  Nikita Staroverov
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifdef HAVE_DELAY_ENGINE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "ioengine.h"
+
+/*
+ * Fake engine for benchmarks, it makes any file look like a device with high latency.
+ * Every request completes LATENCY microseconds after it was queued, plus random jitter up to JITTER either way,
+ * parameters are given as delay:LATENCY[:JITTER]. Requests don't wait for each other, so the queue depth
+ * hides the latency like it does on a real device. The transfer itself is done with pread() and pwrite()
+ * when the request completes.
+ */
+
+#define DELAY_LATENCY_US 1000
+
+struct delayengine {
+
+	struct blkqueitem **items;
+
+	/*
+	 * Completion time and direction of every request in flight.
+	 */
+	long long *due;
+
+	int *dirs;
+
+	int count;
+
+	long long latency;
+
+	long long jitter;
+
+	unsigned int seed;
+
+};
+
+static int delay_params(struct delayengine *de, const char *params) {
+
+	char *end;
+
+	de->latency = DELAY_LATENCY_US * 1000LL;
+	de->jitter = 0;
+
+	if (params == NULL) return 0;
+
+	errno = 0;
+
+	de->latency = strtoll(params, &end, 10) * 1000;
+
+	if ((errno == 0) && (end != params) && (*end == ':')) {
+
+		params = end + 1;
+
+		de->jitter = strtoll(params, &end, 10) * 1000;
+
+		if (end == params) errno = EINVAL;
+
+	}
+
+	if ((errno != 0) || (end == params) || (*end != '\0') || (de->latency < 0) || (de->jitter < 0)) {
+
+		errno = EINVAL;
+
+		return -1;
+
+	}
+
+	return 0;
+
+}
+
+static int delay_init(struct ioengine *eng) {
+
+	struct delayengine *de;
+
+	de = malloc(sizeof(struct delayengine));
+
+	if (de == NULL) return -1;
+
+	memset(de, 0, sizeof(struct delayengine));
+
+	if (delay_params(de, eng->params) == -1) {
+
+		free(de);
+
+		return -1;
+
+	}
+
+	de->items = malloc(sizeof(struct blkqueitem *) * eng->depth);
+	de->due = malloc(sizeof(long long) * eng->depth);
+	de->dirs = malloc(sizeof(int) * eng->depth);
+
+	if ((de->items == NULL) || (de->due == NULL) || (de->dirs == NULL)) {
+
+		free(de->items);
+		free(de->due);
+		free(de->dirs);
+		free(de);
+
+		return -1;
+
+	}
+
+	/*
+	 * The same jitter sequence on every run.
+	 */
+	de->seed = eng->stream + 1;
+
+	eng->priv = de;
+
+	return 0;
+
+}
+
+static int delay_queue(struct ioengine *eng, struct blkqueitem *item, int direction) {
+
+	struct delayengine *de = eng->priv;
+	long long lat = de->latency;
+
+	if (de->count == eng->depth) {
+
+		errno = EAGAIN;
+
+		return -1;
+
+	}
+
+	if (de->jitter != 0) lat += (long long)(rand_r(&de->seed) % (2 * de->jitter + 1)) - de->jitter;
+
+	if (lat < 0) lat = 0;
+
+	de->items[de->count] = item;
+	de->due[de->count] = item->iostart + lat;
+	de->dirs[de->count] = direction;
+
+	de->count++ ;
+
+	return 0;
+
+}
+
+static int delay_submit(struct ioengine *eng) {
+
+	(void)eng;
+
+	return 0;
+
+}
+
+/*
+ * Pipes and sockets have no offsets.
+ */
+
+static void delay_transfer(struct blkqueitem *item, int direction) {
+
+	ssize_t ret;
+
+	switch(direction) {
+
+	case IOENGINE_READ:
+
+		ret = pread(item->iofd, item->iobuf, item->iolen, item->iooff);
+
+		if ((ret == -1) && (errno == ESPIPE)) ret = read(item->iofd, item->iobuf, item->iolen);
+
+		break;
+
+	case IOENGINE_WRITE:
+
+		ret = pwrite(item->iofd, item->iobuf, item->iolen, item->iooff);
+
+		if ((ret == -1) && (errno == ESPIPE)) ret = write(item->iofd, item->iobuf, item->iolen);
+
+		break;
+
+	default:
+
+		ret = fdatasync(item->iofd);
+
+		break;
+
+	}
+
+	if (ret == -1) {
+
+		item->retcode = errno;
+		item->iores = 0;
+
+	}
+	else {
+
+		item->retcode = 0;
+		item->iores = ret;
+
+	}
+
+}
+
+static int delay_reap(struct ioengine *eng, int wait) {
+
+	struct delayengine *de = eng->priv;
+	struct timespec ts;
+	long long now;
+	long long first;
+	int done = 0;
+	int i;
+
+	if (de->count == 0) return 0;
+
+	now = nstime();
+
+	if (wait != 0) {
+
+		first = de->due[0];
+
+		for(i = 1; i < de->count; i++) if (de->due[i] < first) first = de->due[i];
+
+		if (first > now) {
+
+			ts.tv_sec = (first - now) / 1000000000;
+			ts.tv_nsec = (first - now) % 1000000000;
+
+			nanosleep(&ts, NULL);
+
+			now = nstime();
+
+		}
+
+	}
+
+	/*
+	 * Completed request is replaced by the last one.
+	 */
+
+	for(i = 0; i < de->count; i++) {
+
+		if (de->due[i] > now) continue;
+
+		delay_transfer(de->items[i], de->dirs[i]);
+
+		ioengine_done(eng, de->items[i]);
+
+		de->count-- ;
+
+		de->items[i] = de->items[de->count];
+		de->due[i] = de->due[de->count];
+		de->dirs[i] = de->dirs[de->count];
+
+		i-- ;
+		done++ ;
+
+	}
+
+	return done;
+
+}
+
+static void delay_destroy(struct ioengine *eng) {
+
+	struct delayengine *de = eng->priv;
+
+	free(de->items);
+	free(de->due);
+	free(de->dirs);
+	free(de);
+
+}
+
+const struct ioengineops ioengine_delay = {
+	.name = "delay",
+	.manual = 1,
+	.takesparams = 1,
+	.init = delay_init,
+	.queue = delay_queue,
+	.submit = delay_submit,
+	.reap = delay_reap,
+	.destroy = delay_destroy
+};
+
+#endif
@@ -0,0 +1,366 @@
+/*
+ ============================================================================
+ Name        : ioengine_libaio.c
+ Author      : Nikita Staroverov
+ Version     : 1.0.0
+ Copyright   : GPLv2
+ Description : Asynchronous block copying tool, Linux native AIO engine
+ ============================================================================
+ */
+
+/*
+Copyright (C) 2014  Nikita Staroverov
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifdef HAVE_LINUX_AIO_ABI_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/syscall.h>
+#include <linux/aio_abi.h>
+
+#include "ioengine.h"
+
+/*
+ * Kernel native AIO used through raw system calls, so libaio isn't needed for building.
+ * It is truly asynchronous only on O_DIRECT descriptors, io_submit() blocks on buffered ones.
+ */
+
+struct libaioengine {
+
+	aio_context_t ctx;
+
+	/*
+	 * Control blocks for all requests, unused ones are kept in the free stack.
+	 */
+	struct iocb *iocbs;
+
+	struct iocb **freecbs;
+
+	int nfree;
+
+	/*
+	 * Requests queued but not submitted yet.
+	 */
+	struct iocb **pending;
+
+	int npending;
+
+	struct io_event *events;
+
+	/*
+	 * Kernels before 4.18 have no IOCB_CMD_FDSYNC, then data is flushed by fdatasync() when the request is queued
+	 * and the item is kept here until the next reap().
+	 */
+	int nofdsync;
+
+	struct blkqueitem **synced;
+
+	int nsynced;
+
+};
+
+static void libaio_syncnow(struct libaioengine *le, struct blkqueitem *item) {
+
+	if (fdatasync(item->iofd) == -1) {
+
+		item->retcode = errno;
+		item->iores = -1;
+
+	}
+	else {
+
+		item->retcode = 0;
+		item->iores = 0;
+
+	}
+
+	le->synced[le->nsynced++] = item;
+
+}
+
+static int libaio_init(struct ioengine *eng) {
+
+	struct libaioengine *le;
+	int i;
+
+	le = malloc(sizeof(struct libaioengine));
+
+	if (le == NULL) return -1;
+
+	memset(le, 0, sizeof(struct libaioengine));
+
+	if (syscall(SYS_io_setup, eng->depth, &le->ctx) == -1) {
+
+		free(le);
+
+		return -1;
+
+	}
+
+	le->iocbs = malloc(sizeof(struct iocb) * eng->depth);
+	le->freecbs = malloc(sizeof(struct iocb *) * eng->depth);
+	le->pending = malloc(sizeof(struct iocb *) * eng->depth);
+	le->events = malloc(sizeof(struct io_event) * eng->depth);
+	le->synced = malloc(sizeof(struct blkqueitem *) * eng->depth);
+
+	if ((le->iocbs == NULL) || (le->freecbs == NULL) || (le->pending == NULL) || (le->events == NULL) || (le->synced == NULL)) {
+
+		syscall(SYS_io_destroy, le->ctx);
+
+		free(le->iocbs);
+		free(le->freecbs);
+		free(le->pending);
+		free(le->events);
+		free(le->synced);
+		free(le);
+
+		errno = ENOMEM;
+
+		return -1;
+
+	}
+
+	for(i = 0; i < eng->depth; i++) le->freecbs[i] = &le->iocbs[i];
+
+	le->nfree = eng->depth;
+
+	eng->priv = le;
+
+	return 0;
+
+}
+
+static int libaio_queue(struct ioengine *eng, struct blkqueitem *item, int direction) {
+
+	struct libaioengine *le = eng->priv;
+	struct iocb *cb;
+
+	if ((direction == IOENGINE_SYNC) && (le->nofdsync == 1)) {
+
+		libaio_syncnow(le, item);
+
+		return 0;
+
+	}
+
+	if (le->nfree == 0) {
+
+		errno = EAGAIN;
+
+		return -1;
+
+	}
+
+	cb = le->freecbs[--le->nfree];
+
+	memset(cb, 0, sizeof(struct iocb));
+
+	cb->aio_data = (__u64)(unsigned long)item;
+	cb->aio_fildes = item->iofd;
+
+	if (direction == IOENGINE_SYNC) {
+
+		cb->aio_lio_opcode = IOCB_CMD_FDSYNC;
+
+		le->pending[le->npending++] = cb;
+
+		return 0;
+
+	}
+
+	cb->aio_lio_opcode = (direction == IOENGINE_READ) ? IOCB_CMD_PREAD : IOCB_CMD_PWRITE;
+	cb->aio_buf = (__u64)(unsigned long)item->iobuf;
+	cb->aio_nbytes = item->iolen;
+	cb->aio_offset = item->iooff;
+
+	le->pending[le->npending++] = cb;
+
+	return 0;
+
+}
+
+static int libaio_submit(struct ioengine *eng) {
+
+	struct libaioengine *le = eng->priv;
+	long ret = 0;
+	int done = 0;
+
+	/*
+	 * The whole batch goes in one io_submit() unless the kernel takes only a part of it.
+	 */
+
+	while(done < le->npending) {
+
+		ret = syscall(SYS_io_submit, le->ctx, (long)(le->npending - done), le->pending + done);
+
+		if (ret == -1) {
+
+			if (errno == EINTR) continue;
+
+			/*
+			 * Old kernel refuses the data flush, it is done synchronously from now on.
+			 */
+
+			if ((errno == EINVAL) && (le->pending[done]->aio_lio_opcode == IOCB_CMD_FDSYNC)) {
+
+				le->nofdsync = 1;
+
+				libaio_syncnow(le, (struct blkqueitem *)(unsigned long)le->pending[done]->aio_data);
+
+				le->freecbs[le->nfree++] = le->pending[done];
+
+				done++ ;
+
+				ret = 0;
+
+				continue;
+
+			}
+
+			break;
+
+		}
+
+		if (ret == 0) {
+
+			errno = EAGAIN;
+
+			ret = -1;
+
+			break;
+
+		}
+
+		done += ret;
+
+	}
+
+	/*
+	 * Requests taken by the kernel are in flight, only the rest is submitted again.
+	 */
+
+	if ((done != 0) && (done < le->npending)) memmove(le->pending, le->pending + done, sizeof(struct iocb *) * (le->npending - done));
+
+	le->npending -= done;
+
+	return (ret == -1) ? -1 : 0;
+
+}
+
+static int libaio_reap(struct ioengine *eng, int wait) {
+
+	struct libaioengine *le = eng->priv;
+	struct blkqueitem *item;
+	struct timespec ts;
+	struct iocb *cb;
+	long ret;
+	long n = 0;
+	long i;
+
+	ts.tv_sec = 0;
+	ts.tv_nsec = 0;
+
+	/*
+	 * Items flushed synchronously are completed already, so there is nothing to wait for.
+	 */
+	if (le->nsynced != 0) wait = 0;
+
+	do {
+
+		ret = syscall(SYS_io_getevents, le->ctx, (wait != 0) ? 1L : 0L, (long)eng->depth, le->events, (wait != 0) ? NULL : &ts);
+
+	} while ((ret == -1) && (errno == EINTR));
+
+	if (ret == -1) return -1;
+
+	for(i = 0; i < ret; i++) {
+
+		item = (struct blkqueitem *)(unsigned long)le->events[i].data;
+		cb = (struct iocb *)(unsigned long)le->events[i].obj;
+
+		le->freecbs[le->nfree++] = cb;
+
+		if ((le->events[i].res == -EINVAL) && (cb->aio_lio_opcode == IOCB_CMD_FDSYNC)) {
+
+			le->nofdsync = 1;
+
+			libaio_syncnow(le, item);
+
+			continue;
+
+		}
+
+		if (le->events[i].res < 0) {
+
+			item->retcode = -le->events[i].res;
+			item->iores = -1;
+
+		}
+		else {
+
+			item->retcode = 0;
+			item->iores = le->events[i].res;
+
+		}
+
+		ioengine_done(eng, item);
+
+		n++ ;
+
+	}
+
+	for(i = 0; i < le->nsynced; i++) ioengine_done(eng, le->synced[i]);
+
+	n += le->nsynced;
+
+	le->nsynced = 0;
+
+	return n;
+
+}
+
+static void libaio_destroy(struct ioengine *eng) {
+
+	struct libaioengine *le = eng->priv;
+
+	syscall(SYS_io_destroy, le->ctx);
+
+	free(le->iocbs);
+	free(le->freecbs);
+	free(le->pending);
+	free(le->events);
+	free(le->synced);
+	free(le);
+
+}
+
+const struct ioengineops ioengine_libaio = {
+	.name = "libaio",
+	.directonly = 1,
+	.init = libaio_init,
+	.queue = libaio_queue,
+	.submit = libaio_submit,
+	.reap = libaio_reap,
+	.destroy = libaio_destroy
+};
+
+#endif
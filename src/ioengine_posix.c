@@ -0,0 +1,295 @@
+/*
+ ============================================================================
+ Name        : ioengine_posix.c
+ Author      : Nikita Staroverov
+ Version     : 1.0.0
+ Copyright   : GPLv2
+ Description : Asynchronous block copying tool, POSIX AIO engine
+ ============================================================================
+ */
+
+/*
+Copyright (C) 2014  Nikita Staroverov
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <signal.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <aio.h>
+
+#include "ioengine.h"
+
+/*
+ * aio_read() and aio_write() submit requests immediately.
+ * Every request notifies about its completion with queued signal carrying pointer to its item,
+ * engine of copy stream N uses IO_SIGNAL + N, so each thread takes only its own completions,
+ * the signal is kept blocked and taken with sigtimedwait(), so only completed items are checked.
+ * Requests in progress are remembered too, they are all checked with aio_error() if signals
+ * were lost (e.g. RLIMIT_SIGPENDING reached) and nothing arrives for POSIX_SAFETY_TIMEOUT seconds.
+ */
+
+#define POSIX_SAFETY_TIMEOUT 1
+
+struct posixengine {
+
+	struct blkqueitem **items;
+
+	int count;
+
+	sigset_t ioset;
+
+	int signo;
+
+};
+
+static int posix_init(struct ioengine *eng) {
+
+	struct posixengine *pe;
+
+	pe = malloc(sizeof(struct posixengine));
+
+	if (pe == NULL) return -1;
+
+	pe->items = malloc(sizeof(struct blkqueitem *) * eng->depth);
+
+	if (pe->items == NULL) {
+
+		free(pe);
+
+		return -1;
+
+	}
+
+	pe->count = 0;
+
+	pe->signo = IO_SIGNAL + eng->stream;
+
+	/*
+	 * Block the signal before any request is sent so it stays pending for sigtimedwait().
+	 */
+
+	if ((sigemptyset(&pe->ioset) == -1) || (sigaddset(&pe->ioset, pe->signo) == -1) || \
+			(pthread_sigmask(SIG_BLOCK, &pe->ioset, NULL) != 0)) {
+
+		free(pe->items);
+		free(pe);
+
+		return -1;
+
+	}
+
+	eng->priv = pe;
+
+	return 0;
+
+}
+
+static int posix_queue(struct ioengine *eng, struct blkqueitem *item, int direction) {
+
+	struct posixengine *pe = eng->priv;
+
+	if (pe->count == eng->depth) {
+
+		errno = EAGAIN;
+
+		return -1;
+
+	}
+
+	item->aiodata.aio_fildes = item->iofd;
+	item->aiodata.aio_reqprio = 0;
+	item->aiodata.aio_buf = item->iobuf;
+	item->aiodata.aio_offset = item->iooff;
+	item->aiodata.aio_nbytes = item->iolen;
+	item->aiodata.aio_sigevent.sigev_notify = SIGEV_SIGNAL;
+	item->aiodata.aio_sigevent.sigev_signo = pe->signo;
+	item->aiodata.aio_sigevent.sigev_value.sival_ptr = item;
+
+	if (direction == IOENGINE_READ) {
+
+		if (aio_read(&item->aiodata) == -1) return -1;
+
+	}
+	else if (direction == IOENGINE_SYNC) {
+
+		if (aio_fsync(O_DSYNC, &item->aiodata) == -1) return -1;
+
+	}
+	else {
+
+		if (aio_write(&item->aiodata) == -1) return -1;
+
+	}
+
+	item->ioslot = pe->count;
+
+	pe->items[pe->count++] = item;
+
+	return 0;
+
+}
+
+static int posix_submit(struct ioengine *eng) {
+
+	return 0;
+
+}
+
+/*
+ * Checks request of the item and forgets it if completed.
+ */
+
+static int posix_check(struct ioengine *eng, struct blkqueitem *item) {
+
+	struct posixengine *pe = eng->priv;
+	int slot = item->ioslot;
+
+	/*
+	 * The signal could come late for a request already found completed by posix_scan().
+	 */
+	if ((slot < 0) || (slot >= pe->count) || (pe->items[slot] != item)) return 0;
+
+	item->retcode = aio_error(&item->aiodata);
+
+	if (item->retcode == EINPROGRESS) return 0;
+
+	item->iores = aio_return(&item->aiodata);
+
+	/*
+	 * Forget completed request, the last one takes its place.
+	 */
+	item->ioslot = -1;
+
+	pe->items[slot] = pe->items[--pe->count];
+
+	if (slot < pe->count) pe->items[slot]->ioslot = slot;
+
+	ioengine_done(eng, item);
+
+	return 1;
+
+}
+
+static int posix_scan(struct ioengine *eng) {
+
+	struct posixengine *pe = eng->priv;
+	int done = 0;
+	int i = 0;
+
+	while(i < pe->count) {
+
+		if (posix_check(eng, pe->items[i]) == 0) i++;
+		else done++;
+
+	}
+
+	return done;
+
+}
+
+/*
+ * Takes all pending completion signals and checks items they point to.
+ */
+
+static int posix_drain(struct ioengine *eng, const struct timespec *to) {
+
+	struct posixengine *pe = eng->priv;
+	struct timespec zero;
+	siginfo_t si;
+	int done = 0;
+
+	zero.tv_sec = 0;
+	zero.tv_nsec = 0;
+
+	for(;;) {
+
+		if (sigtimedwait(&pe->ioset, &si, (to != NULL) ? to : &zero) == -1) {
+
+			if (errno == EAGAIN) break;
+
+			/*
+			 * Other signals must be handled by the main loop.
+			 */
+			if (errno == EINTR) break;
+
+			return -1;
+
+		}
+
+		to = NULL;
+
+		if (si.si_code != SI_ASYNCIO) continue;
+
+		done += posix_check(eng, (struct blkqueitem *)si.si_value.sival_ptr);
+
+	}
+
+	return done;
+
+}
+
+static int posix_reap(struct ioengine *eng, int wait) {
+
+	struct timespec to;
+	int done;
+
+	done = posix_drain(eng, NULL);
+
+	if ((done != 0) || (wait == 0)) return done;
+
+	/*
+	 *  Wait for completion signals.
+	 */
+
+	to.tv_sec = POSIX_SAFETY_TIMEOUT;
+	to.tv_nsec = 0;
+
+	done = posix_drain(eng, &to);
+
+	if (done != 0) return done;
+
+	if (errno == EINTR) return 0;
+
+	/*
+	 * Nothing has come in time, maybe some signals were lost.
+	 */
+	return posix_scan(eng);
+
+}
+
+static void posix_destroy(struct ioengine *eng) {
+
+	struct posixengine *pe = eng->priv;
+
+	free(pe->items);
+	free(pe);
+
+}
+
+const struct ioengineops ioengine_posix = {
+	.name = "posix",
+	.init = posix_init,
+	.queue = posix_queue,
+	.submit = posix_submit,
+	.reap = posix_reap,
+	.destroy = posix_destroy
+};
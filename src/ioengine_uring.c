@@ -0,0 +1,430 @@
+/*
+ ============================================================================
+ Name        : ioengine_uring.c
+ Author      : Nikita Staroverov
+ Version     : 1.0.0
+ Copyright   : GPLv2
+ Description : Asynchronous block copying tool, Linux io_uring engine
+ ============================================================================
+ */
+
+/*
+Copyright (C) 2014  Nikita Staroverov
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifdef HAVE_LIBURING
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <liburing.h>
+
+#include "ioengine.h"
+
+/*
+ * Requests are collected as SQEs during the main loop iteration and sent
+ * with one io_uring_submit() call, completions are reaped in batches.
+ */
+
+#define URING_REAP_BATCH 32
+
+/*
+ * Kernel limits every registered buffer to 1 GiB, bigger arena is registered in pieces.
+ */
+#define URING_MAXFIXEDBUF (1024 * 1024 * 1024)
+
+/*
+ * Input and all outputs, direct and buffered.
+ */
+#define URING_MAXFILES (2 * (1 + MAX_OUTPUTS))
+
+/*
+ * Kernel submission thread sleeps after that many milliseconds without requests.
+ */
+#define URING_SQPOLL_IDLE 100
+
+struct uringengine {
+
+	struct io_uring ring;
+
+	/*
+	 * Registered descriptors, requests refer to them by index.
+	 */
+	int fds[URING_MAXFILES];
+
+	int nfds;
+
+	/*
+	 * Registered buffers, the arena is cut into pieces of bufchunk bytes.
+	 */
+	char *arena;
+
+	size_t arenasize;
+
+	size_t bufchunk;
+
+	int nbufs;
+
+};
+
+/*
+ * Parameter sqpoll[=CPU] makes a kernel thread take requests from the ring, on the CPU if it's given.
+ */
+
+static int uring_params(struct io_uring_params *up, const char *params) {
+
+	char *end;
+
+	memset(up, 0, sizeof(struct io_uring_params));
+
+	if (params == NULL) return 0;
+
+	if (strncmp(params, "sqpoll", 6) != 0) {
+
+		errno = EINVAL;
+
+		return -1;
+
+	}
+
+	up->flags = IORING_SETUP_SQPOLL;
+	up->sq_thread_idle = URING_SQPOLL_IDLE;
+
+	params += 6;
+
+	if (*params == '\0') return 0;
+
+	errno = 0;
+
+	if (*params == '=') up->sq_thread_cpu = strtoul(params + 1, &end, 10);
+
+	if ((*params != '=') || (errno != 0) || (end == params + 1) || (*end != '\0')) {
+
+		errno = EINVAL;
+
+		return -1;
+
+	}
+
+	up->flags |= IORING_SETUP_SQ_AFF;
+
+	return 0;
+
+}
+
+static int uring_init(struct ioengine *eng) {
+
+	struct uringengine *ue;
+	struct io_uring_params up;
+	int ret;
+
+	if (uring_params(&up, eng->params) == -1) return -1;
+
+	ue = malloc(sizeof(struct uringengine));
+
+	if (ue == NULL) return -1;
+
+	memset(ue, 0, sizeof(struct uringengine));
+
+	ret = io_uring_queue_init_params(eng->depth, &ue->ring, &up);
+
+	if (ret < 0) {
+
+		free(ue);
+
+		errno = -ret;
+
+		return -1;
+
+	}
+
+	eng->priv = ue;
+
+	return 0;
+
+}
+
+/*
+ * Registration only saves per request work, so if the kernel refuses it
+ * (old kernel, RLIMIT_MEMLOCK) requests are sent the usual way.
+ */
+
+static int uring_setfiles(struct ioengine *eng, const int *fds, int nfds) {
+
+	struct uringengine *ue = eng->priv;
+	int ret;
+
+	if (nfds > URING_MAXFILES) return 0;
+
+	ret = io_uring_register_files(&ue->ring, fds, nfds);
+
+	if (ret < 0) {
+
+		#ifdef AIOBLKCOPY_DEBUG
+		fprintf(stderr, "ioengine: uring files aren't registered: %s\n", strerror(-ret));
+		#endif
+
+		return 0;
+
+	}
+
+	memcpy(ue->fds, fds, sizeof(int) * nfds);
+
+	ue->nfds = nfds;
+
+	return 0;
+
+}
+
+static int uring_setbuffers(struct ioengine *eng, char *arena, size_t size, size_t bufsize) {
+
+	struct uringengine *ue = eng->priv;
+	struct iovec *iov;
+	size_t chunk;
+	int count;
+	int i;
+	int ret;
+
+	/*
+	 * Pieces hold whole buffers, so every request lies inside one piece.
+	 */
+	chunk = URING_MAXFIXEDBUF / bufsize * bufsize;
+
+	if (chunk == 0) return 0;
+
+	count = (size + chunk - 1) / chunk;
+
+	iov = malloc(sizeof(struct iovec) * count);
+
+	if (iov == NULL) return -1;
+
+	for(i = 0; i < count; i++) {
+
+		iov[i].iov_base = arena + chunk * i;
+		iov[i].iov_len = ((size - chunk * i) < chunk) ? (size - chunk * i) : chunk;
+
+	}
+
+	ret = io_uring_register_buffers(&ue->ring, iov, count);
+
+	free(iov);
+
+	if (ret < 0) {
+
+		#ifdef AIOBLKCOPY_DEBUG
+		fprintf(stderr, "ioengine: uring buffers aren't registered: %s\n", strerror(-ret));
+		#endif
+
+		return 0;
+
+	}
+
+	ue->arena = arena;
+	ue->arenasize = size;
+	ue->bufchunk = chunk;
+	ue->nbufs = count;
+
+	#ifdef AIOBLKCOPY_DEBUG
+	fprintf(stderr, "ioengine: uring registered %i files, %i buffers\n", ue->nfds, ue->nbufs);
+	#endif
+
+	return 0;
+
+}
+
+static int uring_queue(struct ioengine *eng, struct blkqueitem *item, int direction) {
+
+	struct uringengine *ue = eng->priv;
+	struct io_uring_sqe *sqe;
+	int fd;
+	int i;
+	int ret;
+
+	sqe = io_uring_get_sqe(&ue->ring);
+
+	if (sqe == NULL) {
+
+		/*
+		 * Submission queue is full, flush it and try again.
+		 */
+		ret = io_uring_submit(&ue->ring);
+
+		if (ret < 0) {
+
+			errno = -ret;
+
+			return -1;
+
+		}
+
+		sqe = io_uring_get_sqe(&ue->ring);
+
+		if (sqe == NULL) {
+
+			errno = EAGAIN;
+
+			return -1;
+
+		}
+
+	}
+
+	fd = item->iofd;
+
+	for(i = 0; i < ue->nfds; i++) {
+
+		if (ue->fds[i] == item->iofd) {
+
+			fd = i;
+
+			break;
+
+		}
+
+	}
+
+	if (direction == IOENGINE_SYNC) {
+
+		io_uring_prep_fsync(sqe, fd, IORING_FSYNC_DATASYNC);
+
+	}
+	else if ((ue->nbufs != 0) && (item->iobuf >= ue->arena) && (item->iobuf < ue->arena + ue->arenasize)) {
+
+		if (direction == IOENGINE_READ) io_uring_prep_read_fixed(sqe, fd, item->iobuf, item->iolen, item->iooff, (item->iobuf - ue->arena) / ue->bufchunk);
+		else io_uring_prep_write_fixed(sqe, fd, item->iobuf, item->iolen, item->iooff, (item->iobuf - ue->arena) / ue->bufchunk);
+
+	}
+	else {
+
+		if (direction == IOENGINE_READ) io_uring_prep_read(sqe, fd, item->iobuf, item->iolen, item->iooff);
+		else io_uring_prep_write(sqe, fd, item->iobuf, item->iolen, item->iooff);
+
+	}
+
+	if (i < ue->nfds) io_uring_sqe_set_flags(sqe, IOSQE_FIXED_FILE);
+
+	io_uring_sqe_set_data(sqe, item);
+
+	return 0;
+
+}
+
+static int uring_submit(struct ioengine *eng) {
+
+	struct uringengine *ue = eng->priv;
+	int ret;
+
+	if (io_uring_sq_ready(&ue->ring) == 0) return 0;
+
+	ret = io_uring_submit(&ue->ring);
+
+	if (ret < 0) {
+
+		errno = -ret;
+
+		return -1;
+
+	}
+
+	return 0;
+
+}
+
+static int uring_reap(struct ioengine *eng, int wait) {
+
+	struct uringengine *ue = eng->priv;
+	struct io_uring_cqe *cqes[URING_REAP_BATCH];
+	struct io_uring_cqe *cqe;
+	struct blkqueitem *item;
+	unsigned int count;
+	unsigned int i;
+	int ret;
+
+	count = io_uring_peek_batch_cqe(&ue->ring, cqes, URING_REAP_BATCH);
+
+	if ((count == 0) && (wait != 0)) {
+
+		do {
+
+			ret = io_uring_wait_cqe(&ue->ring, &cqe);
+
+		} while (ret == -EINTR);
+
+		if (ret < 0) {
+
+			errno = -ret;
+
+			return -1;
+
+		}
+
+		count = io_uring_peek_batch_cqe(&ue->ring, cqes, URING_REAP_BATCH);
+
+	}
+
+	for(i = 0; i < count; i++) {
+
+		item = io_uring_cqe_get_data(cqes[i]);
+
+		if (cqes[i]->res < 0) {
+
+			item->retcode = -cqes[i]->res;
+			item->iores = -1;
+
+		}
+		else {
+
+			item->retcode = 0;
+			item->iores = cqes[i]->res;
+
+		}
+
+		ioengine_done(eng, item);
+
+	}
+
+	io_uring_cq_advance(&ue->ring, count);
+
+	return count;
+
+}
+
+static void uring_destroy(struct ioengine *eng) {
+
+	struct uringengine *ue = eng->priv;
+
+	io_uring_queue_exit(&ue->ring);
+
+	free(ue);
+
+}
+
+const struct ioengineops ioengine_uring = {
+	.name = "uring",
+	.takesparams = 1,
+	.init = uring_init,
+	.queue = uring_queue,
+	.submit = uring_submit,
+	.reap = uring_reap,
+	.destroy = uring_destroy,
+	.setfiles = uring_setfiles,
+	.setbuffers = uring_setbuffers
+};
+
+#endif
@@ -0,0 +1,130 @@
+/*
+ ============================================================================
+ Name        : jobsched.c
+ Author      : Nikita Staroverov
+ Version     : 1.0.0
+ Copyright   : GPLv2
+ Description : Asynchronous block copying tool, shared budget of batch jobs
+ ============================================================================
+ */
+
+/*
+Copyright (C) 2014  Nikita Staroverov
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+
+#include "jobsched.h"
+#include "stats.h"
+
+int sched_init(struct sched *sc, int budget) {
+
+	memset(sc, 0, sizeof(struct sched));
+
+	sc->budget = budget;
+	sc->share = budget;
+
+	if (pthread_mutex_init(&sc->lock, NULL) != 0) return -1;
+
+	return 0;
+
+}
+
+void sched_destroy(struct sched *sc) {
+
+	if (sc->pool != NULL) bufpool_destroy(sc->pool);
+
+	pthread_mutex_destroy(&sc->lock);
+
+}
+
+static void sched_reshare(struct sched *sc) {
+
+	int share = sc->budget;
+
+	if (sc->streams > 1) share = sc->budget / sc->streams;
+
+	if (share < 1) share = 1;
+
+	STATS_SET(sc->share, share);
+
+	#ifdef AIOBLKCOPY_DEBUG
+	fprintf(stderr, "sched: streams: %i share: %i of %i buffers\n", sc->streams, share, sc->budget);
+	#endif
+
+}
+
+/*
+ * Stream starts copying, returns the pool of data buffers or NULL on error.
+ * Buffers of the pool must be big enough and have the same headroom.
+ */
+
+struct bufpool *sched_join(struct sched *sc, size_t bufsize, size_t headroom, int flags, int node) {
+
+	struct bufpool *pool;
+
+	pthread_mutex_lock(&sc->lock);
+
+	if (sc->pool == NULL) sc->pool = bufpool_create(sc->budget, bufsize, headroom, flags | BUFPOOL_SHARED, node);
+
+	pool = sc->pool;
+
+	if ((pool != NULL) && ((pool->bufsize < bufsize) || (pool->headroom != headroom))) {
+
+		pool = NULL;
+
+		errno = EINVAL;
+
+	}
+
+	if (pool != NULL) {
+
+		sc->streams++ ;
+
+		sched_reshare(sc);
+
+	}
+
+	pthread_mutex_unlock(&sc->lock);
+
+	return pool;
+
+}
+
+void sched_leave(struct sched *sc) {
+
+	pthread_mutex_lock(&sc->lock);
+
+	sc->streams-- ;
+
+	sched_reshare(sc);
+
+	pthread_mutex_unlock(&sc->lock);
+
+}
+
+/*
+ * Buffers a stream may hold now.
+ */
+
+int sched_share(struct sched *sc) {
+
+	return STATS_GET(sc->share);
+
+}
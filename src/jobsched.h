@@ -0,0 +1,83 @@
+/*
+ ============================================================================
+ Name        : jobsched.h
+ Author      : Nikita Staroverov
+ Version     : 1.0.0
+ Copyright   : GPLv2
+ Description : Asynchronous block copying tool, shared budget of batch jobs
+ ============================================================================
+ */
+
+/*
+Copyright (C) 2014  Nikita Staroverov
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef AIOBLKCOPY_JOBSCHED_H
+#define AIOBLKCOPY_JOBSCHED_H
+
+#include <sys/types.h>
+#include <pthread.h>
+
+#include "bufpool.h"
+
+/*
+ * Stream which can't get a data buffer sleeps that long before it tries again.
+ */
+#define SCHED_WAIT_NS 1000000LL
+
+/*
+ * Budget shared by jobs copying at the same time.
+ * Data buffers of all their streams come from one pool, so blocks read but not written yet are limited
+ * over all jobs by its size. Every stream may hold an equal share of the pool. The share grows when streams end,
+ * so jobs left at the end of a batch get the whole budget.
+ */
+
+struct sched {
+
+	pthread_mutex_t lock;
+
+	/*
+	 * Buffers of the pool.
+	 */
+	int budget;
+
+	/*
+	 * Streams copying now and buffers every one of them may hold, the share is read without lock.
+	 */
+	int streams;
+
+	int share;
+
+	/*
+	 * Created by the first stream, the batch gives all its jobs the same block size. Kept until the end,
+	 * so jobs don't map and fault the memory again. It's placed on the NUMA node of the first stream.
+	 */
+	struct bufpool *pool;
+
+};
+
+int sched_init(struct sched *sc, int budget);
+
+void sched_destroy(struct sched *sc);
+
+struct bufpool *sched_join(struct sched *sc, size_t bufsize, size_t headroom, int flags, int node);
+
+void sched_leave(struct sched *sc);
+
+int sched_share(struct sched *sc);
+
+#endif
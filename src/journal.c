@@ -0,0 +1,366 @@
+/*
+ ============================================================================
+ Name        : journal.c
+ Author      : Nikita Staroverov
+ Version     : 1.0.0
+ Copyright   : GPLv2
+ Description : Asynchronous block copying tool, copy progress journal
+ ============================================================================
+ */
+
+/*
+Copyright (C) 2014  Nikita Staroverov
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "journal.h"
+
+#define JOURNAL_MAGIC "aioblkcopy journal 1"
+
+/*
+ * Journal with NULL path is disabled, all calls do nothing.
+ */
+
+int journal_init(struct journal *jr, const char *path, off_t size, long long now) {
+
+	memset(jr, 0, sizeof(struct journal));
+
+	jr->path = path;
+	jr->size = size;
+	jr->lastcommit = now;
+
+	if (path == NULL) return 0;
+
+	if (pthread_mutex_init(&jr->lock, NULL) != 0) return -1;
+
+	/*
+	 * New journal is written beside and renamed, so the old one stays valid until then.
+	 */
+	jr->tmppath = malloc(strlen(path) + 5);
+
+	if (jr->tmppath == NULL) return -1;
+
+	sprintf(jr->tmppath, "%s.tmp", path);
+
+	return 0;
+
+}
+
+void journal_destroy(struct journal *jr) {
+
+	if (jr->path == NULL) return;
+
+	pthread_mutex_destroy(&jr->lock);
+
+	free(jr->tmppath);
+	free(jr->ranges);
+	free(jr->snapranges);
+
+	jr->tmppath = NULL;
+	jr->ranges = NULL;
+	jr->snapranges = NULL;
+
+}
+
+/*
+ * Records a written range. Ranges are merged, the contiguous part is moved forward.
+ */
+
+static int journal_add(struct journal *jr, off_t off, off_t len) {
+
+	struct journalrange *newranges;
+	off_t end = off + len;
+	int i;
+	int j;
+
+	jr->dirty = 1;
+
+	if (end <= jr->done) return 0;
+
+	if (off < jr->done) off = jr->done;
+
+	/*
+	 * Position of the first range which ends at off or later.
+	 */
+	for(i = 0; (i < jr->nranges) && (jr->ranges[i].end < off); i++);
+
+	/*
+	 * Ranges touching the new one are swallowed by it.
+	 */
+	for(j = i; (j < jr->nranges) && (jr->ranges[j].start <= end); j++) {
+
+		if (jr->ranges[j].start < off) off = jr->ranges[j].start;
+		if (jr->ranges[j].end > end) end = jr->ranges[j].end;
+
+	}
+
+	if (j == i) {
+
+		if (jr->nranges == jr->maxranges) {
+
+			newranges = realloc(jr->ranges, sizeof(struct journalrange) * (jr->maxranges * 2 + 16));
+
+			if (newranges == NULL) return -1;
+
+			jr->ranges = newranges;
+			jr->maxranges = jr->maxranges * 2 + 16;
+
+		}
+
+		memmove(&jr->ranges[i + 1], &jr->ranges[i], sizeof(struct journalrange) * (jr->nranges - i));
+
+		jr->nranges++ ;
+
+	}
+	else if (j > i + 1) {
+
+		memmove(&jr->ranges[i + 1], &jr->ranges[j], sizeof(struct journalrange) * (jr->nranges - j));
+
+		jr->nranges -= j - i - 1;
+
+	}
+
+	jr->ranges[i].start = off;
+	jr->ranges[i].end = end;
+
+	if ((i == 0) && (off == jr->done)) {
+
+		jr->done = end;
+
+		memmove(&jr->ranges[0], &jr->ranges[1], sizeof(struct journalrange) * (jr->nranges - 1));
+
+		jr->nranges-- ;
+
+	}
+
+	return 0;
+
+}
+
+/*
+ * Returns -1 with errno EINVAL if journal is damaged or made for input of other size.
+ */
+
+int journal_load(struct journal *jr) {
+
+	FILE *f;
+	char magic[sizeof(JOURNAL_MAGIC)];
+	long long size;
+	long long done;
+	long long start;
+	long long end;
+	int ret = 0;
+
+	f = fopen(jr->path, "r");
+
+	if (f == NULL) return -1;
+
+	if ((fgets(magic, sizeof(magic), f) == NULL) || (strcmp(magic, JOURNAL_MAGIC) != 0) || \
+			(fscanf(f, " size %lld done %lld", &size, &done) != 2) || (size != jr->size) || (done < 0)) {
+
+		fclose(f);
+
+		errno = EINVAL;
+
+		return -1;
+
+	}
+
+	jr->done = done;
+
+	while(fscanf(f, " range %lld %lld", &start, &end) == 2) {
+
+		if ((start < 0) || (end < start)) {
+
+			errno = EINVAL;
+
+			ret = -1;
+
+			break;
+
+		}
+
+		if (journal_add(jr, start, end - start) == -1) {
+
+			ret = -1;
+
+			break;
+
+		}
+
+	}
+
+	fclose(f);
+
+	jr->dirty = 0;
+
+	return ret;
+
+}
+
+int journal_done(struct journal *jr, off_t off, off_t len) {
+
+	int ret;
+
+	if ((jr->path == NULL) || (len == 0)) return 0;
+
+	pthread_mutex_lock(&jr->lock);
+
+	ret = journal_add(jr, off - jr->shift, len);
+
+	pthread_mutex_unlock(&jr->lock);
+
+	return ret;
+
+}
+
+/*
+ * Returns the first offset starting from off which isn't written yet.
+ */
+
+off_t journal_nextmissing(struct journal *jr, off_t off) {
+
+	int i;
+
+	if (jr->path == NULL) return off;
+
+	pthread_mutex_lock(&jr->lock);
+
+	if (off < jr->done) off = jr->done;
+
+	for(i = 0; i < jr->nranges; i++) {
+
+		if ((off >= jr->ranges[i].start) && (off < jr->ranges[i].end)) off = jr->ranges[i].end;
+
+	}
+
+	pthread_mutex_unlock(&jr->lock);
+
+	return off;
+
+}
+
+/*
+ * Writes the taken state to a new file and renames it over the journal.
+ */
+
+static int journal_write(struct journal *jr, off_t done, int nranges) {
+
+	FILE *f;
+	int i;
+
+	f = fopen(jr->tmppath, "w");
+
+	if (f == NULL) return -1;
+
+	fprintf(f, "%s\nsize %lld\ndone %lld\n", JOURNAL_MAGIC, (long long)jr->size, (long long)done);
+
+	for(i = 0; i < nranges; i++) fprintf(f, "range %lld %lld\n", (long long)jr->snapranges[i].start, (long long)jr->snapranges[i].end);
+
+	if ((fflush(f) == EOF) || (fdatasync(fileno(f)) == -1)) {
+
+		fclose(f);
+
+		return -1;
+
+	}
+
+	if (fclose(f) == EOF) return -1;
+
+	if (rename(jr->tmppath, jr->path) == -1) return -1;
+
+	#ifdef AIOBLKCOPY_DEBUG
+	fprintf(stderr, "JOURNAL COMMIT done: %lld ranges: %i\n", (long long)done, nranges);
+	#endif
+
+	return 0;
+
+}
+
+/*
+ * Writes the journal if something has changed and the interval is over, or always if force isn't zero.
+ * Recorded state is taken before syncfd is synced, so the journal never claims writes which aren't durable.
+ * Only one stream commits at a time, the others go on copying.
+ */
+
+int journal_commit(struct journal *jr, int syncfd, long long now, int force) {
+
+	struct journalrange *newranges;
+	off_t done;
+	int nranges;
+	int ret;
+
+	if (jr->path == NULL) return 0;
+
+	pthread_mutex_lock(&jr->lock);
+
+	if ((jr->dirty == 0) || (jr->committing == 1) || ((force == 0) && (now - jr->lastcommit < JOURNAL_INTERVAL_NS))) {
+
+		pthread_mutex_unlock(&jr->lock);
+
+		return 0;
+
+	}
+
+	if (jr->nranges > jr->maxsnapranges) {
+
+		newranges = realloc(jr->snapranges, sizeof(struct journalrange) * jr->maxranges);
+
+		if (newranges == NULL) {
+
+			pthread_mutex_unlock(&jr->lock);
+
+			return -1;
+
+		}
+
+		jr->snapranges = newranges;
+		jr->maxsnapranges = jr->maxranges;
+
+	}
+
+	memcpy(jr->snapranges, jr->ranges, sizeof(struct journalrange) * jr->nranges);
+
+	done = jr->done;
+	nranges = jr->nranges;
+
+	jr->lastcommit = now;
+	jr->dirty = 0;
+	jr->committing = 1;
+
+	pthread_mutex_unlock(&jr->lock);
+
+	ret = fdatasync(syncfd);
+
+	if (ret == 0) ret = journal_write(jr, done, nranges);
+
+	pthread_mutex_lock(&jr->lock);
+
+	jr->committing = 0;
+
+	if (ret == -1) jr->dirty = 1;
+
+	pthread_mutex_unlock(&jr->lock);
+
+	return ret;
+
+}
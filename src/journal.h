@@ -0,0 +1,117 @@
+/*
+ ============================================================================
+ Name        : journal.h
+ Author      : Nikita Staroverov
+ Version     : 1.0.0
+ Copyright   : GPLv2
+ Description : Asynchronous block copying tool, copy progress journal
+ ============================================================================
+ */
+
+/*
+Copyright (C) 2014  Nikita Staroverov
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef AIOBLKCOPY_JOURNAL_H
+#define AIOBLKCOPY_JOURNAL_H
+
+#include <sys/types.h>
+#include <pthread.h>
+
+/*
+ * Journal is written to disk not more often than that, output is synced before.
+ */
+#define JOURNAL_INTERVAL_NS 5000000000LL
+
+/*
+ * Completed range of output beyond the contiguous part.
+ */
+
+struct journalrange {
+
+	off_t start;
+
+	off_t end;
+
+};
+
+/*
+ * Copy progress: everything below done is written, ranges above it are written out of order.
+ * Ranges are sorted and never adjacent, their number is bounded by requests in flight.
+ * All calls are serialized by the lock, the journal is shared by copy streams.
+ */
+
+struct journal {
+
+	/*
+	 * Journal file, NULL if journal is disabled.
+	 */
+	const char *path;
+
+	char *tmppath;
+
+	/*
+	 * Input size, journal of other input isn't accepted.
+	 */
+	off_t size;
+
+	/*
+	 * Output offset minus input offset, ranges are recorded by input offsets.
+	 */
+	off_t shift;
+
+	off_t done;
+
+	struct journalrange *ranges;
+
+	int nranges;
+
+	int maxranges;
+
+	/*
+	 * Completions recorded since the last commit.
+	 */
+	int dirty;
+
+	long long lastcommit;
+
+	/*
+	 * State being written by commit, taken before output is synced.
+	 */
+	struct journalrange *snapranges;
+
+	int maxsnapranges;
+
+	int committing;
+
+	pthread_mutex_t lock;
+
+};
+
+int journal_init(struct journal *jr, const char *path, off_t size, long long now);
+
+int journal_load(struct journal *jr);
+
+int journal_done(struct journal *jr, off_t off, off_t len);
+
+off_t journal_nextmissing(struct journal *jr, off_t off);
+
+int journal_commit(struct journal *jr, int syncfd, long long now, int force);
+
+void journal_destroy(struct journal *jr);
+
+#endif
@@ -0,0 +1,396 @@
+/*
+ ============================================================================
+ Name        : net.c
+ Author      : Nikita Staroverov
+ Version     : 1.0.0
+ Copyright   : GPLv2
+ Description : Asynchronous block copying tool, blocks transport over TCP
+ ============================================================================
+ */
+
+/*
+Copyright (C) 2014  Nikita Staroverov
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <endian.h>
+#include <netdb.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#include "net.h"
+
+void net_putheader(char *buf, uint64_t off, uint32_t len, uint32_t wirelen, uint64_t hash) {
+
+	off = htobe64(off);
+	len = htobe32(len);
+	wirelen = htobe32(wirelen);
+	hash = htobe64(hash);
+
+	memcpy(buf, &off, sizeof(uint64_t));
+	memcpy(buf + 8, &len, sizeof(uint32_t));
+	memcpy(buf + 12, &wirelen, sizeof(uint32_t));
+	memcpy(buf + 16, &hash, sizeof(uint64_t));
+
+}
+
+void net_getheader(const char *buf, uint64_t *off, uint32_t *len, uint32_t *wirelen, uint64_t *hash) {
+
+	memcpy(off, buf, sizeof(uint64_t));
+	memcpy(len, buf + 8, sizeof(uint32_t));
+	memcpy(wirelen, buf + 12, sizeof(uint32_t));
+	memcpy(hash, buf + 16, sizeof(uint64_t));
+
+	*off = be64toh(*off);
+	*len = be32toh(*len);
+	*wirelen = be32toh(*wirelen);
+	*hash = be64toh(*hash);
+
+}
+
+/*
+ * Blocking transfer of a whole header.
+ */
+
+static int net_sendall(int fd, const char *buf, size_t len) {
+
+	ssize_t ret;
+
+	while(len != 0) {
+
+		ret = send(fd, buf, len, MSG_NOSIGNAL);
+
+		if (ret == -1) {
+
+			if (errno == EINTR) continue;
+
+			return -1;
+
+		}
+
+		buf += ret;
+		len -= ret;
+
+	}
+
+	return 0;
+
+}
+
+static int net_recvall(int fd, char *buf, size_t len) {
+
+	ssize_t ret;
+
+	while(len != 0) {
+
+		ret = recv(fd, buf, len, 0);
+
+		if (ret == -1) {
+
+			if (errno == EINTR) continue;
+
+			return -1;
+
+		}
+
+		if (ret == 0) {
+
+			errno = ECONNRESET;
+
+			return -1;
+
+		}
+
+		buf += ret;
+		len -= ret;
+
+	}
+
+	return 0;
+
+}
+
+/*
+ * Splits HOST:PORT, [HOST]:PORT or PORT and resolves it. Empty host means any address for listening.
+ */
+
+static struct addrinfo *net_resolve(const char *addr, int passive) {
+
+	struct addrinfo hints;
+	struct addrinfo *res;
+	char *str;
+	char *host;
+	char *port;
+	int ret;
+
+	str = strdup(addr);
+
+	if (str == NULL) return NULL;
+
+	port = strrchr(str, ':');
+
+	if (port == NULL) {
+
+		port = str;
+		host = NULL;
+
+	}
+	else {
+
+		*port++ = '\0';
+
+		host = str;
+
+		if ((host[0] == '[') && (port - host >= 3) && (port[-2] == ']')) {
+
+			port[-2] = '\0';
+			host++ ;
+
+		}
+
+		if (host[0] == '\0') host = NULL;
+
+	}
+
+	memset(&hints, 0, sizeof(struct addrinfo));
+
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = passive ? AI_PASSIVE : 0;
+
+	ret = getaddrinfo(host, port, &hints, &res);
+
+	free(str);
+
+	if (ret != 0) {
+
+		fprintf(stderr, "Can't resolve %s: %s\n", addr, gai_strerror(ret));
+
+		errno = EINVAL;
+
+		return NULL;
+
+	}
+
+	return res;
+
+}
+
+/*
+ * Closes connections opened before an error, errno of the error is kept.
+ */
+
+static void net_closeall(int *fds, int count) {
+
+	int err = errno;
+	int i;
+
+	for(i = 0; i < count; i++) {
+
+		close(fds[i]);
+
+		fds[i] = -1;
+
+	}
+
+	errno = err;
+
+}
+
+/*
+ * Opens count connections and sends hello on each of them.
+ */
+
+int net_connect(const char *addr, int count, int features, int *fds) {
+
+	struct addrinfo *res;
+	struct addrinfo *ai;
+	char hdr[NET_HDRSIZE];
+	int i;
+
+	res = net_resolve(addr, 0);
+
+	if (res == NULL) return -1;
+
+	for(i = 0; i < count; i++) {
+
+		fds[i] = -1;
+
+		for(ai = res; ai != NULL; ai = ai->ai_next) {
+
+			fds[i] = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+
+			if (fds[i] == -1) continue;
+
+			if (connect(fds[i], ai->ai_addr, ai->ai_addrlen) == 0) break;
+
+			close(fds[i]);
+
+			fds[i] = -1;
+
+		}
+
+		if (fds[i] == -1) {
+
+			net_closeall(fds, i);
+
+			freeaddrinfo(res);
+
+			return -1;
+
+		}
+
+		net_putheader(hdr, NET_MAGIC, count, features, 0);
+
+		if (net_sendall(fds[i], hdr, NET_HDRSIZE) == -1) {
+
+			net_closeall(fds, i + 1);
+
+			freeaddrinfo(res);
+
+			return -1;
+
+		}
+
+	}
+
+	freeaddrinfo(res);
+
+	return 0;
+
+}
+
+/*
+ * Waits for all connections of one sender, their number and features come with the first hello.
+ * Returns number of connections.
+ */
+
+int net_listen(const char *addr, int *fds, int *features) {
+
+	struct addrinfo *res;
+	char hdr[NET_HDRSIZE];
+	uint64_t magic;
+	uint32_t n;
+	uint32_t m;
+	uint32_t count;
+	uint64_t hash;
+	int lfd;
+	int on = 1;
+	int i;
+
+	res = net_resolve(addr, 1);
+
+	if (res == NULL) return -1;
+
+	lfd = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+
+	if ((lfd == -1) || (setsockopt(lfd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) == -1) || \
+			(bind(lfd, res->ai_addr, res->ai_addrlen) == -1) || (listen(lfd, NET_MAXCONNECTIONS) == -1)) {
+
+		if (lfd != -1) net_closeall(&lfd, 1);
+
+		freeaddrinfo(res);
+
+		return -1;
+
+	}
+
+	freeaddrinfo(res);
+
+	count = 1;
+
+	for(i = 0; (uint32_t)i < count; i++) {
+
+		fds[i] = accept(lfd, NULL, NULL);
+
+		if (fds[i] == -1) {
+
+			if (errno == EINTR) {
+
+				i-- ;
+
+				continue;
+
+			}
+
+			net_closeall(fds, i);
+
+			net_closeall(&lfd, 1);
+
+			return -1;
+
+		}
+
+		if (net_recvall(fds[i], hdr, NET_HDRSIZE) == -1) {
+
+			net_closeall(fds, i + 1);
+
+			net_closeall(&lfd, 1);
+
+			return -1;
+
+		}
+
+		net_getheader(hdr, &magic, &n, &m, &hash);
+
+		if (i == 0) {
+
+			count = n;
+
+			*features = m;
+
+		}
+
+		if ((magic != NET_MAGIC) || (n != count) || ((int)m != *features) || (count < 1) || (count > NET_MAXCONNECTIONS)) {
+
+			errno = EPROTO;
+
+			net_closeall(fds, i + 1);
+
+			net_closeall(&lfd, 1);
+
+			return -1;
+
+		}
+
+	}
+
+	close(lfd);
+
+	return count;
+
+}
+
+/*
+ * Sends trailer and closes sending side of the connection.
+ */
+
+int net_finish(int fd, uint64_t sent) {
+
+	char hdr[NET_HDRSIZE];
+
+	net_putheader(hdr, sent, 0, 0, 0);
+
+	if (net_sendall(fd, hdr, NET_HDRSIZE) == -1) return -1;
+
+	return shutdown(fd, SHUT_WR);
+
+}
@@ -0,0 +1,67 @@
+/*
+ ============================================================================
+ Name        : net.h
+ Author      : Nikita Staroverov
+ Version     : 1.0.0
+ Copyright   : GPLv2
+ Description : Asynchronous block copying tool, blocks transport over TCP
+ ============================================================================
+ */
+
+/*
+Copyright (C) 2014  Nikita Staroverov
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef AIOBLKCOPY_NET_H
+#define AIOBLKCOPY_NET_H
+
+#include <stdint.h>
+
+/*
+ * Every block is sent with a big endian header: 64 bit output offset, 32 bit block length,
+ * 32 bit length of data following the header, it is less than block length if the block is compressed,
+ * and 64 bit hash of the block, 0 if sender doesn't verify.
+ * Connection starts with hello header (NET_MAGIC, number of connections, features, 0) and ends with
+ * trailer header (number of data bytes sent, 0, 0, 0).
+ */
+#define NET_HDRSIZE 24
+#define NET_MAGIC 0x6169626c6b6e6574ULL
+
+/*
+ * Features of hello: compression method and hashing of blocks.
+ */
+#define NET_HELLO_METHOD 0xff
+#define NET_HELLO_VERIFY 0x100
+
+/*
+ * Space before every data buffer for the header, keeps buffers aligned for O_DIRECT.
+ */
+#define NET_HEADROOM 4096
+
+#define NET_MAXCONNECTIONS 16
+
+void net_putheader(char *buf, uint64_t off, uint32_t len, uint32_t wirelen, uint64_t hash);
+
+void net_getheader(const char *buf, uint64_t *off, uint32_t *len, uint32_t *wirelen, uint64_t *hash);
+
+int net_connect(const char *addr, int count, int features, int *fds);
+
+int net_listen(const char *addr, int *fds, int *features);
+
+int net_finish(int fd, uint64_t sent);
+
+#endif
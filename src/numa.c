@@ -0,0 +1,240 @@
+/*
+ ============================================================================
+ Name        : numa.c
+ Author      : Nikita Staroverov
+ Version     : 1.0.0
+ Copyright   : GPLv2
+ Description : Asynchronous block copying tool, NUMA placement of buffers and threads
+ ============================================================================
+ */
+
+/*
+Copyright (C) 2014  Nikita Staroverov
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/sysmacros.h>
+#include <linux/mempolicy.h>
+
+#include "numa.h"
+
+/*
+ * Returns the number in the sysfs file, -1 if there is none.
+ */
+
+static int numa_readint(const char *path) {
+
+	FILE *f;
+	int val;
+
+	f = fopen(path, "r");
+
+	if (f == NULL) return -1;
+
+	if (fscanf(f, "%i", &val) != 1) val = -1;
+
+	fclose(f);
+
+	return val;
+
+}
+
+/*
+ * The node is a property of the bus device (PCI function of HBA or NVMe controller), it's found
+ * going up from the block device. Stacked devices (device-mapper, md) have no bus device,
+ * the node of their first slave is taken.
+ */
+
+static int numa_sysnode(const char *syspath, int depth) {
+
+	char path[PATH_MAX];
+	char file[PATH_MAX + 16];
+	struct dirent *de;
+	char *slash;
+	DIR *dir;
+	int node = -1;
+
+	if (realpath(syspath, path) == NULL) return -1;
+
+	snprintf(file, sizeof(file), "%s/slaves", path);
+
+	dir = opendir(file);
+
+	if (dir != NULL) {
+
+		while((node == -1) && (depth < NUMA_MAXSTACK) && ((de = readdir(dir)) != NULL)) {
+
+			if (de->d_name[0] == '.') continue;
+
+			snprintf(file, sizeof(file), "/sys/class/block/%s", de->d_name);
+
+			node = numa_sysnode(file, depth + 1);
+
+		}
+
+		closedir(dir);
+
+		if (node != -1) return node;
+
+	}
+
+	for(;;) {
+
+		snprintf(file, sizeof(file), "%s/numa_node", path);
+
+		node = numa_readint(file);
+
+		if (node >= 0) return node;
+
+		slash = strrchr(path, '/');
+
+		if ((slash == NULL) || (slash == path) || (strcmp(path, "/sys/devices") == 0)) break;
+
+		*slash = '\0';
+
+	}
+
+	return -1;
+
+}
+
+/*
+ * Node of the device behind the descriptor: the block device itself or the one holding the file system
+ * of a regular file. Returns -1 if it isn't known.
+ */
+
+int numa_devnode(int fd) {
+
+	char path[64];
+	struct stat statdata;
+	dev_t dev;
+
+	if (fstat(fd, &statdata) == -1) return -1;
+
+	if (S_ISBLK(statdata.st_mode)) dev = statdata.st_rdev;
+	else if (S_ISREG(statdata.st_mode)) dev = statdata.st_dev;
+	else return -1;
+
+	snprintf(path, sizeof(path), "/sys/dev/block/%u:%u", major(dev), minor(dev));
+
+	return numa_sysnode(path, 0);
+
+}
+
+/*
+ * CPUs of the node from its cpulist, returns -1 with errno ENOENT if it has none.
+ */
+
+int numa_nodecpus(int node, cpu_set_t *set) {
+
+	char path[64];
+	char line[4096];
+	char *str;
+	char *end;
+	long first;
+	long last;
+	FILE *f;
+
+	CPU_ZERO(set);
+
+	snprintf(path, sizeof(path), "/sys/devices/system/node/node%i/cpulist", node);
+
+	f = fopen(path, "r");
+
+	if (f == NULL) {
+
+		errno = ENOENT;
+
+		return -1;
+
+	}
+
+	if (fgets(line, sizeof(line), f) == NULL) line[0] = '\0';
+
+	fclose(f);
+
+	/*
+	 * List of ranges like 0-3,8-11.
+	 */
+
+	for(str = line; (*str >= '0') && (*str <= '9'); str = end + (*end == ',')) {
+
+		first = strtol(str, &end, 10);
+		last = first;
+
+		if (*end == '-') last = strtol(end + 1, &end, 10);
+
+		for(; (first <= last) && (first < CPU_SETSIZE); first++) CPU_SET(first, set);
+
+	}
+
+	if (CPU_COUNT(set) == 0) {
+
+		errno = ENOENT;
+
+		return -1;
+
+	}
+
+	return 0;
+
+}
+
+/*
+ * Pages of the range not faulted in yet are taken from the node, from other nodes if it has no free memory.
+ */
+
+int numa_bind(void *addr, size_t len, int node) {
+
+	unsigned long mask[NUMA_MAXNODES / (8 * sizeof(unsigned long))];
+
+	if ((node < 0) || (node >= NUMA_MAXNODES)) {
+
+		errno = EINVAL;
+
+		return -1;
+
+	}
+
+	memset(mask, 0, sizeof(mask));
+
+	mask[node / (8 * sizeof(unsigned long))] |= 1UL << (node % (8 * sizeof(unsigned long)));
+
+	#ifdef SYS_mbind
+
+	/*
+	 * Kernel takes one bit less than maxnode.
+	 */
+	return syscall(SYS_mbind, addr, len, MPOL_PREFERRED, mask, NUMA_MAXNODES + 1, 0);
+
+	#else
+
+	errno = ENOSYS;
+
+	return -1;
+
+	#endif
+
+}
@@ -0,0 +1,64 @@
+/*
+ ============================================================================
+ Name        : numa.h
+ Author      : Nikita Staroverov
+ Version     : 1.0.0
+ Copyright   : GPLv2
+ Description : Asynchronous block copying tool, NUMA placement of buffers and threads
+ ============================================================================
+ */
+
+/*
+Copyright (C) 2014  Nikita Staroverov
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef AIOBLKCOPY_NUMA_H
+#define AIOBLKCOPY_NUMA_H
+
+#include <sched.h>
+#include <sys/types.h>
+
+/*
+ * Node of --numa: not placed, or the node of input device (output device if input has none), or the node given.
+ */
+#define NUMA_NONE -1
+#define NUMA_AUTO -2
+
+/*
+ * CPU of --sqpoll: no kernel submission thread, or a thread on a CPU taken from the node or anywhere without
+ * --numa, or the CPU given.
+ */
+#define NUMA_CPU_NONE -1
+#define NUMA_CPU_AUTO -2
+
+/*
+ * Nodes the memory policy mask can name.
+ */
+#define NUMA_MAXNODES 1024
+
+/*
+ * Device of a stacked device is looked for that deep in its slaves.
+ */
+#define NUMA_MAXSTACK 4
+
+int numa_devnode(int fd);
+
+int numa_nodecpus(int node, cpu_set_t *set);
+
+int numa_bind(void *addr, size_t len, int node);
+
+#endif
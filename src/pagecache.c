@@ -0,0 +1,192 @@
+/*
+ ============================================================================
+ Name        : pagecache.c
+ Author      : Nikita Staroverov
+ Version     : 1.0.0
+ Copyright   : GPLv2
+ Description : Asynchronous block copying tool, page cache hints of buffered files
+ ============================================================================
+ */
+
+/*
+Copyright (C) 2014  Nikita Staroverov
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <fcntl.h>
+
+#include "pagecache.h"
+
+/*
+ * posix_fadvise() returns the error instead of setting errno.
+ */
+
+static int pagecache_advise(int fd, off_t off, off_t len, int advice) {
+
+	int ret;
+
+	ret = posix_fadvise(fd, off, len, advice);
+
+	if (ret != 0) {
+
+		errno = ret;
+
+		return -1;
+
+	}
+
+	return 0;
+
+}
+
+/*
+ * Input is marked sequential, so the kernel reads ahead more. fd of -1 turns hints off.
+ */
+
+int pagecache_init(struct pagecache *pc, int fd, int input, size_t window) {
+
+	memset(pc, 0, sizeof(struct pagecache));
+
+	pc->fd = fd;
+	pc->window = window;
+
+	if ((fd == -1) || (input == 0)) return 0;
+
+	return pagecache_advise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+}
+
+/*
+ * Called with the end of every read queued. Readahead is asked for the next window when half of the last one is used.
+ */
+
+int pagecache_ahead(struct pagecache *pc, off_t off) {
+
+	off_t start;
+
+	if ((pc->fd == -1) || (off + (off_t)pc->window / 2 < pc->raend)) return 0;
+
+	start = (off > pc->raend) ? off : pc->raend;
+
+	pc->raend = off + pc->window;
+
+	return pagecache_advise(pc->fd, start, pc->raend - start, POSIX_FADV_WILLNEED);
+
+}
+
+/*
+ * Pages read are clean, they are dropped at once. Only pages lying wholly in the range are dropped.
+ */
+
+int pagecache_read(struct pagecache *pc, off_t off, off_t len) {
+
+	if ((pc->fd == -1) || (len == 0)) return 0;
+
+	return pagecache_advise(pc->fd, off, len, POSIX_FADV_DONTNEED);
+
+}
+
+/*
+ * Waits for writeback of the oldest range and drops its pages.
+ */
+
+static int pagecache_drop(struct pagecache *pc) {
+
+	struct pagerange *pr = &pc->ranges[pc->first];
+
+	#ifdef _GNU_SOURCE
+
+	if (sync_file_range(pc->fd, pr->start, pr->len, SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER) == -1) return -1;
+
+	#endif
+
+	pc->first = (pc->first + 1) % PAGECACHE_RANGES;
+	pc->count-- ;
+	pc->pending -= pr->len;
+
+	return pagecache_advise(pc->fd, pr->start, pr->len, POSIX_FADV_DONTNEED);
+
+}
+
+/*
+ * Writeback of the range written is started at once. Ranges older than the window are waited for
+ * and dropped, by then their writeback is mostly done. A range grows up to a quarter of the window,
+ * so sequential writes are dropped in several steps.
+ */
+
+int pagecache_written(struct pagecache *pc, off_t off, off_t len) {
+
+	struct pagerange *pr;
+
+	if ((pc->fd == -1) || (len == 0)) return 0;
+
+	#ifdef _GNU_SOURCE
+
+	if (sync_file_range(pc->fd, off, len, SYNC_FILE_RANGE_WRITE) == -1) return -1;
+
+	#endif
+
+	pr = &pc->ranges[(pc->first + pc->count + PAGECACHE_RANGES - 1) % PAGECACHE_RANGES];
+
+	if ((pc->count != 0) && (pr->start + pr->len == off) && (pr->len < (off_t)pc->window / 4)) {
+
+		pr->len += len;
+
+	}
+	else {
+
+		if ((pc->count == PAGECACHE_RANGES) && (pagecache_drop(pc) == -1)) return -1;
+
+		pr = &pc->ranges[(pc->first + pc->count) % PAGECACHE_RANGES];
+
+		pr->start = off;
+		pr->len = len;
+
+		pc->count++ ;
+
+	}
+
+	pc->pending += len;
+
+	while((pc->count > 1) && (pc->pending - pc->ranges[pc->first].len >= (off_t)pc->window)) {
+
+		if (pagecache_drop(pc) == -1) return -1;
+
+	}
+
+	return 0;
+
+}
+
+/*
+ * Drops all output ranges left at the end of the copy.
+ */
+
+int pagecache_flush(struct pagecache *pc) {
+
+	while((pc->fd != -1) && (pc->count != 0)) {
+
+		if (pagecache_drop(pc) == -1) return -1;
+
+	}
+
+	return 0;
+
+}
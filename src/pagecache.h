@@ -0,0 +1,95 @@
+/*
+ ============================================================================
+ Name        : pagecache.h
+ Author      : Nikita Staroverov
+ Version     : 1.0.0
+ Copyright   : GPLv2
+ Description : Asynchronous block copying tool, page cache hints of buffered files
+ ============================================================================
+ */
+
+/*
+Copyright (C) 2014  Nikita Staroverov
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef AIOBLKCOPY_PAGECACHE_H
+#define AIOBLKCOPY_PAGECACHE_H
+
+#include <sys/types.h>
+
+/*
+ * Input is read ahead that far from the read cursor, output pages are dropped when writeback of that much
+ * newer data is started.
+ */
+#define PAGECACHE_WINDOW (16 * 1024 * 1024)
+
+/*
+ * Output ranges under writeback, adjacent ones are merged.
+ */
+#define PAGECACHE_RANGES 64
+
+struct pagerange {
+
+	off_t start;
+
+	off_t len;
+
+};
+
+/*
+ * Page cache of one file opened without direct io. Input pages are dropped as soon as they are read,
+ * output pages when their writeback is over, so the copy doesn't push other data out of the cache.
+ */
+
+struct pagecache {
+
+	/*
+	 * -1 if the file isn't handled.
+	 */
+	int fd;
+
+	size_t window;
+
+	/*
+	 * Input is asked to be read ahead up to that offset.
+	 */
+	off_t raend;
+
+	/*
+	 * Output ranges with writeback started, oldest first, and their bytes.
+	 */
+	struct pagerange ranges[PAGECACHE_RANGES];
+
+	int first;
+
+	int count;
+
+	off_t pending;
+
+};
+
+int pagecache_init(struct pagecache *pc, int fd, int input, size_t window);
+
+int pagecache_ahead(struct pagecache *pc, off_t off);
+
+int pagecache_read(struct pagecache *pc, off_t off, off_t len);
+
+int pagecache_written(struct pagecache *pc, off_t off, off_t len);
+
+int pagecache_flush(struct pagecache *pc);
+
+#endif
@@ -0,0 +1,307 @@
+/*
+ ============================================================================
+ Name        : rescue.c
+ Author      : Nikita Staroverov
+ Version     : 1.0.0
+ Copyright   : GPLv2
+ Description : Asynchronous block copying tool, read error handling
+ ============================================================================
+ */
+
+/*
+Copyright (C) 2014  Nikita Staroverov
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "rescue.h"
+
+#define RESCUE_MAGIC "aioblkcopy badmap 1"
+
+/*
+ * Map with NULL path isn't written, bad ranges are still kept for --on-error=skip.
+ */
+
+int rescue_init(struct rescue *rs, int mode, size_t sector, const char *path, long long now) {
+
+	memset(rs, 0, sizeof(struct rescue));
+
+	rs->mode = mode;
+	rs->sector = sector;
+	rs->path = path;
+	rs->lastwrite = now;
+
+	if (pthread_mutex_init(&rs->lock, NULL) != 0) return -1;
+
+	if (path == NULL) return 0;
+
+	/*
+	 * New map is written beside and renamed, so the old one stays valid until then.
+	 */
+	rs->tmppath = malloc(strlen(path) + 5);
+
+	if (rs->tmppath == NULL) return -1;
+
+	sprintf(rs->tmppath, "%s.tmp", path);
+
+	return 0;
+
+}
+
+void rescue_destroy(struct rescue *rs) {
+
+	pthread_mutex_destroy(&rs->lock);
+
+	free(rs->tmppath);
+	free(rs->ranges);
+
+	rs->tmppath = NULL;
+	rs->ranges = NULL;
+
+}
+
+static int rescue_write(struct rescue *rs) {
+
+	FILE *f;
+	int i;
+
+	f = fopen(rs->tmppath, "w");
+
+	if (f == NULL) return -1;
+
+	fprintf(f, "%s\nbad %lld\n", RESCUE_MAGIC, (long long)rs->badbytes);
+
+	for(i = 0; i < rs->nranges; i++) fprintf(f, "range %lld %lld\n", (long long)rs->ranges[i].start, (long long)rs->ranges[i].end);
+
+	if ((fflush(f) == EOF) || (fdatasync(fileno(f)) == -1)) {
+
+		fclose(f);
+
+		return -1;
+
+	}
+
+	if (fclose(f) == EOF) return -1;
+
+	if (rename(rs->tmppath, rs->path) == -1) return -1;
+
+	rs->dirty = 0;
+
+	return 0;
+
+}
+
+/*
+ * Writes the map if something has changed and the interval is over, or always if force isn't zero.
+ * Must be called with the lock held.
+ */
+
+static int rescue_commitlocked(struct rescue *rs, long long now, int force) {
+
+	if ((rs->path == NULL) || (rs->dirty == 0)) return 0;
+
+	if ((force == 0) && (now - rs->lastwrite < RESCUE_MAP_INTERVAL_NS)) return 0;
+
+	rs->lastwrite = now;
+
+	return rescue_write(rs);
+
+}
+
+int rescue_commit(struct rescue *rs, long long now, int force) {
+
+	int ret;
+
+	pthread_mutex_lock(&rs->lock);
+
+	ret = rescue_commitlocked(rs, now, force);
+
+	pthread_mutex_unlock(&rs->lock);
+
+	return ret;
+
+}
+
+/*
+ * Records a bad input range, ranges touching it are merged with it.
+ */
+
+static int rescue_add(struct rescue *rs, off_t off, off_t len, long long now) {
+
+	struct rescuerange *newranges;
+	off_t end = off + len;
+	int ret;
+	int i;
+	int j;
+
+	pthread_mutex_lock(&rs->lock);
+
+	rs->badbytes += len;
+	rs->dirty = 1;
+
+	for(i = 0; (i < rs->nranges) && (rs->ranges[i].end < off); i++);
+
+	for(j = i; (j < rs->nranges) && (rs->ranges[j].start <= end); j++) {
+
+		if (rs->ranges[j].start < off) off = rs->ranges[j].start;
+		if (rs->ranges[j].end > end) end = rs->ranges[j].end;
+
+	}
+
+	if (j == i) {
+
+		if (rs->nranges == rs->maxranges) {
+
+			newranges = realloc(rs->ranges, sizeof(struct rescuerange) * (rs->maxranges * 2 + 16));
+
+			if (newranges == NULL) {
+
+				pthread_mutex_unlock(&rs->lock);
+
+				return -1;
+
+			}
+
+			rs->ranges = newranges;
+			rs->maxranges = rs->maxranges * 2 + 16;
+
+		}
+
+		memmove(&rs->ranges[i + 1], &rs->ranges[i], sizeof(struct rescuerange) * (rs->nranges - i));
+
+		rs->nranges++ ;
+
+	}
+	else if (j > i + 1) {
+
+		memmove(&rs->ranges[i + 1], &rs->ranges[j], sizeof(struct rescuerange) * (rs->nranges - j));
+
+		rs->nranges -= j - i - 1;
+
+	}
+
+	rs->ranges[i].start = off;
+	rs->ranges[i].end = end;
+
+	ret = rescue_commitlocked(rs, now, 0);
+
+	pthread_mutex_unlock(&rs->lock);
+
+	return ret;
+
+}
+
+/*
+ * Decides what to do with the failed read of a block. The whole block is read again with backoff, then it's bisected:
+ * a failing piece is halved, a failing sector is recorded as bad and filled with zeroes.
+ * Returns RESCUE_WAIT if the item must be queued again at retryat, RESCUE_AGAIN if it must be queued now,
+ * RESCUE_DONE if the block is complete, -1 if the copy must stop.
+ */
+
+int rescue_failed(struct rescue *rs, struct blkqueitem *item, long long now) {
+
+	size_t len;
+
+	if ((item->rescuelen == 0) && (item->retries < RESCUE_RETRIES)) {
+
+		item->retryat = now + (RESCUE_BACKOFF_NS << item->retries);
+		item->retries++ ;
+
+		return RESCUE_WAIT;
+
+	}
+
+	if (rs->mode == RESCUE_RETRY) return -1;
+
+	if (item->iolen > rs->sector) {
+
+		len = (item->iolen / 2 + rs->sector - 1) / rs->sector * rs->sector;
+
+		item->rescuelen = len;
+		item->iolen = len;
+
+		return RESCUE_AGAIN;
+
+	}
+
+	#ifdef AIOBLKCOPY_DEBUG
+	fprintf(stderr, "READ BAD rqnum: %lld fd: %i offset: %lld bytes: %zu\n", item->rqnum, item->fd, (long long)item->iooff, item->iolen);
+	#endif
+
+	if (rescue_add(rs, item->iooff, item->iolen, now) == -1) return -1;
+
+	memset(item->iobuf, 0, item->iolen);
+
+	item->badb += item->iolen;
+	item->readyb += item->iolen;
+
+	if (item->readyb == item->blklen) return RESCUE_DONE;
+
+	item->iobuf += item->iolen;
+	item->iooff += item->iolen;
+
+	item->rescuelen = rs->sector;
+	item->iolen = item->blklen - item->readyb;
+
+	if (item->iolen > item->rescuelen) item->iolen = item->rescuelen;
+
+	return RESCUE_AGAIN;
+
+}
+
+/*
+ * Pieces of a bisected block grow back while they are read, iobuf and iooff of the next piece are already set.
+ */
+
+void rescue_next(struct blkqueitem *item) {
+
+	item->rescuelen *= 2;
+
+	if (item->iolen > item->rescuelen) item->iolen = item->rescuelen;
+
+}
+
+/*
+ * Returns the start of the first bad range in [off, end) and sets badend to its end limited by end.
+ * Returns end if there is no bad range there.
+ */
+
+off_t rescue_nextbad(struct rescue *rs, off_t off, off_t end, off_t *badend) {
+
+	off_t bad = end;
+	int i;
+
+	pthread_mutex_lock(&rs->lock);
+
+	for(i = 0; (i < rs->nranges) && (rs->ranges[i].end <= off); i++);
+
+	if ((i < rs->nranges) && (rs->ranges[i].start < end)) {
+
+		bad = (rs->ranges[i].start > off) ? rs->ranges[i].start : off;
+
+		*badend = (rs->ranges[i].end < end) ? rs->ranges[i].end : end;
+
+	}
+
+	pthread_mutex_unlock(&rs->lock);
+
+	return bad;
+
+}
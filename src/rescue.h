@@ -0,0 +1,123 @@
+/*
+ ============================================================================
+ Name        : rescue.h
+ Author      : Nikita Staroverov
+ Version     : 1.0.0
+ Copyright   : GPLv2
+ Description : Asynchronous block copying tool, read error handling
+ ============================================================================
+ */
+
+/*
+Copyright (C) 2014  Nikita Staroverov
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef AIOBLKCOPY_RESCUE_H
+#define AIOBLKCOPY_RESCUE_H
+
+#include <sys/types.h>
+#include <pthread.h>
+
+#include "aioblkcopy.h"
+
+/*
+ * What is done when a read fails.
+ * RESCUE_ABORT - the copy stops with error.
+ * RESCUE_RETRY - the block is read again with backoff, the copy stops if it still fails.
+ * RESCUE_SKIP  - after retries the block is bisected down to sectors, unreadable ones aren't written.
+ * RESCUE_ZERO  - the same, but unreadable sectors are written as zeroes.
+ */
+#define RESCUE_ABORT 0
+#define RESCUE_RETRY 1
+#define RESCUE_SKIP 2
+#define RESCUE_ZERO 3
+
+/*
+ * Failed block is read again that many times, the first retry waits RESCUE_BACKOFF_NS and every next one twice longer.
+ */
+#define RESCUE_RETRIES 3
+#define RESCUE_BACKOFF_NS 100000000LL
+
+/*
+ * Map of bad ranges is rewritten not more often than that and at the end.
+ */
+#define RESCUE_MAP_INTERVAL_NS 1000000000LL
+
+/*
+ * Results of rescue_failed().
+ */
+#define RESCUE_WAIT 0
+#define RESCUE_AGAIN 1
+#define RESCUE_DONE 2
+
+struct rescuerange {
+
+	off_t start;
+
+	off_t end;
+
+};
+
+/*
+ * Bad ranges of input, sorted and never adjacent. The map is shared by copy streams, calls are serialized by the lock.
+ */
+
+struct rescue {
+
+	int mode;
+
+	/*
+	 * Failing block is bisected down to that size.
+	 */
+	size_t sector;
+
+	/*
+	 * Map file, NULL if the map isn't kept.
+	 */
+	const char *path;
+
+	char *tmppath;
+
+	struct rescuerange *ranges;
+
+	int nranges;
+
+	int maxranges;
+
+	off_t badbytes;
+
+	int dirty;
+
+	long long lastwrite;
+
+	pthread_mutex_t lock;
+
+};
+
+int rescue_init(struct rescue *rs, int mode, size_t sector, const char *path, long long now);
+
+int rescue_failed(struct rescue *rs, struct blkqueitem *item, long long now);
+
+void rescue_next(struct blkqueitem *item);
+
+off_t rescue_nextbad(struct rescue *rs, off_t off, off_t end, off_t *badend);
+
+int rescue_commit(struct rescue *rs, long long now, int force);
+
+void rescue_destroy(struct rescue *rs);
+
+#endif
@@ -0,0 +1,201 @@
+/*
+ ============================================================================
+ Name        : sparse.c
+ Author      : Nikita Staroverov
+ Version     : 1.0.0
+ Copyright   : GPLv2
+ Description : Asynchronous block copying tool, holes and zero blocks handling
+ ============================================================================
+ */
+
+/*
+Copyright (C) 2014  Nikita Staroverov
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+
+#include "sparse.h"
+
+/*
+ * GCC vector type, compiled to SSE2/AVX registers where they are available.
+ */
+typedef uint64_t sparsevec __attribute__ ((vector_size (32)));
+
+void sparse_init(struct sparsemap *sp, int ifd, int ofd, int mode, struct journal *jr) {
+
+	memset(sp, 0, sizeof(struct sparsemap));
+
+	sp->ifd = ifd;
+	sp->ofd = ofd;
+	sp->mode = mode;
+	sp->dataend = -1;
+	sp->jr = jr;
+
+}
+
+/*
+ * Returns offset of the next input data starting from off, aligned down to align but not less than off.
+ * Returns -1 with errno ENXIO if there is no more data.
+ */
+
+off_t sparse_nextdata(struct sparsemap *sp, off_t off, size_t align) {
+
+	off_t data;
+
+	if ((sp->ifd == -1) || (off < sp->dataend)) return off;
+
+	data = lseek(sp->ifd, off, SEEK_DATA);
+
+	if (data == -1) {
+
+		/*
+		 * Filesystem without SEEK_DATA, everything is data.
+		 */
+		if (errno == EINVAL) {
+
+			sp->ifd = -1;
+
+			return off;
+
+		}
+
+		return -1;
+
+	}
+
+	sp->dataend = lseek(sp->ifd, data, SEEK_HOLE);
+
+	if (sp->dataend == -1) return -1;
+
+	data -= data % align;
+
+	if (data < off) data = off;
+
+	return data;
+
+}
+
+/*
+ * Buffers come from the pool, so they are aligned at least to 512 bytes.
+ */
+
+int sparse_iszero(const char *buf, size_t len) {
+
+	const sparsevec *v = (const sparsevec *)buf;
+	sparsevec acc;
+	size_t n;
+	size_t i;
+
+	n = len / (sizeof(sparsevec) * 4);
+
+	for(i = 0; i < n; i++) {
+
+		acc = v[i * 4] | v[i * 4 + 1] | v[i * 4 + 2] | v[i * 4 + 3];
+
+		if ((acc[0] | acc[1] | acc[2] | acc[3]) != 0) return 0;
+
+	}
+
+	for(i = n * sizeof(sparsevec) * 4; i < len; i++) {
+
+		if (buf[i] != 0) return 0;
+
+	}
+
+	return 1;
+
+}
+
+static int sparse_send(struct sparsemap *sp, off_t off, off_t len) {
+
+	uint64_t range[2];
+
+	range[0] = off;
+	range[1] = len;
+
+	switch(sp->mode) {
+
+	case SPARSE_PUNCH:
+
+		return fallocate(sp->ofd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, off, len);
+
+	case SPARSE_ZEROOUT:
+
+		return ioctl(sp->ofd, BLKZEROOUT, range);
+
+	case SPARSE_DISCARD:
+
+		return ioctl(sp->ofd, BLKDISCARD, range);
+
+	default:
+
+		return 0;
+
+	}
+
+}
+
+/*
+ * Makes the output range read as zeroes. Adjacent ranges are merged.
+ */
+
+int sparse_zero(struct sparsemap *sp, off_t off, off_t len) {
+
+	if ((sp->zlen != 0) && (sp->zstart + sp->zlen == off) && (sp->zlen + len <= SPARSE_MAXZERORANGE)) {
+
+		sp->zlen += len;
+
+		return 0;
+
+	}
+
+	if (sparse_flush(sp) == -1) return -1;
+
+	sp->zstart = off;
+	sp->zlen = len;
+
+	return 0;
+
+}
+
+int sparse_flush(struct sparsemap *sp) {
+
+	int ret;
+
+	if (sp->zlen == 0) return 0;
+
+	#ifdef AIOBLKCOPY_DEBUG
+	fprintf(stderr, "SPARSE ZERO offset: %lld bytes: %lld mode: %i\n", (long long)sp->zstart, (long long)sp->zlen, sp->mode);
+	#endif
+
+	ret = sparse_send(sp, sp->zstart, sp->zlen);
+
+	if (ret == 0) ret = journal_done(sp->jr, sp->zstart, sp->zlen);
+
+	sp->zlen = 0;
+
+	return ret;
+
+}
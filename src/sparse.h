@@ -0,0 +1,102 @@
+/*
+ ============================================================================
+ Name        : sparse.h
+ Author      : Nikita Staroverov
+ Version     : 1.0.0
+ Copyright   : GPLv2
+ Description : Asynchronous block copying tool, holes and zero blocks handling
+ ============================================================================
+ */
+
+/*
+Copyright (C) 2014  Nikita Staroverov
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef AIOBLKCOPY_SPARSE_H
+#define AIOBLKCOPY_SPARSE_H
+
+#include <sys/types.h>
+
+#include "journal.h"
+
+/*
+ * How zero ranges are made on output.
+ * SPARSE_SKIP    - nothing is written, output is a truncated regular file so holes read as zeroes.
+ * SPARSE_PUNCH   - fallocate(FALLOC_FL_PUNCH_HOLE) on regular files.
+ * SPARSE_ZEROOUT - BLKZEROOUT on block devices.
+ * SPARSE_DISCARD - BLKDISCARD on block devices which return zeroes for discarded blocks.
+ */
+#define SPARSE_NONE 0
+#define SPARSE_SKIP 1
+#define SPARSE_PUNCH 2
+#define SPARSE_ZEROOUT 3
+#define SPARSE_DISCARD 4
+
+/*
+ * Method chosen by output type.
+ */
+#define SPARSE_AUTO 5
+
+/*
+ * Zero ranges are merged before they are sent to output up to that size.
+ */
+#define SPARSE_MAXZERORANGE (1024LL * 1024 * 1024)
+
+struct sparsemap {
+
+	/*
+	 * Input descriptor for SEEK_DATA/SEEK_HOLE, -1 if input isn't a regular file.
+	 */
+	int ifd;
+
+	/*
+	 * End of the current input data extent.
+	 */
+	off_t dataend;
+
+	/*
+	 * Output descriptor and the way of zeroing.
+	 */
+	int ofd;
+
+	int mode;
+
+	/*
+	 * Zero range not sent to output yet.
+	 */
+	off_t zstart;
+
+	off_t zlen;
+
+	/*
+	 * Zero ranges are recorded as written after they are sent.
+	 */
+	struct journal *jr;
+
+};
+
+void sparse_init(struct sparsemap *sp, int ifd, int ofd, int mode, struct journal *jr);
+
+off_t sparse_nextdata(struct sparsemap *sp, off_t off, size_t align);
+
+int sparse_iszero(const char *buf, size_t len);
+
+int sparse_zero(struct sparsemap *sp, off_t off, off_t len);
+
+int sparse_flush(struct sparsemap *sp);
+
+#endif
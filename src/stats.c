@@ -0,0 +1,373 @@
+/*
+ ============================================================================
+ Name        : stats.c
+ Author      : Nikita Staroverov
+ Version     : 1.0.0
+ Copyright   : GPLv2
+ Description : Asynchronous block copying tool, progress and latency statistics
+ ============================================================================
+ */
+
+/*
+Copyright (C) 2014  Nikita Staroverov
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "stats.h"
+
+/*
+ * Middle of the bucket range, the inverse of lathist_bucket().
+ */
+
+static long long lathist_value(int b) {
+
+	int shift;
+
+	if (b < 2 * STATS_SUBBUCKETS) return b;
+
+	shift = b / STATS_SUBBUCKETS - 1;
+
+	return ((long long)(b - shift * STATS_SUBBUCKETS) << shift) + (1LL << shift) / 2;
+
+}
+
+/*
+ * Source may be updated by its stream at the same time, every bucket is read once.
+ */
+
+void lathist_merge(struct lathist *dst, const struct lathist *src) {
+
+	int i;
+
+	for(i = 0; i < STATS_BUCKETS; i++) dst->count[i] += STATS_GET(src->count[i]);
+
+}
+
+/*
+ * Latencies recorded between two snapshots of the same histogram.
+ */
+
+void lathist_diff(struct lathist *dst, const struct lathist *cur, const struct lathist *prev) {
+
+	int i;
+
+	for(i = 0; i < STATS_BUCKETS; i++) dst->count[i] = cur->count[i] - prev->count[i];
+
+}
+
+uint64_t lathist_total(const struct lathist *h) {
+
+	uint64_t total = 0;
+	int i;
+
+	for(i = 0; i < STATS_BUCKETS; i++) total += h->count[i];
+
+	return total;
+
+}
+
+/*
+ * Returns latency in nanoseconds which p of recorded latencies don't exceed, -1 if nothing is recorded.
+ */
+
+long long lathist_percentile(const struct lathist *h, double p) {
+
+	uint64_t total = lathist_total(h);
+	uint64_t rank;
+	uint64_t sum = 0;
+	int i;
+
+	if (total == 0) return -1;
+
+	rank = total * p;
+
+	if (rank < total * p) rank++ ;
+
+	if (rank == 0) rank = 1;
+
+	for(i = 0; i < STATS_BUCKETS; i++) {
+
+		sum += h->count[i];
+
+		if (sum >= rank) return lathist_value(i);
+
+	}
+
+	return lathist_value(STATS_BUCKETS - 1);
+
+}
+
+/*
+ * Prints p50/p99/p999 of the histogram in milliseconds.
+ */
+
+void stats_printlat(FILE *f, const char *name, const struct lathist *h) {
+
+	if (lathist_total(h) == 0) {
+
+		fprintf(f, "%s latency -", name);
+
+		return;
+
+	}
+
+	fprintf(f, "%s latency p50 %.3f p99 %.3f p999 %.3f ms", name, lathist_percentile(h, 0.5) / 1e6, \
+			lathist_percentile(h, 0.99) / 1e6, lathist_percentile(h, 0.999) / 1e6);
+
+}
+
+void stats_clear(struct statsnap *snap, long long elapsed, off_t total) {
+
+	memset(snap, 0, sizeof(struct statsnap));
+
+	snap->elapsed = elapsed;
+	snap->total = total;
+
+}
+
+/*
+ * Adds counters of a stream which may be running, every counter is read once.
+ */
+
+void stats_add(struct statsnap *snap, const struct streamstats *st) {
+
+	snap->done += STATS_GET(st->done);
+	snap->rbytes += STATS_GET(st->rbytes);
+	snap->wbytes += STATS_GET(st->wbytes);
+	snap->reads += STATS_GET(st->reads);
+	snap->writes += STATS_GET(st->writes);
+	snap->shortreads += STATS_GET(st->shortreads);
+	snap->shortwrites += STATS_GET(st->shortwrites);
+	snap->rcancels += STATS_GET(st->rcancels);
+	snap->wcancels += STATS_GET(st->wcancels);
+	snap->efbig += STATS_GET(st->efbig);
+	snap->rerrors += STATS_GET(st->rerrors);
+	snap->badb += STATS_GET(st->badb);
+	snap->sparseb += STATS_GET(st->sparseb);
+	snap->deltab += STATS_GET(st->deltab);
+	snap->iqsum += STATS_GET(st->iqsum);
+	snap->oqsum += STATS_GET(st->oqsum);
+	snap->samples += STATS_GET(st->samples);
+	snap->rlatsum += STATS_GET(st->rlatsum);
+	snap->wlatsum += STATS_GET(st->wlatsum);
+	snap->iqsize += STATS_GET(st->iqsize);
+	snap->oqsize += STATS_GET(st->oqsize);
+	snap->ilimit += STATS_GET(st->ilimit);
+	snap->olimit += STATS_GET(st->olimit);
+
+	lathist_merge(&snap->rd, &st->rd);
+	lathist_merge(&snap->wr, &st->wr);
+
+}
+
+/*
+ * Number of latencies below ns, exact if ns is a bucket bound.
+ */
+
+static uint64_t lathist_below(const struct lathist *h, long long ns) {
+
+	uint64_t sum = 0;
+	int n = lathist_bucket(ns);
+	int i;
+
+	for(i = 0; i < n; i++) sum += h->count[i];
+
+	return sum;
+
+}
+
+/*
+ * Percentile in seconds, null if there is nothing recorded.
+ */
+
+static void stats_jsonpct(FILE *f, const char *name, const struct lathist *h, double p) {
+
+	long long ns = lathist_percentile(h, p);
+
+	if (ns == -1) fprintf(f, "      \"%s\": null,\n", name);
+	else fprintf(f, "      \"%s\": %.9f,\n", name, ns / 1e9);
+
+}
+
+static void stats_jsonside(FILE *f, const char *name, unsigned long long bytes, unsigned long long requests, \
+		unsigned long long retries, unsigned long long cancels, int qsize, int limit, unsigned long long qsum, \
+		unsigned long long samples, unsigned long long latsum, const struct lathist *h) {
+
+	int k;
+
+	fprintf(f, "  \"%s\": {\n    \"bytes\": %llu,\n    \"requests\": %llu,\n    \"short_retries\": %llu,\n" \
+			"    \"canceled\": %llu,\n    \"queue\": %i,\n    \"queue_limit\": %i,\n    \"queue_avg\": %.3f,\n", \
+			name, bytes, requests, retries, cancels, qsize, limit, (samples != 0) ? (double)qsum / samples : 0);
+
+	fprintf(f, "    \"latency\": {\n      \"count\": %llu,\n      \"sum\": %.9f,\n", \
+			(unsigned long long)lathist_total(h), latsum / 1e9);
+
+	stats_jsonpct(f, "p50", h, 0.5);
+	stats_jsonpct(f, "p99", h, 0.99);
+	stats_jsonpct(f, "p999", h, 0.999);
+
+	fprintf(f, "      \"buckets\": [");
+
+	for(k = STATS_EXPORTMIN; k <= STATS_EXPORTMAX; k += STATS_EXPORTSTEP) {
+
+		fprintf(f, "%s[%.9f, %llu]", (k == STATS_EXPORTMIN) ? "" : ", ", (double)(1LL << k) / 1e9, \
+				(unsigned long long)lathist_below(h, 1LL << k));
+
+	}
+
+	fprintf(f, "]\n    }\n  }");
+
+}
+
+static void stats_json(FILE *f, const struct statsnap *snap) {
+
+	fprintf(f, "{\n  \"elapsed\": %.3f,\n  \"finished\": %s,\n  \"done_bytes\": %llu,\n  \"total_bytes\": %lld,\n" \
+			"  \"sparse_bytes\": %llu,\n  \"equal_bytes\": %llu,\n  \"efbig\": %llu,\n  \"read_errors\": %llu,\n  \"bad_bytes\": %llu,\n", \
+			snap->elapsed / 1e9, snap->finished ? "true" : "false", (unsigned long long)snap->done, (long long)snap->total, \
+			snap->sparseb, snap->deltab, snap->efbig, snap->rerrors, snap->badb);
+
+	stats_jsonside(f, "read", snap->rbytes, snap->reads, snap->shortreads, snap->rcancels, snap->iqsize, snap->ilimit, \
+			snap->iqsum, snap->samples, snap->rlatsum, &snap->rd);
+
+	fprintf(f, ",\n");
+
+	stats_jsonside(f, "write", snap->wbytes, snap->writes, snap->shortwrites, snap->wcancels, snap->oqsize, snap->olimit, \
+			snap->oqsum, snap->samples, snap->wlatsum, &snap->wr);
+
+	fprintf(f, "\n}\n");
+
+}
+
+static void stats_prommetric(FILE *f, const char *name, const char *type, const char *help, const char *side, double val) {
+
+	if ((side == NULL) || (strcmp(side, "read") == 0)) {
+
+		fprintf(f, "# HELP aioblkcopy_%s %s\n# TYPE aioblkcopy_%s %s\n", name, help, name, type);
+
+	}
+
+	if (side == NULL) fprintf(f, "aioblkcopy_%s %.15g\n", name, val);
+	else fprintf(f, "aioblkcopy_%s{side=\"%s\"} %.15g\n", name, side, val);
+
+}
+
+static void stats_promhist(FILE *f, const char *side, unsigned long long latsum, const struct lathist *h) {
+
+	int k;
+
+	if (strcmp(side, "read") == 0) {
+
+		fprintf(f, "# HELP aioblkcopy_latency_seconds Request latency.\n# TYPE aioblkcopy_latency_seconds histogram\n");
+
+	}
+
+	for(k = STATS_EXPORTMIN; k <= STATS_EXPORTMAX; k += STATS_EXPORTSTEP) {
+
+		fprintf(f, "aioblkcopy_latency_seconds_bucket{side=\"%s\",le=\"%.9g\"} %llu\n", side, (double)(1LL << k) / 1e9, \
+				(unsigned long long)lathist_below(h, 1LL << k));
+
+	}
+
+	fprintf(f, "aioblkcopy_latency_seconds_bucket{side=\"%s\",le=\"+Inf\"} %llu\n", side, (unsigned long long)lathist_total(h));
+	fprintf(f, "aioblkcopy_latency_seconds_sum{side=\"%s\"} %.9f\n", side, latsum / 1e9);
+	fprintf(f, "aioblkcopy_latency_seconds_count{side=\"%s\"} %llu\n", side, (unsigned long long)lathist_total(h));
+
+}
+
+/*
+ * Prometheus text format, metrics of both sides are told apart by side label.
+ */
+
+static void stats_prom(FILE *f, const struct statsnap *snap) {
+
+	stats_prommetric(f, "elapsed_seconds", "gauge", "Time since the copy started.", NULL, snap->elapsed / 1e9);
+	stats_prommetric(f, "finished", "gauge", "The copy is finished.", NULL, snap->finished);
+	stats_prommetric(f, "done_bytes", "gauge", "Bytes of input done including skipped ones.", NULL, snap->done);
+	stats_prommetric(f, "total_bytes", "gauge", "Bytes to copy, zero if unknown.", NULL, snap->total);
+	stats_prommetric(f, "sparse_bytes_total", "counter", "Bytes not written as zero.", NULL, snap->sparseb);
+	stats_prommetric(f, "equal_bytes_total", "counter", "Bytes not written as equal to output.", NULL, snap->deltab);
+	stats_prommetric(f, "efbig_total", "counter", "Writes beyond the end of output.", NULL, snap->efbig);
+	stats_prommetric(f, "read_errors_total", "counter", "Failed reads.", NULL, snap->rerrors);
+	stats_prommetric(f, "bad_bytes_total", "counter", "Bytes of input which couldn't be read.", NULL, snap->badb);
+
+	stats_prommetric(f, "bytes_total", "counter", "Bytes transferred by completed requests.", "read", snap->rbytes);
+	stats_prommetric(f, "bytes_total", "counter", NULL, "write", snap->wbytes);
+	stats_prommetric(f, "requests_total", "counter", "Completed requests.", "read", snap->reads);
+	stats_prommetric(f, "requests_total", "counter", NULL, "write", snap->writes);
+	stats_prommetric(f, "short_retries_total", "counter", "Requests resubmitted for the rest of a short transfer.", "read", snap->shortreads);
+	stats_prommetric(f, "short_retries_total", "counter", NULL, "write", snap->shortwrites);
+	stats_prommetric(f, "canceled_total", "counter", "Canceled requests.", "read", snap->rcancels);
+	stats_prommetric(f, "canceled_total", "counter", NULL, "write", snap->wcancels);
+	stats_prommetric(f, "queue_depth", "gauge", "Requests in flight.", "read", snap->iqsize);
+	stats_prommetric(f, "queue_depth", "gauge", NULL, "write", snap->oqsize);
+	stats_prommetric(f, "queue_limit", "gauge", "Current limit of requests in flight.", "read", snap->ilimit);
+	stats_prommetric(f, "queue_limit", "gauge", NULL, "write", snap->olimit);
+	stats_prommetric(f, "queue_depth_sum", "counter", "Requests in flight summed over depth samples.", "read", snap->iqsum);
+	stats_prommetric(f, "queue_depth_sum", "counter", NULL, "write", snap->oqsum);
+	stats_prommetric(f, "queue_depth_samples_total", "counter", "Depth samples taken.", NULL, snap->samples);
+
+	stats_promhist(f, "read", snap->rlatsum, &snap->rd);
+	stats_promhist(f, "write", snap->wlatsum, &snap->wr);
+
+}
+
+/*
+ * Writes a new file beside and renames it over path, so readers never see a partial file.
+ */
+
+static int stats_write(const char *path, const struct statsnap *snap, void (*print)(FILE *, const struct statsnap *)) {
+
+	char *tmppath;
+	FILE *f;
+	int ret = -1;
+
+	tmppath = malloc(strlen(path) + 5);
+
+	if (tmppath == NULL) return -1;
+
+	sprintf(tmppath, "%s.tmp", path);
+
+	f = fopen(tmppath, "w");
+
+	if (f != NULL) {
+
+		print(f, snap);
+
+		if (fclose(f) != EOF) ret = rename(tmppath, path);
+
+	}
+
+	free(tmppath);
+
+	return ret;
+
+}
+
+int stats_writejson(const char *path, const struct statsnap *snap) {
+
+	return stats_write(path, snap, stats_json);
+
+}
+
+int stats_writeprom(const char *path, const struct statsnap *snap) {
+
+	return stats_write(path, snap, stats_prom);
+
+}
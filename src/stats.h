@@ -0,0 +1,269 @@
+/*
+ ============================================================================
+ Name        : stats.h
+ Author      : Nikita Staroverov
+ Version     : 1.0.0
+ Copyright   : GPLv2
+ Description : Asynchronous block copying tool, progress and latency statistics
+ ============================================================================
+ */
+
+/*
+Copyright (C) 2014  Nikita Staroverov
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef AIOBLKCOPY_STATS_H
+#define AIOBLKCOPY_STATS_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/*
+ * Progress is printed that often by default with --progress, in seconds.
+ */
+#define STATS_INTERVAL 10
+
+/*
+ * Latency histogram in nanoseconds with HDR-like log-linear buckets.
+ * Values below 2*STATS_SUBBUCKETS have their own buckets, above that every power of two is split into
+ * STATS_SUBBUCKETS equal buckets, so the error of any value is below 1/STATS_SUBBUCKETS.
+ * Longer latencies than 2^STATS_MAXBITS ns (about an hour) go to the last bucket.
+ */
+#define STATS_SUBBITS 5
+#define STATS_SUBBUCKETS (1 << STATS_SUBBITS)
+#define STATS_MAXBITS 42
+#define STATS_BUCKETS ((STATS_MAXBITS - STATS_SUBBITS + 2) * STATS_SUBBUCKETS)
+
+/*
+ * Histogram and other counters of a stream are updated only by the stream itself, but read by progress reporting
+ * at any time. Single writer doesn't need atomic increments, only atomic stores and loads.
+ */
+
+#define STATS_SET(var, val) __atomic_store_n(&(var), (val), __ATOMIC_RELAXED)
+#define STATS_GET(var) __atomic_load_n(&(var), __ATOMIC_RELAXED)
+#define STATS_ADD(var, val) STATS_SET(var, (var) + (val))
+
+/*
+ * Exported histograms have buckets up to 2^STATS_EXPORTMIN ns, 2^(STATS_EXPORTMIN+STATS_EXPORTSTEP) ns and so on,
+ * they are bounds of histogram buckets, so the exported counts are exact.
+ */
+#define STATS_EXPORTMIN 10
+#define STATS_EXPORTSTEP 2
+#define STATS_EXPORTMAX 36
+
+struct lathist {
+
+	uint64_t count[STATS_BUCKETS];
+
+};
+
+/*
+ * Live state of a stream for progress reporting.
+ */
+
+struct streamstats {
+
+	/*
+	 * Bytes of the input range done, including holes and resumed ranges.
+	 */
+	size_t done;
+
+	/*
+	 * Completed requests and their bytes, requests resubmitted for the rest of a short read or write,
+	 * canceled requests, writes beyond the end of output.
+	 */
+	unsigned long long rbytes;
+
+	unsigned long long wbytes;
+
+	unsigned long long reads;
+
+	unsigned long long writes;
+
+	unsigned long long shortreads;
+
+	unsigned long long shortwrites;
+
+	unsigned long long rcancels;
+
+	unsigned long long wcancels;
+
+	unsigned long long efbig;
+
+	/*
+	 * Failed reads, bytes of input which couldn't be read.
+	 */
+	unsigned long long rerrors;
+
+	unsigned long long badb;
+
+	/*
+	 * Bytes not written as zero or equal to output.
+	 */
+	unsigned long long sparseb;
+
+	unsigned long long deltab;
+
+	/*
+	 * Queue sizes summed over loop iterations, divided by samples they give average depth.
+	 */
+	unsigned long long iqsum;
+
+	unsigned long long oqsum;
+
+	unsigned long long samples;
+
+	/*
+	 * Sums of latencies in nanoseconds.
+	 */
+	unsigned long long rlatsum;
+
+	unsigned long long wlatsum;
+
+	/*
+	 * Requests in flight and current limits of both queues.
+	 */
+	int iqsize;
+
+	int oqsize;
+
+	int ilimit;
+
+	int olimit;
+
+	struct lathist rd;
+
+	struct lathist wr;
+
+};
+
+static inline int lathist_bucket(uint64_t ns) {
+
+	int bits;
+	int shift;
+
+	if (ns < 2 * STATS_SUBBUCKETS) return ns;
+
+	bits = 63 - __builtin_clzll(ns);
+
+	if (bits > STATS_MAXBITS) return STATS_BUCKETS - 1;
+
+	shift = bits - STATS_SUBBITS;
+
+	return (shift + 1) * STATS_SUBBUCKETS + (ns >> shift) - STATS_SUBBUCKETS;
+
+}
+
+/*
+ * Called on the completion path, costs a couple of instructions.
+ */
+
+static inline void lathist_add(struct lathist *h, long long ns) {
+
+	int b = lathist_bucket((ns < 0) ? 0 : ns);
+
+	STATS_SET(h->count[b], h->count[b] + 1);
+
+}
+
+/*
+ * Sum of all streams at one moment.
+ */
+
+struct statsnap {
+
+	/*
+	 * Nanoseconds since the copy started, bytes to copy or zero if unknown.
+	 */
+	long long elapsed;
+
+	off_t total;
+
+	int finished;
+
+	size_t done;
+
+	unsigned long long rbytes;
+
+	unsigned long long wbytes;
+
+	unsigned long long reads;
+
+	unsigned long long writes;
+
+	unsigned long long shortreads;
+
+	unsigned long long shortwrites;
+
+	unsigned long long rcancels;
+
+	unsigned long long wcancels;
+
+	unsigned long long efbig;
+
+	unsigned long long rerrors;
+
+	unsigned long long badb;
+
+	unsigned long long sparseb;
+
+	unsigned long long deltab;
+
+	unsigned long long iqsum;
+
+	unsigned long long oqsum;
+
+	unsigned long long samples;
+
+	unsigned long long rlatsum;
+
+	unsigned long long wlatsum;
+
+	int iqsize;
+
+	int oqsize;
+
+	int ilimit;
+
+	int olimit;
+
+	struct lathist rd;
+
+	struct lathist wr;
+
+};
+
+void lathist_merge(struct lathist *dst, const struct lathist *src);
+
+void lathist_diff(struct lathist *dst, const struct lathist *cur, const struct lathist *prev);
+
+uint64_t lathist_total(const struct lathist *h);
+
+long long lathist_percentile(const struct lathist *h, double p);
+
+void stats_printlat(FILE *f, const char *name, const struct lathist *h);
+
+void stats_clear(struct statsnap *snap, long long elapsed, off_t total);
+
+void stats_add(struct statsnap *snap, const struct streamstats *st);
+
+int stats_writejson(const char *path, const struct statsnap *snap);
+
+int stats_writeprom(const char *path, const struct statsnap *snap);
+
+#endif
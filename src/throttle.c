@@ -0,0 +1,207 @@
+/*
+ ============================================================================
+ Name        : throttle.c
+ Author      : Nikita Staroverov
+ Version     : 1.0.0
+ Copyright   : GPLv2
+ Description : Asynchronous block copying tool, bandwidth and IOPS throttling
+ ============================================================================
+ */
+
+/*
+Copyright (C) 2014  Nikita Staroverov
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "throttle.h"
+
+static void tbucket_set(struct tbucket *tb, double rate) {
+
+	tb->rate = rate;
+	tb->burst = rate * THROTTLE_BURST_NS / 1000000000;
+
+	if (tb->burst < 1) tb->burst = 1;
+
+	if (tb->tokens > tb->burst) tb->tokens = tb->burst;
+
+}
+
+static void tbucket_refill(struct tbucket *tb, long long now) {
+
+	if (now > tb->last) {
+
+		tb->tokens += tb->rate * (now - tb->last) / 1000000000;
+
+		if (tb->tokens > tb->burst) tb->tokens = tb->burst;
+
+	}
+
+	tb->last = now;
+
+}
+
+/*
+ * Nanoseconds until the bucket is out of debt.
+ */
+
+static long long tbucket_delay(struct tbucket *tb) {
+
+	if ((tb->rate == 0) || (tb->tokens > 0)) return 0;
+
+	return (-tb->tokens / tb->rate) * 1000000000 + 1;
+
+}
+
+int throttle_init(struct throttle *th, long long rate, long long iops, long long now) {
+
+	int i;
+
+	memset(th, 0, sizeof(struct throttle));
+
+	if (pthread_mutex_init(&th->lock, NULL) != 0) return -1;
+
+	for(i = 0; i < 2; i++) {
+
+		th->bytes[i].last = now;
+		th->iops[i].last = now;
+
+	}
+
+	throttle_set(th, rate, iops);
+
+	return 0;
+
+}
+
+/*
+ * Changes limits while streams run, buckets start full.
+ */
+
+void throttle_set(struct throttle *th, long long rate, long long iops) {
+
+	int i;
+
+	pthread_mutex_lock(&th->lock);
+
+	for(i = 0; i < 2; i++) {
+
+		tbucket_set(&th->bytes[i], rate);
+		tbucket_set(&th->iops[i], iops);
+
+		th->bytes[i].tokens = th->bytes[i].burst;
+		th->iops[i].tokens = th->iops[i].burst;
+
+	}
+
+	pthread_mutex_unlock(&th->lock);
+
+	#ifdef AIOBLKCOPY_DEBUG
+	fprintf(stderr, "throttle: rate %lld bytes/s, %lld requests/s\n", rate, iops);
+	#endif
+
+}
+
+/*
+ * Returns 1 if a new request of the side may be submitted now.
+ */
+
+int throttle_allow(struct throttle *th, int side, long long now) {
+
+	int ret = 1;
+
+	pthread_mutex_lock(&th->lock);
+
+	if (th->bytes[side].rate != 0) {
+
+		tbucket_refill(&th->bytes[side], now);
+
+		if (th->bytes[side].tokens <= 0) ret = 0;
+
+	}
+
+	if (th->iops[side].rate != 0) {
+
+		tbucket_refill(&th->iops[side], now);
+
+		if (th->iops[side].tokens <= 0) ret = 0;
+
+	}
+
+	pthread_mutex_unlock(&th->lock);
+
+	return ret;
+
+}
+
+/*
+ * Takes tokens of the submitted request.
+ */
+
+void throttle_charge(struct throttle *th, int side, size_t bytes) {
+
+	pthread_mutex_lock(&th->lock);
+
+	if (th->bytes[side].rate != 0) th->bytes[side].tokens -= bytes;
+
+	if (th->iops[side].rate != 0) th->iops[side].tokens -= 1;
+
+	pthread_mutex_unlock(&th->lock);
+
+}
+
+/*
+ * Nanoseconds until any bucket which is in debt may give tokens again, zero if none is in debt.
+ */
+
+long long throttle_delay(struct throttle *th, long long now) {
+
+	long long delay = 0;
+	long long d;
+	int i;
+
+	pthread_mutex_lock(&th->lock);
+
+	for(i = 0; i < 2; i++) {
+
+		tbucket_refill(&th->bytes[i], now);
+		tbucket_refill(&th->iops[i], now);
+
+		d = tbucket_delay(&th->bytes[i]);
+
+		if ((d != 0) && ((delay == 0) || (d < delay))) delay = d;
+
+		d = tbucket_delay(&th->iops[i]);
+
+		if ((d != 0) && ((delay == 0) || (d < delay))) delay = d;
+
+	}
+
+	pthread_mutex_unlock(&th->lock);
+
+	if (delay > THROTTLE_MAXSLEEP_NS) delay = THROTTLE_MAXSLEEP_NS;
+
+	return delay;
+
+}
+
+void throttle_destroy(struct throttle *th) {
+
+	pthread_mutex_destroy(&th->lock);
+
+}
@@ -0,0 +1,92 @@
+/*
+ ============================================================================
+ Name        : throttle.h
+ Author      : Nikita Staroverov
+ Version     : 1.0.0
+ Copyright   : GPLv2
+ Description : Asynchronous block copying tool, bandwidth and IOPS throttling
+ ============================================================================
+ */
+
+/*
+Copyright (C) 2014  Nikita Staroverov
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef AIOBLKCOPY_THROTTLE_H
+#define AIOBLKCOPY_THROTTLE_H
+
+#include <sys/types.h>
+#include <pthread.h>
+
+#define THROTTLE_READ 0
+#define THROTTLE_WRITE 1
+
+/*
+ * Buckets hold tokens for that much time at the full rate.
+ */
+#define THROTTLE_BURST_NS 100000000LL
+
+/*
+ * Loop with nothing in flight sleeps at most that long, so new limits are picked up soon.
+ */
+#define THROTTLE_MAXSLEEP_NS 100000000LL
+
+/*
+ * Token bucket, rate is in tokens per second, zero means no limit.
+ * Tokens may go below zero, so a request bigger than the bucket still goes, the following ones wait for the debt.
+ */
+
+struct tbucket {
+
+	double rate;
+
+	double tokens;
+
+	double burst;
+
+	long long last;
+
+};
+
+/*
+ * Limits are the same for both sides and shared by all streams.
+ * Request of a side may be submitted when both its buckets aren't in debt.
+ */
+
+struct throttle {
+
+	pthread_mutex_t lock;
+
+	struct tbucket bytes[2];
+
+	struct tbucket iops[2];
+
+};
+
+int throttle_init(struct throttle *th, long long rate, long long iops, long long now);
+
+void throttle_set(struct throttle *th, long long rate, long long iops);
+
+int throttle_allow(struct throttle *th, int side, long long now);
+
+void throttle_charge(struct throttle *th, int side, size_t bytes);
+
+long long throttle_delay(struct throttle *th, long long now);
+
+void throttle_destroy(struct throttle *th);
+
+#endif
@@ -0,0 +1,170 @@
+/*
+ ============================================================================
+ Name        : topology.c
+ Author      : Nikita Staroverov
+ Version     : 1.0.0
+ Copyright   : GPLv2
+ Description : Asynchronous block copying tool, device block sizes and alignment
+ ============================================================================
+ */
+
+/*
+Copyright (C) 2014  Nikita Staroverov
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+
+#include "topology.h"
+
+static size_t topology_gcd(size_t a, size_t b) {
+
+	size_t t;
+
+	while(b != 0) {
+
+		t = a % b;
+		a = b;
+		b = t;
+
+	}
+
+	return a;
+
+}
+
+/*
+ * Zero is unknown and doesn't change the other value.
+ */
+
+size_t topology_lcm(size_t a, size_t b) {
+
+	if (a == 0) return b;
+	if (b == 0) return a;
+
+	return a / topology_gcd(a, b) * b;
+
+}
+
+static void topology_blkdev(int fd, struct topology *tp) {
+
+	int lbs;
+	unsigned int val;
+
+	if (ioctl(fd, BLKSSZGET, &lbs) == 0) tp->dioalign = lbs;
+
+	#ifdef BLKPBSZGET
+	if (ioctl(fd, BLKPBSZGET, &val) == 0) tp->physical = val;
+	#endif
+
+	#ifdef BLKIOMIN
+	if (ioctl(fd, BLKIOMIN, &val) == 0) tp->iomin = val;
+	#endif
+
+	#ifdef BLKIOOPT
+	if (ioctl(fd, BLKIOOPT, &val) == 0) tp->ioopt = val;
+	#endif
+
+	tp->memalign = tp->dioalign;
+
+}
+
+/*
+ * Files don't tell their device limits, statx gives direct io alignment since Linux 6.1 and st_blksize is
+ * the file system block, aligning to it is always enough for direct io.
+ */
+
+static void topology_file(int fd, struct stat *st, struct topology *tp) {
+
+	#ifdef STATX_DIOALIGN
+
+	struct statx stx;
+
+	if ((statx(fd, "", AT_EMPTY_PATH, STATX_DIOALIGN, &stx) == 0) && ((stx.stx_mask & STATX_DIOALIGN) != 0) && \
+			(stx.stx_dio_offset_align != 0)) {
+
+		tp->dioalign = stx.stx_dio_offset_align;
+		tp->memalign = stx.stx_dio_mem_align;
+
+	}
+
+	#endif
+
+	if (tp->dioalign == 0) {
+
+		tp->dioalign = st->st_blksize;
+		tp->memalign = st->st_blksize;
+
+	}
+
+	tp->iomin = st->st_blksize;
+
+}
+
+/*
+ * Sizes which aren't multiples of the logical block size are dropped, so blocks made of them stay aligned.
+ * Returns -1 if fd can't be looked at.
+ */
+
+int topology_query(int fd, struct topology *tp) {
+
+	struct stat st;
+
+	memset(tp, 0, sizeof(struct topology));
+
+	if (fstat(fd, &st) == -1) return -1;
+
+	if (S_ISBLK(st.st_mode)) topology_blkdev(fd, tp);
+	else if (S_ISREG(st.st_mode)) topology_file(fd, &st, tp);
+
+	if ((tp->dioalign == 0) || ((tp->dioalign & (tp->dioalign - 1)) != 0)) tp->dioalign = TOPOLOGY_SECTOR;
+
+	if ((tp->memalign == 0) || ((tp->memalign & (tp->memalign - 1)) != 0) || (tp->memalign > tp->dioalign)) tp->memalign = tp->dioalign;
+
+	if ((tp->physical % tp->dioalign) != 0) tp->physical = 0;
+	if ((tp->iomin % tp->dioalign) != 0) tp->iomin = 0;
+	if ((tp->ioopt % tp->dioalign) != 0) tp->ioopt = 0;
+
+	#ifdef AIOBLKCOPY_DEBUG
+	fprintf(stderr, "topology: fd %i dioalign: %zu memalign: %zu physical: %zu iomin: %zu ioopt: %zu\n", \
+			fd, tp->dioalign, tp->memalign, tp->physical, tp->iomin, tp->ioopt);
+	#endif
+
+	return 0;
+
+}
+
+/*
+ * Size every request of the endpoint should be a multiple of: optimal io size if the device has one,
+ * otherwise the biggest of minimal io size, physical and logical block size.
+ */
+
+size_t topology_unit(const struct topology *tp) {
+
+	size_t unit;
+
+	if (tp->ioopt != 0) return topology_lcm(tp->ioopt, tp->dioalign);
+
+	unit = topology_lcm(tp->dioalign, tp->physical);
+
+	return topology_lcm(unit, tp->iomin);
+
+}
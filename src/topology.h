@@ -0,0 +1,76 @@
+/*
+ ============================================================================
+ Name        : topology.h
+ Author      : Nikita Staroverov
+ Version     : 1.0.0
+ Copyright   : GPLv2
+ Description : Asynchronous block copying tool, device block sizes and alignment
+ ============================================================================
+ */
+
+/*
+Copyright (C) 2014  Nikita Staroverov
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef AIOBLKCOPY_TOPOLOGY_H
+#define AIOBLKCOPY_TOPOLOGY_H
+
+#include <stddef.h>
+
+/*
+ * Used when the endpoint doesn't report its logical block size.
+ */
+#define TOPOLOGY_SECTOR 512
+
+/*
+ * Block sizes of one endpoint, zero if unknown.
+ */
+
+struct topology {
+
+	/*
+	 * Alignment of offset and length taken by direct io: logical block size of devices,
+	 * the one reported by statx or file system block size for regular files.
+	 */
+	size_t dioalign;
+
+	/*
+	 * Alignment of memory taken by direct io.
+	 */
+	size_t memalign;
+
+	/*
+	 * Physical block size, smaller writes are read-modify-write.
+	 */
+	size_t physical;
+
+	/*
+	 * Minimal and optimal io size of the device, a chunk and a full stripe of RAID.
+	 */
+	size_t iomin;
+
+	size_t ioopt;
+
+};
+
+int topology_query(int fd, struct topology *tp);
+
+size_t topology_unit(const struct topology *tp);
+
+size_t topology_lcm(size_t a, size_t b);
+
+#endif
@@ -0,0 +1,74 @@
+/*
+ ============================================================================
+ Name        : verify.c
+ Author      : Nikita Staroverov
+ Version     : 1.0.0
+ Copyright   : GPLv2
+ Description : Asynchronous block copying tool, block hashing for verification
+ ============================================================================
+ */
+
+/*
+Copyright (C) 2014  Nikita Staroverov
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifdef HAVE_XXHASH
+#include <xxhash.h>
+#endif
+
+#include "sparse.h"
+#include "verify.h"
+
+int verify_available(void) {
+
+	#ifdef HAVE_XXHASH
+	return 1;
+	#else
+	return 0;
+	#endif
+
+}
+
+/*
+ * XXH3 uses SSE2/AVX2 or NEON where they are available. Buffers come from the pool, so sectors are aligned
+ * for sparse_iszero().
+ */
+
+uint64_t verify_hash(const char *buf, size_t len, uint64_t off) {
+
+	uint64_t sum = 0;
+	size_t n;
+	size_t i;
+
+	for(i = 0; i < len; i += VERIFY_SECTOR) {
+
+		n = (len - i < VERIFY_SECTOR) ? len - i : VERIFY_SECTOR;
+
+		if (sparse_iszero(buf + i, n) == 1) continue;
+
+		#ifdef HAVE_XXHASH
+		sum += XXH3_64bits_withSeed(buf + i, n, off + i);
+		#endif
+
+	}
+
+	return sum;
+
+}
@@ -0,0 +1,54 @@
+/*
+ ============================================================================
+ Name        : verify.h
+ Author      : Nikita Staroverov
+ Version     : 1.0.0
+ Copyright   : GPLv2
+ Description : Asynchronous block copying tool, block hashing for verification
+ ============================================================================
+ */
+
+/*
+Copyright (C) 2014  Nikita Staroverov
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef AIOBLKCOPY_VERIFY_H
+#define AIOBLKCOPY_VERIFY_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+/*
+ * VERIFY_HASH     - blocks are hashed after they are read, digest of the copy is printed.
+ * VERIFY_READBACK - every written block is also read back and its hash compared.
+ */
+#define VERIFY_NONE 0
+#define VERIFY_HASH 1
+#define VERIFY_READBACK 2
+
+/*
+ * Blocks are hashed by sectors, every sector with its offset as seed, and sector hashes are summed.
+ * So hashes of adjacent blocks add up, the digest doesn't depend on block size, streams or completion order.
+ * Zero sectors add nothing, holes which are never read don't need hashing.
+ */
+#define VERIFY_SECTOR 512
+
+int verify_available(void);
+
+uint64_t verify_hash(const char *buf, size_t len, uint64_t off);
+
+#endif
@@ -0,0 +1,280 @@
+/*
+ ============================================================================
+ Name        : workers.c
+ Author      : Nikita Staroverov
+ Version     : 1.0.0
+ Copyright   : GPLv2
+ Description : Asynchronous block copying tool, worker threads hashing and compressing blocks
+ ============================================================================
+ */
+
+/*
+Copyright (C) 2014  Nikita Staroverov
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "workers.h"
+#include "compress.h"
+#include "verify.h"
+
+static void workers_run(struct compressctx *cc, struct workjob *job) {
+
+	struct blkqueitem *item = job->item;
+	size_t len = item->readyb;
+
+	job->res = 0;
+	job->hash = 0;
+
+	if ((job->ops & WORK_UNPACK) != 0) {
+
+		job->res = compress_unpack(cc, item->zbuf, item->zlen, item->buffer);
+
+		if (job->res == -1) return;
+
+		len = job->res;
+
+	}
+
+	if ((job->ops & WORK_HASH) != 0) job->hash = verify_hash(item->buffer, len, job->off);
+
+	if ((job->ops & WORK_PACK) != 0) job->res = compress_pack(cc, item->buffer, len, item->zbuf);
+
+	if ((job->ops & WORK_HASHBACK) != 0) job->hash = verify_hash(item->cmpbuf, item->blklen, job->off);
+
+}
+
+static void *workers_thread(void *arg) {
+
+	struct workers *wk = arg;
+	struct compressctx cc;
+	struct workjob job;
+
+	compress_init(&cc, wk->method, wk->bufsize);
+
+	pthread_mutex_lock(&wk->lock);
+
+	for(;;) {
+
+		while((wk->qcount == 0) && (wk->stop == 0)) pthread_cond_wait(&wk->work, &wk->lock);
+
+		if (wk->stop == 1) break;
+
+		job = wk->queue[wk->qhead];
+
+		wk->qhead = (wk->qhead + 1) % wk->qsize;
+		wk->qcount-- ;
+
+		pthread_mutex_unlock(&wk->lock);
+
+		workers_run(&cc, &job);
+
+		pthread_mutex_lock(&wk->lock);
+
+		wk->finished[wk->nfinished++] = job;
+
+		pthread_cond_signal(&wk->done);
+
+	}
+
+	pthread_mutex_unlock(&wk->lock);
+
+	compress_free(&cc);
+
+	return NULL;
+
+}
+
+/*
+ * depth is the maximum number of simultaneous jobs.
+ */
+
+struct workers *workers_create(int method, int nthreads, int depth, size_t bufsize) {
+
+	struct workers *wk;
+	int i;
+
+	wk = malloc(sizeof(struct workers));
+
+	if (wk == NULL) return NULL;
+
+	memset(wk, 0, sizeof(struct workers));
+
+	wk->method = method;
+	wk->bufsize = bufsize;
+	wk->qsize = depth;
+
+	wk->queue = malloc(sizeof(struct workjob) * depth);
+	wk->finished = malloc(sizeof(struct workjob) * depth);
+	wk->threads = malloc(sizeof(pthread_t) * nthreads);
+
+	if ((wk->queue == NULL) || (wk->finished == NULL) || (wk->threads == NULL)) {
+
+		free(wk->queue);
+		free(wk->finished);
+		free(wk->threads);
+		free(wk);
+
+		errno = ENOMEM;
+
+		return NULL;
+
+	}
+
+	pthread_mutex_init(&wk->lock, NULL);
+	pthread_cond_init(&wk->work, NULL);
+	pthread_cond_init(&wk->done, NULL);
+
+	for(i = 0; i < nthreads; i++) {
+
+		errno = pthread_create(&wk->threads[i], NULL, workers_thread, wk);
+
+		if (errno != 0) {
+
+			workers_destroy(wk);
+
+			return NULL;
+
+		}
+
+		wk->nthreads++ ;
+
+	}
+
+	#ifdef AIOBLKCOPY_DEBUG
+	fprintf(stderr, "workers: %i threads, compression %s\n", nthreads, compress_name(method));
+	#endif
+
+	return wk;
+
+}
+
+void workers_destroy(struct workers *wk) {
+
+	int i;
+
+	pthread_mutex_lock(&wk->lock);
+
+	wk->stop = 1;
+
+	pthread_cond_broadcast(&wk->work);
+
+	pthread_mutex_unlock(&wk->lock);
+
+	for(i = 0; i < wk->nthreads; i++) pthread_join(wk->threads[i], NULL);
+
+	pthread_mutex_destroy(&wk->lock);
+	pthread_cond_destroy(&wk->work);
+	pthread_cond_destroy(&wk->done);
+
+	free(wk->queue);
+	free(wk->finished);
+	free(wk->threads);
+	free(wk);
+
+}
+
+int workers_queue(struct workers *wk, struct blkqueitem *item, int ops, uint64_t off) {
+
+	struct workjob *job;
+
+	pthread_mutex_lock(&wk->lock);
+
+	if (wk->pending == wk->qsize) {
+
+		pthread_mutex_unlock(&wk->lock);
+
+		errno = EAGAIN;
+
+		return -1;
+
+	}
+
+	item->retcode = EINPROGRESS;
+
+	job = &wk->queue[(wk->qhead + wk->qcount) % wk->qsize];
+
+	job->item = item;
+	job->ops = ops;
+	job->off = off;
+
+	wk->qcount++ ;
+	wk->pending++ ;
+
+	pthread_cond_signal(&wk->work);
+
+	pthread_mutex_unlock(&wk->lock);
+
+	return 0;
+
+}
+
+/*
+ * Like ioengine_reap(): retcode of finished items is set to 0 or errno and they are put on reaped list. UNPACK sets readyb to the unpacked length,
+ * PACK sets zlen to the packed length or 0 if the block isn't worth packing, HASH sets hash, HASHBACK sets hashback.
+ * If wait isn't zero and nothing is finished, waits for the first job. Returns number of finished jobs.
+ */
+
+int workers_reap(struct workers *wk, int wait) {
+
+	struct blkqueitem *item;
+	struct workjob *job;
+	int count;
+	int i;
+
+	pthread_mutex_lock(&wk->lock);
+
+	while((wait != 0) && (wk->nfinished == 0) && (wk->pending != 0)) pthread_cond_wait(&wk->done, &wk->lock);
+
+	count = wk->nfinished;
+
+	for(i = 0; i < count; i++) {
+
+		job = &wk->finished[i];
+		item = job->item;
+
+		itemlist_push(&wk->reaped, item);
+
+		if (job->res == -1) {
+
+			item->retcode = EPROTO;
+
+			continue;
+
+		}
+
+		item->retcode = 0;
+
+		if ((job->ops & WORK_UNPACK) != 0) item->readyb = job->res;
+		if ((job->ops & WORK_PACK) != 0) item->zlen = job->res;
+		if ((job->ops & WORK_HASH) != 0) item->hash = job->hash;
+		if ((job->ops & WORK_HASHBACK) != 0) item->hashback = job->hash;
+
+	}
+
+	wk->nfinished = 0;
+	wk->pending -= count;
+
+	pthread_mutex_unlock(&wk->lock);
+
+	return count;
+
+}
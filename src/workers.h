@@ -0,0 +1,131 @@
+/*
+ ============================================================================
+ Name        : workers.h
+ Author      : Nikita Staroverov
+ Version     : 1.0.0
+ Copyright   : GPLv2
+ Description : Asynchronous block copying tool, worker threads hashing and compressing blocks
+ ============================================================================
+ */
+
+/*
+Copyright (C) 2014  Nikita Staroverov
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef AIOBLKCOPY_WORKERS_H
+#define AIOBLKCOPY_WORKERS_H
+
+#include <stdint.h>
+#include <pthread.h>
+
+#include "aioblkcopy.h"
+
+/*
+ * Operations of one job, done in this order:
+ * WORK_UNPACK   - zlen bytes of zbuf are unpacked to buffer.
+ * WORK_HASH     - readyb bytes of buffer (or unpacked ones) are hashed.
+ * WORK_PACK     - readyb bytes of buffer are packed to zbuf.
+ * WORK_HASHBACK - blklen bytes of cmpbuf are hashed.
+ */
+#define WORK_UNPACK 1
+#define WORK_HASH 2
+#define WORK_PACK 4
+#define WORK_HASHBACK 8
+
+#define WORKERS_MAXTHREADS 64
+
+struct workjob {
+
+	struct blkqueitem *item;
+
+	int ops;
+
+	/*
+	 * Hash seed offset.
+	 */
+	uint64_t off;
+
+	/*
+	 * Results: length of unpacked or packed data or -1, hash.
+	 */
+	long long res;
+
+	uint64_t hash;
+
+};
+
+/*
+ * Worker threads of one copy stream. Workers touch only buffers of the item, its fields are set by reap().
+ */
+
+struct workers {
+
+	int method;
+
+	size_t bufsize;
+
+	int nthreads;
+
+	pthread_t *threads;
+
+	pthread_mutex_t lock;
+
+	/*
+	 * Signalled when a job is queued and when workers must stop.
+	 */
+	pthread_cond_t work;
+
+	pthread_cond_t done;
+
+	/*
+	 * Queued jobs in ring, finished jobs in array.
+	 */
+	struct workjob *queue;
+
+	int qsize;
+
+	int qhead;
+
+	int qcount;
+
+	struct workjob *finished;
+
+	int nfinished;
+
+	/*
+	 * Jobs queued and not reaped yet.
+	 */
+	int pending;
+
+	/*
+	 * Items finished by reap(), taken by the caller.
+	 */
+	struct itemlist reaped;
+
+	int stop;
+
+};
+
+struct workers *workers_create(int method, int nthreads, int depth, size_t bufsize);
+
+void workers_destroy(struct workers *wk);
+
+int workers_queue(struct workers *wk, struct blkqueitem *item, int ops, uint64_t off);
+
+int workers_reap(struct workers *wk, int wait);
+
+#endif
@@ -0,0 +1,165 @@
+/*
+ ============================================================================
+ Name        : zerocopy.c
+ Author      : Nikita Staroverov
+ Version     : 1.0.0
+ Copyright   : GPLv2
+ Description : Asynchronous block copying tool, kernel side copy without user buffers
+ ============================================================================
+ */
+
+/*
+Copyright (C) 2014  Nikita Staroverov
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include "zerocopy.h"
+#include "stats.h"
+
+/*
+ * copy_file_range() is asked for big pieces, a filesystem can clone them at once.
+ */
+#define ZEROCOPY_RANGECHUNK (1024 * 1024 * 1024)
+
+/*
+ * Chooses the method for descriptors, idirect and odirect tell whether they use O_DIRECT.
+ * Direct I/O queues stay the default for block devices.
+ */
+
+int zerocopy_method(int ifd, int idirect, int ofd, int odirect) {
+
+	struct stat ist;
+	struct stat ost;
+
+	if ((fstat(ifd, &ist) == -1) || (fstat(ofd, &ost) == -1)) return ZEROCOPY_NONE;
+
+	#ifdef HAVE_COPY_FILE_RANGE
+
+	if (S_ISREG(ist.st_mode) && S_ISREG(ost.st_mode)) return ZEROCOPY_RANGE;
+
+	#endif
+
+	#ifdef _GNU_SOURCE
+
+	if (S_ISFIFO(ist.st_mode) && (S_ISFIFO(ost.st_mode) || (odirect == 0))) return ZEROCOPY_SPLICE;
+
+	if (S_ISFIFO(ost.st_mode) && (idirect == 0)) return ZEROCOPY_SPLICE;
+
+	#endif
+
+	return ZEROCOPY_NONE;
+
+}
+
+/*
+ * Copies from current positions up to the end of input, splice() moves pieces of chunk bytes.
+ * Returns number of bytes copied or -1 on error. If the kernel refuses the method
+ * before anything is copied errno is EOPNOTSUPP, so the caller can copy the usual way.
+ * Bytes copied so far are kept in done for progress reporting. Copy stops with errno ECANCELED when stop is set.
+ */
+
+long long zerocopy_run(int ifd, int ofd, int method, size_t chunk, size_t *done, const int *stop) {
+
+	long long copied = 0;
+	int nodirect = 0;
+	ssize_t ret;
+
+	for(;;) {
+
+		if (STATS_GET(*stop) == 1) {
+
+			errno = ECANCELED;
+
+			return -1;
+
+		}
+
+		switch(method) {
+
+		#ifdef HAVE_COPY_FILE_RANGE
+
+		case ZEROCOPY_RANGE:
+
+			ret = copy_file_range(ifd, NULL, ofd, NULL, ZEROCOPY_RANGECHUNK, 0);
+			break;
+
+		#endif
+
+		#ifdef _GNU_SOURCE
+
+		case ZEROCOPY_SPLICE:
+
+			ret = splice(ifd, NULL, ofd, NULL, chunk, SPLICE_F_MOVE | SPLICE_F_MORE);
+			break;
+
+		#endif
+
+		default:
+
+			errno = EOPNOTSUPP;
+			return -1;
+
+		}
+
+		if (ret == 0) break;
+
+		if (ret == -1) {
+
+			if (errno == EINTR) continue;
+
+			/*
+			 * Direct io refuses the unaligned tail of the file, it is copied through page cache.
+			 */
+
+			if ((method == ZEROCOPY_RANGE) && (errno == EINVAL) && (copied != 0) && (nodirect == 0)) {
+
+				nodirect = 1;
+
+				if ((fcntl(ifd, F_SETFL, fcntl(ifd, F_GETFL) & ~O_DIRECT) == 0) && \
+						(fcntl(ofd, F_SETFL, fcntl(ofd, F_GETFL) & ~O_DIRECT) == 0)) continue;
+
+				errno = EINVAL;
+
+			}
+
+			if ((copied == 0) && ((errno == EINVAL) || (errno == EXDEV) || (errno == ENOSYS) || \
+					(errno == EOPNOTSUPP) || (errno == EBADF))) errno = EOPNOTSUPP;
+
+			#ifdef AIOBLKCOPY_DEBUG
+			fprintf(stderr, "zerocopy: method %i failed after %lld bytes: %s\n", method, copied, strerror(errno));
+			#endif
+
+			return -1;
+
+		}
+
+		copied += ret;
+
+		STATS_SET(*done, copied);
+
+	}
+
+	return copied;
+
+}
@@ -0,0 +1,47 @@
+/*
+ ============================================================================
+ Name        : zerocopy.h
+ Author      : Nikita Staroverov
+ Version     : 1.0.0
+ Copyright   : GPLv2
+ Description : Asynchronous block copying tool, kernel side copy without user buffers
+ ============================================================================
+ */
+
+/*
+Copyright (C) 2014  Nikita Staroverov
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef AIOBLKCOPY_ZEROCOPY_H
+#define AIOBLKCOPY_ZEROCOPY_H
+
+#include <sys/types.h>
+
+/*
+ * Ways of copying inside the kernel.
+ * ZEROCOPY_SPLICE - splice() when one side is a pipe and the other doesn't use O_DIRECT.
+ * ZEROCOPY_RANGE  - copy_file_range() between regular files, filesystems may reflink or copy on server.
+ */
+#define ZEROCOPY_NONE 0
+#define ZEROCOPY_SPLICE 1
+#define ZEROCOPY_RANGE 2
+
+int zerocopy_method(int ifd, int idirect, int ofd, int odirect);
+
+long long zerocopy_run(int ifd, int ofd, int method, size_t chunk, size_t *done, const int *stop);
+
+#endif